@@ -27,7 +27,7 @@
 #include "exec/helper-proto.h"
 #include "exec/cpu_ldst.h"
 #include "exec/exec-all.h"
-#include "exec/tb-hash.h"
+#include "exec/tb-lookup.h"
 #include "disas/disas.h"
 #include "exec/log.h"
 
@@ -149,22 +149,18 @@ void *HELPER(lookup_tb_ptr)(CPUArchState *env, target_ulong addr)
     CPUState *cpu = ENV_GET_CPU(env);
     TranslationBlock *tb;
     target_ulong cs_base, pc;
-    uint32_t flags, addr_hash;
+    uint32_t flags;
 
-    addr_hash = tb_jmp_cache_hash_func(addr);
-    tb = atomic_rcu_read(&cpu->tb_jmp_cache[addr_hash]);
     cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
 
-    if (unlikely(!(tb
-                   && tb->pc == addr
-                   && tb->cs_base == cs_base
-                   && tb->flags == flags
-                   && tb->trace_vcpu_dstate == *cpu->trace_dstate))) {
+    /* Try every way of the jump cache before the much slower hash table */
+    tb = tb_jmp_cache_lookup(cpu, addr, cs_base, flags);
+    if (unlikely(!tb)) {
         tb = tb_htable_lookup(cpu, addr, cs_base, flags);
         if (!tb) {
             return tcg_ctx.code_gen_epilogue;
         }
-        atomic_set(&cpu->tb_jmp_cache[addr_hash], tb);
+        tb_jmp_cache_insert(cpu, addr, tb);
     }
 
     qemu_log_mask_and_addr(CPU_LOG_EXEC, addr,
@@ -174,6 +170,11 @@ void *HELPER(lookup_tb_ptr)(CPUArchState *env, target_ulong addr)
     return tb->tc_ptr;
 }
 
+void HELPER(tb_trace_hot)(CPUArchState *env, void *tb)
+{
+    tb_trace_hot(ENV_GET_CPU(env), tb);
+}
+
 void HELPER(exit_atomic)(CPUArchState *env)
 {
     cpu_loop_exit_atomic(ENV_GET_CPU(env), GETPC());
@@ -239,6 +239,8 @@ void tb_lock_reset(void)
 }
 
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr);
+static void do_tb_phys_invalidate(TranslationBlock *tb,
+                                  tb_page_addr_t page_addr);
 
 void cpu_gen_init(void)
 {
@@ -820,15 +822,72 @@ static inline void code_gen_alloc(size_t tb_size)
         exit(1);
     }
 
-    /* size this conservatively -- realloc later if needed */
-    tcg_ctx.tb_ctx.tbs_size =
-        tcg_ctx.code_gen_buffer_size / CODE_GEN_AVG_BLOCK_SIZE / 8;
-    if (unlikely(!tcg_ctx.tb_ctx.tbs_size)) {
-        tcg_ctx.tb_ctx.tbs_size = 64 * 1024;
+    qemu_mutex_init(&tcg_ctx.tb_ctx.tb_lock);
+}
+
+/* Make region @idx the one new code is generated into.  The fill pointer
+ * of the previous region must have been saved by the caller.
+ */
+static void tb_region_set_current(size_t idx)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r = &ctx->regions[idx];
+
+    ctx->cur_region = idx;
+    tcg_ctx.code_gen_ptr = r->ptr;
+    /* Leave the same slack as tcg_prologue_init does for the buffer */
+    tcg_ctx.code_gen_highwater = r->end - 1024;
+}
+
+/*
+ * Split what follows the prologue in code_gen_buffer into regions.  This
+ * must wait until the prologue is generated, so do it on the first TB
+ * allocation.
+ *
+ * Called with tb_lock held.
+ */
+static void tb_regions_init(void)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    size_t i, n, size;
+
+    n = tcg_ctx.code_gen_buffer_size / TB_REGION_MIN_SIZE;
+    n = MIN(MAX(n, 1), TB_REGIONS_MAX);
+    size = tcg_ctx.code_gen_buffer_size / n;
+
+    for (i = 0; i < n; i++) {
+        TBRegion *r = &ctx->regions[i];
+
+        r->start = tcg_ctx.code_gen_buffer + i * size;
+        r->end = i == n - 1 ?
+            tcg_ctx.code_gen_buffer + tcg_ctx.code_gen_buffer_size :
+            r->start + size;
+        r->ptr = r->start;
+        /* size this conservatively -- realloc later if needed */
+        r->tbs_size = MAX(size / CODE_GEN_AVG_BLOCK_SIZE / 8, 1024);
+        r->tbs = g_new(TranslationBlock *, r->tbs_size);
+        r->nb_tbs = 0;
     }
-    tcg_ctx.tb_ctx.tbs = g_new(TranslationBlock *, tcg_ctx.tb_ctx.tbs_size);
+    ctx->n_regions = n;
+    tb_region_set_current(0);
+}
 
-    qemu_mutex_init(&tcg_ctx.tb_ctx.tb_lock);
+/* Bytes of generated code currently held in code_gen_buffer */
+static size_t tb_code_size(void)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    size_t i, size = 0;
+
+    if (!ctx->n_regions) {
+        return tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer;
+    }
+    for (i = 0; i < ctx->n_regions; i++) {
+        TBRegion *r = &ctx->regions[i];
+        void *ptr = i == ctx->cur_region ? tcg_ctx.code_gen_ptr : r->ptr;
+
+        size += ptr - r->start;
+    }
+    return size;
 }
 
 static void tb_htable_init(void)
@@ -865,20 +924,25 @@ static TranslationBlock *tb_alloc(target_ulong pc)
 {
     PTH_UPDATE_CONTEXT
     TranslationBlock *tb;
-    TBContext *ctx;
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r;
 
     assert_tb_locked();
 
+    if (unlikely(!ctx->n_regions)) {
+        tb_regions_init();
+    }
     tb = tcg_tb_alloc(&tcg_ctx);
     if (unlikely(tb == NULL)) {
         return NULL;
     }
-    ctx = &tcg_ctx.tb_ctx;
-    if (unlikely(ctx->nb_tbs == ctx->tbs_size)) {
-        ctx->tbs_size *= 2;
-        ctx->tbs = g_renew(TranslationBlock *, ctx->tbs, ctx->tbs_size);
+    r = &ctx->regions[ctx->cur_region];
+    if (unlikely(r->nb_tbs == r->tbs_size)) {
+        r->tbs_size *= 2;
+        r->tbs = g_renew(TranslationBlock *, r->tbs, r->tbs_size);
     }
-    ctx->tbs[ctx->nb_tbs++] = tb;
+    r->tbs[r->nb_tbs++] = tb;
+    ctx->nb_tbs++;
     return tb;
 }
 
@@ -886,16 +950,18 @@ static TranslationBlock *tb_alloc(target_ulong pc)
 void tb_free(TranslationBlock *tb)
 {
     PTH_UPDATE_CONTEXT
+    TBRegion *r = &tcg_ctx.tb_ctx.regions[tcg_ctx.tb_ctx.cur_region];
+
     assert_tb_locked();
 
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (tcg_ctx.tb_ctx.nb_tbs > 0 &&
-            tb == tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs - 1]) {
+    if (r->nb_tbs > 0 && tb == r->tbs[r->nb_tbs - 1]) {
         size_t struct_size = ROUND_UP(sizeof(*tb), qemu_icache_linesize);
 
         tcg_ctx.code_gen_ptr = tb->tc_ptr - struct_size;
+        r->nb_tbs--;
         tcg_ctx.tb_ctx.nb_tbs--;
     }
 }
@@ -945,6 +1011,9 @@ static void page_flush_tb(void)
 /* flush all the translation blocks */
 static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 {
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    size_t i;
+
     tb_lock();
 
     /* If it is already been done on request of another CPU,
@@ -974,7 +1043,15 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     qht_reset_size(&tcg_ctx.tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
     page_flush_tb();
 
-    tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
+    for (i = 0; i < ctx->n_regions; i++) {
+        ctx->regions[i].nb_tbs = 0;
+        ctx->regions[i].ptr = ctx->regions[i].start;
+    }
+    if (ctx->n_regions) {
+        tb_region_set_current(0);
+    } else {
+        tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
+    }
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
     atomic_mb_set(&tcg_ctx.tb_ctx.tb_flush_count,
@@ -993,6 +1070,126 @@ void tb_flush(CPUState *cpu)
     }
 }
 
+/* Count the TBs of @r executed since the last eviction, and start
+ * counting again.
+ */
+static int tb_region_used(TBRegion *r)
+{
+    int i, used = 0;
+
+    for (i = 0; i < r->nb_tbs; i++) {
+        TranslationBlock *tb = r->tbs[i];
+
+        if (atomic_read(&tb->used)) {
+            atomic_set(&tb->used, 0);
+            used++;
+        }
+    }
+    return used;
+}
+
+/* Pick the region to reclaim: the one whose code ran least since the last
+ * eviction, so that regions holding hot TBs are kept and their code needs
+ * no retranslation.  Ties go to the oldest region, i.e. the first after the
+ * current one, which makes this plain FIFO for code that is never reused.
+ */
+static size_t tb_region_victim(void)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    size_t i, idx, victim = 0;
+    int used, min_used = INT_MAX;
+
+    for (i = 1; i < ctx->n_regions; i++) {
+        idx = (ctx->cur_region + i) % ctx->n_regions;
+        used = tb_region_used(&ctx->regions[idx]);
+        if (used < min_used) {
+            min_used = used;
+            victim = idx;
+        }
+    }
+    return victim;
+}
+
+/* Reclaim the least used code region other than the current one, and
+ * continue generating code there.  Only the TBs of that region are
+ * unlinked; everything translated into the other regions stays.
+ */
+static void do_tb_evict_region(CPUState *cpu, run_on_cpu_data tb_evict_count)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r;
+    size_t victim;
+    int i;
+
+    tb_lock();
+
+    /* If it is already been done on request of another CPU,
+     * just retry.
+     */
+    if (ctx->tb_evict_count != tb_evict_count.host_int) {
+        goto done;
+    }
+
+    victim = tb_region_victim();
+    if (victim != (ctx->cur_region + 1) % ctx->n_regions) {
+        ctx->tb_evict_kept++;
+    }
+    r = &ctx->regions[victim];
+    for (i = 0; i < r->nb_tbs; i++) {
+        TranslationBlock *tb = r->tbs[i];
+
+        if (!atomic_read(&tb->invalid)) {
+            do_tb_phys_invalidate(tb, -1);
+        }
+    }
+    ctx->nb_tbs -= r->nb_tbs;
+    ctx->tb_evicted_tbs += r->nb_tbs;
+    r->nb_tbs = 0;
+    r->ptr = r->start;
+
+    ctx->regions[ctx->cur_region].ptr = tcg_ctx.code_gen_ptr;
+    tb_region_set_current(victim);
+
+    atomic_mb_set(&ctx->tb_evict_count, ctx->tb_evict_count + 1);
+
+done:
+    tb_unlock();
+}
+
+/*
+ * The current code region is full.  If the next one is empty, nobody can be
+ * executing from it and we switch to it right away, returning true.
+ * Otherwise a region must be evicted first, which is done once all vCPUs
+ * have left the execution loop; with a single region this degrades to a
+ * full tb_flush.
+ *
+ * Called with tb_lock held.
+ */
+static bool tb_region_advance(CPUState *cpu)
+{
+    PTH_UPDATE_CONTEXT
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    size_t next;
+
+    assert_tb_locked();
+
+    if (ctx->n_regions <= 1) {
+        tb_flush(cpu);
+        return false;
+    }
+
+    next = (ctx->cur_region + 1) % ctx->n_regions;
+    if (ctx->regions[next].nb_tbs == 0) {
+        ctx->regions[ctx->cur_region].ptr = tcg_ctx.code_gen_ptr;
+        tb_region_set_current(next);
+        return true;
+    }
+
+    async_safe_run_on_cpu(cpu, do_tb_evict_region,
+                          RUN_ON_CPU_HOST_INT(atomic_mb_read(&ctx->tb_evict_count)));
+    return false;
+}
+
 #ifdef DEBUG_TB_CHECK
 
 static void
@@ -1119,12 +1316,14 @@ static inline void tb_jmp_unlink(TranslationBlock *tb)
  *
  * Called with tb_lock held.
  */
-void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
+static void do_tb_phys_invalidate(TranslationBlock *tb,
+                                  tb_page_addr_t page_addr)
 {
     PTH_UPDATE_CONTEXT
     CPUState *cpu;
     PageDesc *p;
     uint32_t h;
+    int i;
     tb_page_addr_t phys_pc;
 
     assert_tb_locked();
@@ -1149,10 +1348,12 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
 
     /* remove the TB from the hash list */
-    h = tb_jmp_cache_hash_func(tb->pc);
+    h = tb_jmp_cache_hash_func(tb->pc) * TB_JMP_CACHE_WAYS;
     CPU_FOREACH(cpu) {
-        if (atomic_read(&cpu->tb_jmp_cache[h]) == tb) {
-            atomic_set(&cpu->tb_jmp_cache[h], NULL);
+        for (i = 0; i < TB_JMP_CACHE_WAYS; i++) {
+            if (atomic_read(&cpu->tb_jmp_cache[h + i]) == tb) {
+                atomic_set(&cpu->tb_jmp_cache[h + i], NULL);
+            }
         }
     }
 
@@ -1162,10 +1363,33 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 
     /* suppress any remaining jumps to this TB */
     tb_jmp_unlink(tb);
+}
 
+void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
+{
+    do_tb_phys_invalidate(tb, page_addr);
     tcg_ctx.tb_ctx.tb_phys_invalidate_count++;
 }
 
+/* Called from generated code once the trace counter of @tb reaches
+ * TB_TRACE_THRESHOLD.  Drop @tb from the lookup structures so that the
+ * next lookup of its pc on this vCPU retranslates it as a superblock.
+ * The old code stays in the buffer, so any vCPU still running it (this
+ * one included) finishes normally.
+ */
+void tb_trace_hot(CPUState *cpu, TranslationBlock *tb)
+{
+    mmap_lock();
+    tb_lock();
+    if (!tb->invalid) {
+        do_tb_phys_invalidate(tb, -1);
+        cpu->trace_pc = tb->pc;
+        cpu->trace_pending = true;
+    }
+    tb_unlock();
+    mmap_unlock();
+}
+
 #ifdef CONFIG_SOFTMMU
 static void build_page_bitmap(PageDesc *p)
 {
@@ -1309,12 +1533,24 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if (use_icount && !(cflags & CF_IGNORE_ICOUNT)) {
         cflags |= CF_USE_ICOUNT;
     }
+    /* Side exits would leave icount accounting for the whole trace,
+     * so superblocks are only formed without it.
+     */
+    if (unlikely(cpu->trace_pending) && cpu->trace_pc == pc &&
+        !(cflags & (CF_LAST_IO | CF_NOCACHE | CF_USE_ICOUNT))) {
+        cpu->trace_pending = false;
+        cflags |= CF_TRACE;
+        tcg_ctx.tb_ctx.tb_trace_count++;
+    }
 
+retry:
     tb = tb_alloc(pc);
     if (unlikely(!tb)) {
  buffer_overflow:
-        /* flush must be done */
-        tb_flush(cpu);
+        /* move on to the next code region, evicting it if needed */
+        if (tb_region_advance(cpu)) {
+            goto retry;
+        }
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -1329,6 +1565,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
     tb->invalid = false;
+    tb->used = 0;
+    tb->exec_count = 0;
 
 #ifdef CONFIG_PROFILER
     tcg_ctx.tb_count1++; /* includes aborted translations because of
@@ -1369,10 +1607,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
        re-initialize it per above, and re-do the actual code generation.  */
     gen_code_size = tcg_gen_code(&tcg_ctx, tb);
     if (unlikely(gen_code_size < 0)) {
+        tb_free(tb);
         goto buffer_overflow;
     }
     search_size = encode_search(tb, (void *)gen_code_buf + gen_code_size);
     if (unlikely(search_size < 0)) {
+        tb_free(tb);
         goto buffer_overflow;
     }
 
@@ -1720,23 +1960,32 @@ static bool tb_invalidate_phys_page(tb_page_addr_t addr, uintptr_t pc)
    tb[1].tc_ptr. Return NULL if not found */
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
 {
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r = NULL;
     int m_min, m_max, m;
     uintptr_t v;
     TranslationBlock *tb;
+    size_t i;
 
-    if (tcg_ctx.tb_ctx.nb_tbs <= 0) {
+    if (ctx->nb_tbs <= 0) {
         return NULL;
     }
-    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer ||
-        tc_ptr >= (uintptr_t)tcg_ctx.code_gen_ptr) {
+    for (i = 0; i < ctx->n_regions; i++) {
+        if (tc_ptr >= (uintptr_t)ctx->regions[i].start &&
+            tc_ptr < (uintptr_t)ctx->regions[i].end) {
+            r = &ctx->regions[i];
+            break;
+        }
+    }
+    if (r == NULL || r->nb_tbs == 0) {
         return NULL;
     }
     /* binary search (cf Knuth) */
     m_min = 0;
-    m_max = tcg_ctx.tb_ctx.nb_tbs - 1;
+    m_max = r->nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
-        tb = tcg_ctx.tb_ctx.tbs[m];
+        tb = r->tbs[m];
         v = (uintptr_t)tb->tc_ptr;
         if (v == tc_ptr) {
             return tb;
@@ -1746,7 +1995,7 @@ static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
             m_min = m + 1;
         }
     }
-    return tcg_ctx.tb_ctx.tbs[m_max];
+    return m_max >= 0 ? r->tbs[m_max] : NULL;
 }
 
 #if !defined(CONFIG_USER_ONLY)
@@ -1878,9 +2127,12 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
 
 static void tb_jmp_cache_clear_page(CPUState *cpu, target_ulong page_addr)
 {
-    unsigned int i, i0 = tb_jmp_cache_hash_page(page_addr);
+    unsigned int i, i0;
 
-    for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
+    i0 = tb_jmp_cache_hash_page(page_addr) * TB_JMP_CACHE_WAYS;
+
+    /* The sets of one page are contiguous, and so are their ways */
+    for (i = 0; i < TB_JMP_PAGE_SIZE * TB_JMP_CACHE_WAYS; i++) {
         atomic_set(&cpu->tb_jmp_cache[i0 + i], NULL);
     }
 }
@@ -1933,9 +2185,13 @@ static void print_qht_statistics(FILE *f, fprintf_function cpu_fprintf,
 
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
+    TBContext *ctx = &tcg_ctx.tb_ctx;
     int i, target_code_size, max_target_code_size;
-    int direct_jmp_count, direct_jmp2_count, cross_page;
+    int direct_jmp_count, direct_jmp2_count, cross_page, trace_tbs;
+    uint64_t jc_hits, jc_misses;
+    size_t r, code_size;
     TranslationBlock *tb;
+    CPUState *cpu;
     struct qht_stats hst;
 
     tb_lock();
@@ -1943,41 +2199,48 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     target_code_size = 0;
     max_target_code_size = 0;
     cross_page = 0;
+    trace_tbs = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
-        tb = tcg_ctx.tb_ctx.tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size) {
-            max_target_code_size = tb->size;
-        }
-        if (tb->page_addr[1] != -1) {
-            cross_page++;
-        }
-        if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
-            direct_jmp_count++;
-            if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
-                direct_jmp2_count++;
+    for (r = 0; r < ctx->n_regions; r++) {
+        for (i = 0; i < ctx->regions[r].nb_tbs; i++) {
+            tb = ctx->regions[r].tbs[i];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size) {
+                max_target_code_size = tb->size;
+            }
+            if (tb->page_addr[1] != -1) {
+                cross_page++;
+            }
+            if (tb->cflags & CF_TRACE) {
+                trace_tbs++;
+            }
+            if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
+                direct_jmp_count++;
+                if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
+    code_size = tb_code_size();
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
-    cpu_fprintf(f, "gen code size       %td/%zd\n",
-                tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer,
-                tcg_ctx.code_gen_highwater - tcg_ctx.code_gen_buffer);
+    cpu_fprintf(f, "gen code size       %zd/%zd\n",
+                code_size, tcg_ctx.code_gen_buffer_size);
+    cpu_fprintf(f, "code regions        %zd x %zd KiB (current %zd)\n",
+                ctx->n_regions,
+                ctx->n_regions ?
+                tcg_ctx.code_gen_buffer_size / ctx->n_regions / 1024 : 0,
+                ctx->cur_region);
     cpu_fprintf(f, "TB count            %d\n", tcg_ctx.tb_ctx.nb_tbs);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
             tcg_ctx.tb_ctx.nb_tbs ? target_code_size /
                     tcg_ctx.tb_ctx.nb_tbs : 0,
             max_target_code_size);
-    cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-            tcg_ctx.tb_ctx.nb_tbs ? (tcg_ctx.code_gen_ptr -
-                                     tcg_ctx.code_gen_buffer) /
-                                     tcg_ctx.tb_ctx.nb_tbs : 0,
-                target_code_size ? (double) (tcg_ctx.code_gen_ptr -
-                                             tcg_ctx.code_gen_buffer) /
-                                             target_code_size : 0);
+    cpu_fprintf(f, "TB avg host size    %zd bytes (expansion ratio: %0.1f)\n",
+            tcg_ctx.tb_ctx.nb_tbs ? code_size / tcg_ctx.tb_ctx.nb_tbs : 0,
+            target_code_size ? (double) code_size / target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n", cross_page,
             tcg_ctx.tb_ctx.nb_tbs ? (cross_page * 100) /
                                     tcg_ctx.tb_ctx.nb_tbs : 0);
@@ -1988,6 +2251,10 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                 direct_jmp2_count,
                 tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp2_count * 100) /
                         tcg_ctx.tb_ctx.nb_tbs : 0);
+    cpu_fprintf(f, "superblock TB count %d (%d%%, %d formed)\n", trace_tbs,
+                tcg_ctx.tb_ctx.nb_tbs ? (trace_tbs * 100) /
+                                        tcg_ctx.tb_ctx.nb_tbs : 0,
+                tcg_ctx.tb_ctx.tb_trace_count);
 
     qht_statistics_init(&tcg_ctx.tb_ctx.htable, &hst);
     print_qht_statistics(f, cpu_fprintf, hst);
@@ -1996,9 +2263,33 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %u\n",
             atomic_read(&tcg_ctx.tb_ctx.tb_flush_count));
+    cpu_fprintf(f, "TB evict count      %u regions, %" PRIu64 " TBs "
+                "(%u kept the oldest)\n",
+            atomic_read(&tcg_ctx.tb_ctx.tb_evict_count),
+            tcg_ctx.tb_ctx.tb_evicted_tbs, tcg_ctx.tb_ctx.tb_evict_kept);
     cpu_fprintf(f, "TB invalidate count %d\n",
             tcg_ctx.tb_ctx.tb_phys_invalidate_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+
+    cpu_fprintf(f, "\nTB jump cache:      %d sets x %d ways\n",
+                TB_JMP_CACHE_SIZE, TB_JMP_CACHE_WAYS);
+    jc_hits = jc_misses = 0;
+    CPU_FOREACH(cpu) {
+        /* Racy, but good enough for statistics */
+        uint64_t hits = cpu->tb_jmp_cache_hits;
+        uint64_t misses = cpu->tb_jmp_cache_misses;
+
+        cpu_fprintf(f, "  cpu %-3d            %" PRIu64 " hits, %" PRIu64
+                    " misses (%0.2f%% hit rate)\n", cpu->cpu_index,
+                    hits, misses,
+                    hits + misses ? hits * 100.0 / (hits + misses) : 0);
+        jc_hits += hits;
+        jc_misses += misses;
+    }
+    cpu_fprintf(f, "  total              %" PRIu64 " hits, %" PRIu64
+                " misses (%0.2f%% hit rate)\n", jc_hits, jc_misses,
+                jc_hits + jc_misses ?
+                jc_hits * 100.0 / (jc_hits + jc_misses) : 0);
     tcg_dump_info(f, cpu_fprintf);
 
     tb_unlock();
@@ -66,6 +66,8 @@ static QTAILQ_HEAD(, BlockDriverState) all_bdrv_states =
 static QLIST_HEAD(, BlockDriver) bdrv_drivers =
     QLIST_HEAD_INITIALIZER(bdrv_drivers);
 
+unsigned long bdrv_graph_generation;
+
 static BlockDriverState *bdrv_open_inherit(const char *filename,
                                            const char *reference,
                                            QDict *options, int flags,
@@ -478,6 +480,31 @@ int bdrv_create_file(const char *filename, QemuOpts *opts, Error **errp)
     return ret;
 }
 
+/* Make the image file @dst a copy of @src.  Protocols may share the storage
+ * of the two files, which makes the copy much cheaper than reading and
+ * writing the data.
+ */
+int bdrv_clone_file(const char *src, const char *dst, Error **errp)
+{
+    BlockDriver *drv;
+
+    drv = bdrv_find_protocol(dst, true, errp);
+    if (drv == NULL) {
+        return -ENOENT;
+    }
+    if (bdrv_find_protocol(src, true, NULL) != drv) {
+        error_setg(errp, "Cannot clone '%s' to a different protocol", src);
+        return -EXDEV;
+    }
+    if (!drv->bdrv_clone_file) {
+        error_setg(errp, "Protocol driver '%s' does not support cloning files",
+                   drv->format_name);
+        return -ENOTSUP;
+    }
+
+    return drv->bdrv_clone_file(src, dst, errp);
+}
+
 /**
  * Try to get @bs's logical and physical block size.
  * On success, store them in @bsz struct and return 0.
@@ -1974,6 +2001,7 @@ static void bdrv_replace_child_noperm(BdrvChild *child,
     }
 
     child->bs = new_bs;
+    atomic_inc(&bdrv_graph_generation);
 
     if (new_bs) {
         QLIST_INSERT_HEAD(&new_bs->parents, child, next_parent);
@@ -3381,6 +3409,7 @@ static void bdrv_delete(BlockDriverState *bs)
     }
     QTAILQ_REMOVE(&all_bdrv_states, bs, bs_list);
 
+    g_free(bs->latency_stats);
     g_free(bs);
 }
 
@@ -3594,6 +3623,7 @@ int bdrv_truncate(BdrvChild *child, int64_t offset, PreallocMode prealloc,
     bdrv_dirty_bitmap_truncate(bs, offset);
     bdrv_parent_cb_resize(bs);
     atomic_inc(&bs->write_gen);
+    atomic_inc(&bdrv_graph_generation);
     return ret;
 }
 
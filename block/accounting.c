@@ -27,6 +27,7 @@
 #include "block/accounting.h"
 #include "block/block_int.h"
 #include "qemu/timer.h"
+#include "qemu/host-utils.h"
 #include "sysemu/qtest.h"
 
 static QEMUClockType clock_type = QEMU_CLOCK_REALTIME;
@@ -183,3 +184,40 @@ double block_acct_queue_depth(BlockAcctTimedStats *stats,
 
     return (double) sum / elapsed;
 }
+
+int64_t block_latency_now(void)
+{
+    return qemu_clock_get_ns(clock_type);
+}
+
+void block_latency_account(BlockAcctLatency *stats, enum BlockAcctType type,
+                           enum BlockLatencyStage stage, int64_t ns)
+{
+    BlockAcctLatencyHist *hist;
+    int bin = 0;
+
+    assert(type < BLOCK_MAX_IOTYPE);
+    assert(stage < BLOCK_MAX_LATENCY_STAGE);
+
+    ns = MAX(ns, 0);
+    if (ns >= 1024) {
+        bin = MIN(63 - clz64(ns) - 9, BLOCK_LATENCY_BINS - 1);
+    }
+
+    hist = &stats->hist[type][stage];
+    hist->count++;
+    hist->total_ns += ns;
+    hist->max_ns = MAX(hist->max_ns, ns);
+    hist->bins[bin]++;
+}
+
+void block_latency_account_queue_depth(BlockAcctLatency *stats,
+                                       enum BlockAcctType type,
+                                       unsigned int depth)
+{
+    assert(type < BLOCK_MAX_IOTYPE);
+    assert(depth > 0);
+
+    stats->queue_depth[type][MIN(31 - clz32(depth),
+                                 BLOCK_QUEUE_DEPTH_BINS - 1)]++;
+}
@@ -67,6 +67,7 @@
  */
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qemu-common.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
 #include "block/block_int.h"
@@ -75,6 +76,7 @@
 #include "block/thread-pool.h"
 #include "qemu/iov.h"
 #include "block/raw-aio.h"
+#include "block/shared-cache.h"
 #include "qapi/qmp/qstring.h"
 
 #include "scsi/pr-manager.h"
@@ -111,6 +113,10 @@
 #ifndef FS_NOCOW_FL
 #define FS_NOCOW_FL                     0x00800000 /* Do not cow file */
 #endif
+#ifndef FICLONE
+#define FICLONE                         _IOW(0x94, 9, int)
+#endif
+#include <sys/syscall.h>
 #endif
 #if defined(CONFIG_FALLOCATE_PUNCH_HOLE) || defined(CONFIG_FALLOCATE_ZERO_RANGE)
 #include <linux/falloc.h>
@@ -180,6 +186,9 @@ do { \
 #define RAW_LOCK_PERM_BASE             100
 #define RAW_LOCK_SHARED_BASE           200
 
+/* Number of blocks a read that misses the shared cache fetches at most */
+#define RAW_SHARED_CACHE_MAX_RUN       16
+
 typedef struct BDRVRawState {
     int fd;
     int lock_fd;
@@ -204,6 +213,13 @@ typedef struct BDRVRawState {
     bool needs_alignment;
 
     PRManager *pr_mgr;
+
+    /* Read cache shared with other processes, for read-only files only */
+    SharedCache *shared_cache;
+    /* Size of the -shared-cache cache to attach once the file turns out to
+     * hold the base image of a backing chain, see raw_is_base_image()
+     */
+    uint64_t shared_cache_pending;
 } BDRVRawState;
 
 typedef struct BDRVRawReopenState {
@@ -456,10 +472,32 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_STRING,
             .help = "id of persistent reservation manager object (default: none)",
         },
+        {
+            .name = "shared-cache-size",
+            .type = QEMU_OPT_SIZE,
+            .help = "size of the read cache shared with other processes "
+                    "opening the same read-only file (default: that of "
+                    "-shared-cache for base images, else 0, none)",
+        },
         { /* end of list */ }
     },
 };
 
+static void raw_shared_cache_open(BDRVRawState *s, uint64_t size)
+{
+    Error *local_err = NULL;
+
+    if (!size) {
+        return;
+    }
+    /* The cache is an optimization only, the image works without it */
+    s->shared_cache = shared_cache_open(s->fd, size, &local_err);
+    if (local_err) {
+        warn_report("%s", error_get_pretty(local_err));
+        error_free(local_err);
+    }
+}
+
 static int raw_open_common(BlockDriverState *bs, QDict *options,
                            int bdrv_flags, int open_flags, Error **errp)
 {
@@ -472,6 +510,8 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     int fd, ret;
     struct stat st;
     OnOffAuto locking;
+    uint64_t shared_cache_size;
+    bool shared_cache_set;
 
     opts = qemu_opts_create(&raw_runtime_opts, NULL, 0, &error_abort);
     qemu_opts_absorb_qdict(opts, options, &local_err);
@@ -541,6 +581,9 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         }
     }
 
+    shared_cache_set = qemu_opt_get(opts, "shared-cache-size") != NULL;
+    shared_cache_size = qemu_opt_get_size(opts, "shared-cache-size", 0);
+
     s->open_flags = open_flags;
     raw_parse_flags(bdrv_flags, &s->open_flags);
 
@@ -604,6 +647,16 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         s->discard_zeroes = true;
         s->has_fallocate = true;
     }
+    if (S_ISREG(st.st_mode) && !(bdrv_flags & BDRV_O_RDWR)) {
+        if (shared_cache_set) {
+            raw_shared_cache_open(s, shared_cache_size);
+        } else {
+            /* Overlays are private to one VM, caching them would only fill
+             * /dev/shm; wait until the backing chain is put together.
+             */
+            s->shared_cache_pending = shared_cache_default_size;
+        }
+    }
     if (S_ISBLK(st.st_mode)) {
 #ifdef BLKDISCARDZEROES
         unsigned int arg;
@@ -913,6 +966,15 @@ static void raw_reopen_commit(BDRVReopenState *state)
     qemu_close(s->fd);
     s->fd = rs->fd;
 
+    /* Other processes must not see the data this one is about to write */
+    if (state->flags & BDRV_O_RDWR) {
+        if (s->shared_cache) {
+            shared_cache_close(s->shared_cache);
+            s->shared_cache = NULL;
+        }
+        s->shared_cache_pending = 0;
+    }
+
     g_free(state->opaque);
     state->opaque = NULL;
 }
@@ -1640,10 +1702,129 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
     return paio_submit_co(bs, s->fd, offset, qiov, bytes, type);
 }
 
+/* Serve a read from the shared cache, and fill the cache with the blocks
+ * missing from it.  Runs of missing blocks are read from the file at once,
+ * so that a cold cache does not split large requests into 64 KiB ones.
+ */
+static int coroutine_fn raw_co_preadv_shared(BlockDriverState *bs,
+                                             uint64_t offset, uint64_t bytes,
+                                             QEMUIOVector *qiov)
+{
+    BDRVRawState *s = bs->opaque;
+    SharedCache *c = s->shared_cache;
+    uint64_t nb_blocks = shared_cache_nb_blocks(c);
+    uint64_t end = offset + bytes;
+    uint64_t pos = offset;
+    QEMUIOVector local_qiov;
+    struct iovec iov;
+    uint8_t *buf = NULL;
+    int ret = 0;
+
+    while (pos < end) {
+        uint64_t block = pos >> SHARED_CACHE_BLOCK_BITS;
+        uint64_t block_offset = pos & (SHARED_CACHE_BLOCK_SIZE - 1);
+        uint64_t n, nb, i;
+
+        if (block >= nb_blocks) {
+            /* The partial block at the end of the file is never cached */
+            qemu_iovec_init(&local_qiov, qiov->niov);
+            qemu_iovec_concat(&local_qiov, qiov, pos - offset, end - pos);
+            ret = raw_co_prw(bs, pos, end - pos, &local_qiov, QEMU_AIO_READ);
+            qemu_iovec_destroy(&local_qiov);
+            break;
+        }
+
+        n = MIN(end - pos, SHARED_CACHE_BLOCK_SIZE - block_offset);
+        if (shared_cache_read(c, block, block_offset, n, qiov, pos - offset)) {
+            pos += n;
+            continue;
+        }
+
+        nb = 1;
+        while (nb < RAW_SHARED_CACHE_MAX_RUN && block + nb < nb_blocks &&
+               ((block + nb) << SHARED_CACHE_BLOCK_BITS) < end &&
+               !shared_cache_contains(c, block + nb)) {
+            nb++;
+        }
+
+        if (!buf) {
+            buf = qemu_try_blockalign(bs, RAW_SHARED_CACHE_MAX_RUN *
+                                          SHARED_CACHE_BLOCK_SIZE);
+            if (!buf) {
+                ret = -ENOMEM;
+                break;
+            }
+        }
+        iov.iov_base = buf;
+        iov.iov_len = nb << SHARED_CACHE_BLOCK_BITS;
+        qemu_iovec_init_external(&local_qiov, &iov, 1);
+        ret = raw_co_prw(bs, block << SHARED_CACHE_BLOCK_BITS, iov.iov_len,
+                         &local_qiov, QEMU_AIO_READ);
+        if (ret < 0) {
+            break;
+        }
+
+        for (i = 0; i < nb; i++) {
+            shared_cache_insert(c, block + i,
+                                buf + (i << SHARED_CACHE_BLOCK_BITS));
+        }
+
+        n = MIN(end, (block + nb) << SHARED_CACHE_BLOCK_BITS) - pos;
+        qemu_iovec_from_buf(qiov, pos - offset, buf + block_offset, n);
+        pos += n;
+    }
+
+    qemu_vfree(buf);
+    return ret;
+}
+
+/* Whether @bs holds the base image of a backing chain, i.e. is the file of
+ * a format node that is some node's backing file but has none itself.
+ * Returns 1 if so, 0 if it never will, and -1 if the chain is not complete
+ * yet: the format driver reads its header before it is attached anywhere.
+ */
+static int raw_is_base_image(BlockDriverState *bs)
+{
+    BdrvChild *c, *pc;
+    int ret = -1;
+
+    QLIST_FOREACH(c, &bs->parents, next_parent) {
+        BlockDriverState *format = c->opaque;
+
+        if (c->role != &child_file) {
+            continue;
+        }
+        if (format->backing) {
+            return 0;
+        }
+        QLIST_FOREACH(pc, &format->parents, next_parent) {
+            if (pc->role == &child_backing) {
+                ret = 1;
+            }
+        }
+    }
+    return ret;
+}
+
 static int coroutine_fn raw_co_preadv(BlockDriverState *bs, uint64_t offset,
                                       uint64_t bytes, QEMUIOVector *qiov,
                                       int flags)
 {
+    BDRVRawState *s = bs->opaque;
+
+    if (s->shared_cache_pending) {
+        int base = raw_is_base_image(bs);
+
+        if (base > 0) {
+            raw_shared_cache_open(s, s->shared_cache_pending);
+        }
+        if (base >= 0) {
+            s->shared_cache_pending = 0;
+        }
+    }
+    if (s->shared_cache) {
+        return raw_co_preadv_shared(bs, offset, bytes, qiov);
+    }
     return raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_READ);
 }
 
@@ -1692,6 +1873,10 @@ static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+    if (s->shared_cache) {
+        shared_cache_close(s->shared_cache);
+        s->shared_cache = NULL;
+    }
     if (s->fd >= 0) {
         qemu_close(s->fd);
         s->fd = -1;
@@ -2095,6 +2280,136 @@ out:
     return result;
 }
 
+static ssize_t qemu_copy_file_range(int in_fd, off_t *in_off, int out_fd,
+                                    off_t *out_off, size_t len)
+{
+#ifdef __NR_copy_file_range
+    return syscall(__NR_copy_file_range, in_fd, in_off, out_fd, out_off,
+                   len, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* Copy the first @size bytes of @src_fd to @dst_fd, in the kernel if it
+ * supports copy_file_range() between the two files.  Zero blocks are left
+ * as holes by the user space fallback.
+ */
+static int raw_copy_file_data(int src_fd, int dst_fd, off_t size)
+{
+    const size_t buf_size = 1024 * 1024;
+    off_t offset = 0;
+    uint8_t *buf;
+    int result = 0;
+
+    while (offset < size) {
+        off_t in_off = offset, out_off = offset;
+        ssize_t n = qemu_copy_file_range(src_fd, &in_off, dst_fd, &out_off,
+                                         size - offset);
+        if (n > 0) {
+            offset += n;
+        } else if (n == 0) {
+            /* The source shrank */
+            size = offset;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                   errno == EOPNOTSUPP) {
+            break;
+        } else {
+            return -errno;
+        }
+    }
+    if (offset == size) {
+        return 0;
+    }
+
+    buf = g_malloc(buf_size);
+    while (offset < size) {
+        size_t len = MIN(size - offset, buf_size);
+        ssize_t n = pread(src_fd, buf, len, offset);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            result = n < 0 ? -errno : -EIO;
+            break;
+        }
+        if (!buffer_is_zero(buf, n) &&
+            (lseek(dst_fd, offset, SEEK_SET) < 0 ||
+             qemu_write_full(dst_fd, buf, n) != n)) {
+            result = -errno;
+            break;
+        }
+        offset += n;
+    }
+    g_free(buf);
+
+    if (result == 0 && ftruncate(dst_fd, size) < 0) {
+        result = -errno;
+    }
+    return result;
+}
+
+/* Make @dst_name a copy of @src_name.  On filesystems with reflinks, such as
+ * Btrfs and XFS, the copy shares the extents of the source until either is
+ * written, so it takes constant time whatever the size of the file.
+ */
+static int raw_clone_file(const char *src_name, const char *dst_name,
+                          Error **errp)
+{
+    int src_fd, dst_fd;
+    struct stat st;
+    int result = 0;
+
+    strstart(src_name, "file:", &src_name);
+    strstart(dst_name, "file:", &dst_name);
+
+    src_fd = qemu_open(src_name, O_RDONLY | O_BINARY);
+    if (src_fd < 0) {
+        result = -errno;
+        error_setg_errno(errp, -result, "Could not open '%s'", src_name);
+        return result;
+    }
+    if (fstat(src_fd, &st) < 0) {
+        result = -errno;
+        error_setg_errno(errp, -result, "Could not stat '%s'", src_name);
+        goto out_close_src;
+    }
+
+    dst_fd = qemu_open(dst_name, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+                       0644);
+    if (dst_fd < 0) {
+        result = -errno;
+        error_setg_errno(errp, -result, "Could not create '%s'", dst_name);
+        goto out_close_src;
+    }
+
+#ifdef __linux__
+    if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+        trace_file_clone(src_name, dst_name, "reflink");
+        goto out_close;
+    }
+#endif
+
+    trace_file_clone(src_name, dst_name, "copy");
+    result = raw_copy_file_data(src_fd, dst_fd, st.st_size);
+    if (result < 0) {
+        error_setg_errno(errp, -result, "Could not copy '%s' to '%s'",
+                         src_name, dst_name);
+    }
+
+out_close:
+    if (qemu_close(dst_fd) != 0 && result == 0) {
+        result = -errno;
+        error_setg_errno(errp, -result, "Could not close '%s'", dst_name);
+    }
+out_close_src:
+    qemu_close(src_fd);
+    return result;
+}
+
 /*
  * Find allocation range in @bs around offset @start.
  * May change underlying file descriptor's file offset.
@@ -2332,6 +2647,7 @@ BlockDriver bdrv_file = {
     .bdrv_reopen_abort = raw_reopen_abort,
     .bdrv_close = raw_close,
     .bdrv_create = raw_create,
+    .bdrv_clone_file = raw_clone_file,
     .bdrv_has_zero_init = bdrv_has_zero_init_1,
     .bdrv_co_get_block_status = raw_co_get_block_status,
     .bdrv_co_pwrite_zeroes = raw_co_pwrite_zeroes,
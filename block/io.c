@@ -421,6 +421,8 @@ static void tracked_request_begin(BdrvTrackedRequest *req,
         .serialising    = false,
         .overlap_offset = offset,
         .overlap_bytes  = bytes,
+        .latency_start_ns  = -1,
+        .latency_driver_ns = -1,
     };
 
     qemu_co_queue_init(&req->wait_queue);
@@ -515,6 +517,75 @@ void bdrv_dec_in_flight(BlockDriverState *bs)
     bdrv_wakeup(bs);
 }
 
+/* Enabling the latency statistics of a node also resets them */
+void bdrv_latency_stats_enable(BlockDriverState *bs, bool enable)
+{
+    BlockAcctLatency *stats = bs->latency_stats;
+
+    if (!stats) {
+        if (!enable) {
+            return;
+        }
+        stats = g_new0(BlockAcctLatency, 1);
+        atomic_set(&bs->latency_stats, stats);
+    } else if (enable) {
+        atomic_set(&stats->enabled, false);
+        memset(stats->hist, 0, sizeof(stats->hist));
+        memset(stats->queue_depth, 0, sizeof(stats->queue_depth));
+    }
+    atomic_set(&stats->enabled, enable);
+}
+
+/* Start tracking the latency of a read or write request that has just been
+ * counted in bs->in_flight */
+static void bdrv_latency_submit(BdrvTrackedRequest *req,
+                                enum BlockAcctType type)
+{
+    BlockDriverState *bs = req->bs;
+    unsigned int in_flight;
+
+    req->latency_start_ns = bdrv_latency_start(bs);
+    if (req->latency_start_ns >= 0) {
+        in_flight = atomic_read(&bs->in_flight);
+        trace_bdrv_latency_submit(bs, type, in_flight);
+        block_latency_account_queue_depth(bs->latency_stats, type, in_flight);
+    }
+}
+
+/* The request is about to enter the driver for the first time */
+static void bdrv_latency_driver(BdrvTrackedRequest *req)
+{
+    if (req->latency_start_ns >= 0 && req->latency_driver_ns < 0) {
+        req->latency_driver_ns = block_latency_now();
+    }
+}
+
+static void bdrv_latency_done(BdrvTrackedRequest *req,
+                              enum BlockAcctType type)
+{
+    BlockAcctLatency *stats = req->bs->latency_stats;
+    int64_t now;
+
+    if (req->latency_start_ns < 0) {
+        return;
+    }
+
+    now = block_latency_now();
+    trace_bdrv_latency_done(req->bs, type, req->offset, req->bytes,
+                            now - req->latency_start_ns,
+                            req->latency_driver_ns >= 0
+                            ? req->latency_driver_ns - req->latency_start_ns
+                            : 0);
+    block_latency_account(stats, type, BLOCK_LATENCY_TOTAL,
+                          now - req->latency_start_ns);
+    if (req->latency_driver_ns >= 0) {
+        block_latency_account(stats, type, BLOCK_LATENCY_QUEUE,
+                              req->latency_driver_ns - req->latency_start_ns);
+        block_latency_account(stats, type, BLOCK_LATENCY_DRIVER,
+                              now - req->latency_driver_ns);
+    }
+}
+
 static bool coroutine_fn wait_serialising_requests(BdrvTrackedRequest *self)
 {
     BlockDriverState *bs = self->bs;
@@ -1105,6 +1176,11 @@ static int coroutine_fn bdrv_aligned_preadv(BdrvChild *child,
         wait_serialising_requests(req);
     }
 
+    /* The reads of a read-modify-write cycle are queueing for the write */
+    if (req->type == BDRV_TRACKED_READ) {
+        bdrv_latency_driver(req);
+    }
+
     if (flags & BDRV_REQ_COPY_ON_READ) {
         /* TODO: Simplify further once bdrv_is_allocated no longer
          * requires sector alignment */
@@ -1228,9 +1304,11 @@ int coroutine_fn bdrv_co_preadv(BdrvChild *child,
     }
 
     tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_READ);
+    bdrv_latency_submit(&req, BLOCK_ACCT_READ);
     ret = bdrv_aligned_preadv(child, &req, offset, bytes, align,
                               use_local_qiov ? &local_qiov : qiov,
                               flags);
+    bdrv_latency_done(&req, BLOCK_ACCT_READ);
     tracked_request_end(&req);
     bdrv_dec_in_flight(bs);
 
@@ -1398,6 +1476,7 @@ static int coroutine_fn bdrv_aligned_pwritev(BdrvChild *child,
 
     waited = wait_serialising_requests(req);
     assert(!waited || !req->serialising);
+    bdrv_latency_driver(req);
     assert(req->overlap_offset <= offset);
     assert(offset + bytes <= req->overlap_offset + req->overlap_bytes);
     assert(child->perm & BLK_PERM_WRITE);
@@ -1592,6 +1671,7 @@ int coroutine_fn bdrv_co_pwritev(BdrvChild *child,
      * only for bdrv_aligned_pwritev, but also for the reads of the RMW cycle.
      */
     tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_WRITE);
+    bdrv_latency_submit(&req, BLOCK_ACCT_WRITE);
 
     if (!qiov) {
         ret = bdrv_co_do_zero_pwritev(child, offset, bytes, flags, &req);
@@ -1686,6 +1766,7 @@ fail:
     qemu_vfree(head_buf);
     qemu_vfree(tail_buf);
 out:
+    bdrv_latency_done(&req, BLOCK_ACCT_WRITE);
     tracked_request_end(&req);
     bdrv_dec_in_flight(bs);
     return ret;
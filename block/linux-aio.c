@@ -15,18 +15,42 @@
 #include "block/raw-aio.h"
 #include "qemu/event_notifier.h"
 #include "qemu/coroutine.h"
+#include "qemu/error-report.h"
 
 #include <libaio.h>
 
+/* From linux/aio_abi.h, set by io_set_eventfd() */
+#ifndef IOCB_FLAG_RESFD
+#define IOCB_FLAG_RESFD (1 << 0)
+#endif
+
 /*
- * Queue size (per-device).
- *
- * XXX: eventually we need to communicate this to the guest and/or make it
- *      tunable by the guest.  If we get more outstanding requests at a time
- *      than this we will get EAGAIN from io_submit which is communicated to
- *      the guest as an I/O error.
+ * Queue size (per-AioContext), unless set with the aio-max-events property
+ * of the iothread.  Requests beyond it wait in the pending queue.  If the
+ * host limit in /proc/sys/fs/aio-max-nr does not allow for it, the old
+ * size of 128 is used instead.
+ */
+#define DEFAULT_MAX_EVENTS  1024
+#define FALLBACK_MAX_EVENTS 128
+
+/*
+ * Number of requests queued while plugged before they are submitted
+ * anyway, and the most requests passed to a single io_submit() call.
+ */
+#define DEFAULT_MAX_BATCH   32
+
+/*
+ * How soon the ring is looked at again for requests submitted while polling
+ * once polling has stopped.  The interval doubles up to the maximum while
+ * none of them completes.
  */
-#define MAX_EVENTS 128
+#define SILENT_REAP_MIN_NS  (10 * SCALE_US)
+#define SILENT_REAP_MAX_NS  (1 * SCALE_MS)
+
+/* Batch size histogram: bin 0 counts single requests, bin i up to 2^i
+ * requests, the last one AIO_MAX_BATCH_LIMIT.
+ */
+#define LAIO_BATCH_BINS     9
 
 struct qemu_laiocb {
     BlockAIOCB common;
@@ -61,6 +85,24 @@ struct LinuxAioState {
     QEMUBH *completion_bh;
     int event_idx;
     int event_max;
+
+    /* Size of the completion ring */
+    unsigned int max_events;
+
+    /* While the AioContext busy-polls, requests are submitted without an
+     * eventfd and their completions are only found by polling the ring.
+     * After polling stops, silent_timer reaps what is left of them.
+     */
+    bool poll_started;
+    unsigned int silent_in_flight;
+    QEMUTimer *silent_timer;
+    int64_t silent_reap_ns;
+
+    /* Statistics, see laio_get_stats() */
+    uint64_t submits;
+    uint64_t requests;
+    uint64_t silent_requests;
+    uint64_t batch_bins[LAIO_BATCH_BINS];
 };
 
 static void ioq_submit(LinuxAioState *s);
@@ -217,6 +259,9 @@ static void qemu_laio_process_completions(LinuxAioState *s)
 
             /* Change counters one-by-one because we can be nested. */
             s->io_q.in_flight--;
+            if (!(iocb->u.c.flags & IOCB_FLAG_RESFD)) {
+                s->silent_in_flight--;
+            }
             s->event_idx++;
             qemu_laio_process_completion(laiocb);
         }
@@ -249,6 +294,35 @@ static void qemu_laio_completion_bh(void *opaque)
     qemu_laio_process_completions_and_submit(s);
 }
 
+/* Requests submitted while polling do not signal the eventfd, so once
+ * polling has stopped nothing else wakes the event loop for them.
+ */
+static void qemu_laio_silent_timer_cb(void *opaque)
+{
+    LinuxAioState *s = opaque;
+    unsigned int silent_in_flight = s->silent_in_flight;
+
+    qemu_laio_process_completions_and_submit(s);
+
+    if (!s->silent_in_flight || s->poll_started) {
+        return;
+    }
+    if (s->silent_in_flight < silent_in_flight) {
+        s->silent_reap_ns = SILENT_REAP_MIN_NS;
+    } else {
+        s->silent_reap_ns = MIN(s->silent_reap_ns * 2, SILENT_REAP_MAX_NS);
+    }
+    timer_mod(s->silent_timer,
+              qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + s->silent_reap_ns);
+}
+
+static void qemu_laio_silent_timer_start(LinuxAioState *s)
+{
+    s->silent_reap_ns = SILENT_REAP_MIN_NS;
+    timer_mod(s->silent_timer,
+              qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + s->silent_reap_ns);
+}
+
 static void qemu_laio_completion_cb(EventNotifier *e)
 {
     LinuxAioState *s = container_of(e, LinuxAioState, e);
@@ -272,6 +346,24 @@ static bool qemu_laio_poll_cb(void *opaque)
     return true;
 }
 
+static void qemu_laio_poll_begin(EventNotifier *e)
+{
+    LinuxAioState *s = container_of(e, LinuxAioState, e);
+
+    s->poll_started = true;
+    timer_del(s->silent_timer);
+}
+
+static void qemu_laio_poll_end(EventNotifier *e)
+{
+    LinuxAioState *s = container_of(e, LinuxAioState, e);
+
+    s->poll_started = false;
+    if (s->silent_in_flight) {
+        qemu_laio_silent_timer_start(s);
+    }
+}
+
 static void laio_cancel(BlockAIOCB *blockacb)
 {
     struct qemu_laiocb *laiocb = (struct qemu_laiocb *)blockacb;
@@ -305,21 +397,49 @@ static void ioq_init(LaioQueue *io_q)
     io_q->blocked = false;
 }
 
+static unsigned int laio_max_batch(LinuxAioState *s)
+{
+    unsigned int max_batch = s->aio_context->aio_max_batch;
+
+    if (!max_batch) {
+        max_batch = DEFAULT_MAX_BATCH;
+    }
+
+    return MIN(max_batch, s->max_events);
+}
+
+static void laio_account_batch(LinuxAioState *s, int len)
+{
+    s->submits++;
+    s->requests += len;
+    if (s->poll_started) {
+        s->silent_requests += len;
+    }
+    s->batch_bins[len > 1 ? 32 - clz32(len - 1) : 0]++;
+}
+
 static void ioq_submit(LinuxAioState *s)
 {
     int ret, len;
     struct qemu_laiocb *aiocb;
-    struct iocb *iocbs[MAX_EVENTS];
+    struct iocb *iocbs[AIO_MAX_BATCH_LIMIT];
+    unsigned int max_batch = laio_max_batch(s);
     QSIMPLEQ_HEAD(, qemu_laiocb) completed;
 
     do {
-        if (s->io_q.in_flight >= MAX_EVENTS) {
+        if (s->io_q.in_flight >= s->max_events) {
             break;
         }
         len = 0;
         QSIMPLEQ_FOREACH(aiocb, &s->io_q.pending, next) {
+            if (s->poll_started) {
+                aiocb->iocb.u.c.flags &= ~IOCB_FLAG_RESFD;
+            } else {
+                io_set_eventfd(&aiocb->iocb, event_notifier_get_fd(&s->e));
+            }
             iocbs[len++] = &aiocb->iocb;
-            if (s->io_q.in_flight + len >= MAX_EVENTS) {
+            if (s->io_q.in_flight + len >= s->max_events ||
+                len >= max_batch) {
                 break;
             }
         }
@@ -340,6 +460,10 @@ static void ioq_submit(LinuxAioState *s)
 
         s->io_q.in_flight += ret;
         s->io_q.in_queue  -= ret;
+        if (s->poll_started) {
+            s->silent_in_flight += ret;
+        }
+        laio_account_batch(s, ret);
         aiocb = container_of(iocbs[ret - 1], struct qemu_laiocb, iocb);
         QSIMPLEQ_SPLIT_AFTER(&s->io_q.pending, aiocb, next, &completed);
     } while (ret == len && !QSIMPLEQ_EMPTY(&s->io_q.pending));
@@ -393,13 +517,13 @@ static int laio_do_submit(int fd, struct qemu_laiocb *laiocb, off_t offset,
                         __func__, type);
         return -EIO;
     }
-    io_set_eventfd(&laiocb->iocb, event_notifier_get_fd(&s->e));
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.pending, laiocb, next);
     s->io_q.in_queue++;
     if (!s->io_q.blocked &&
         (!s->io_q.plugged ||
-         s->io_q.in_flight + s->io_q.in_queue >= MAX_EVENTS)) {
+         s->io_q.in_flight + s->io_q.in_queue >= s->max_events ||
+         s->io_q.in_queue >= laio_max_batch(s))) {
         ioq_submit(s);
     }
 
@@ -458,6 +582,8 @@ void laio_detach_aio_context(LinuxAioState *s, AioContext *old_context)
 {
     aio_set_event_notifier(old_context, &s->e, false, NULL, NULL);
     qemu_bh_delete(s->completion_bh);
+    timer_del(s->silent_timer);
+    timer_free(s->silent_timer);
     s->aio_context = NULL;
 }
 
@@ -465,12 +591,23 @@ void laio_attach_aio_context(LinuxAioState *s, AioContext *new_context)
 {
     s->aio_context = new_context;
     s->completion_bh = aio_bh_new(new_context, qemu_laio_completion_bh, s);
+    s->silent_timer = aio_timer_new(new_context, QEMU_CLOCK_REALTIME, SCALE_NS,
+                                    qemu_laio_silent_timer_cb, s);
     aio_set_event_notifier(new_context, &s->e, false,
                            qemu_laio_completion_cb,
                            qemu_laio_poll_cb);
+    aio_set_event_notifier_poll(new_context, &s->e,
+                                qemu_laio_poll_begin,
+                                qemu_laio_poll_end);
+
+    /* The new context may not poll, so do not wait for its io_poll_end */
+    s->poll_started = false;
+    if (s->silent_in_flight) {
+        qemu_laio_silent_timer_start(s);
+    }
 }
 
-LinuxAioState *laio_init(void)
+LinuxAioState *laio_init(unsigned int max_events)
 {
     LinuxAioState *s;
 
@@ -479,8 +616,17 @@ LinuxAioState *laio_init(void)
         goto out_free_state;
     }
 
-    if (io_setup(MAX_EVENTS, &s->ctx) != 0) {
-        goto out_close_efd;
+    s->max_events = max_events ?: DEFAULT_MAX_EVENTS;
+    if (io_setup(s->max_events, &s->ctx) != 0) {
+        if (io_setup(FALLBACK_MAX_EVENTS, &s->ctx) != 0) {
+            goto out_close_efd;
+        }
+        if (max_events) {
+            error_report("Linux AIO queue depth %u exceeds the host limit "
+                         "(fs.aio-max-nr), using %d", max_events,
+                         FALLBACK_MAX_EVENTS);
+        }
+        s->max_events = FALLBACK_MAX_EVENTS;
     }
 
     ioq_init(&s->io_q);
@@ -504,3 +650,22 @@ void laio_cleanup(LinuxAioState *s)
     }
     g_free(s);
 }
+
+LinuxAioStats *laio_get_stats(LinuxAioState *s)
+{
+    LinuxAioStats *stats = g_new0(LinuxAioStats, 1);
+    intList **p = &stats->batch_sizes;
+    int i;
+
+    stats->queue_depth = s->max_events;
+    stats->in_flight = s->io_q.in_flight;
+    stats->submits = s->submits;
+    stats->requests = s->requests;
+    stats->polled_requests = s->silent_requests;
+    for (i = 0; i < LAIO_BATCH_BINS; i++) {
+        *p = g_new0(intList, 1);
+        (*p)->value = s->batch_bins[i];
+        p = &(*p)->next;
+    }
+    return stats;
+}
@@ -450,6 +450,67 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
     }
 }
 
+static BlockLatencyHistogram *
+bdrv_query_latency_histogram(BlockAcctLatency *stats,
+                             enum BlockAcctType type,
+                             enum BlockLatencyStage stage)
+{
+    BlockAcctLatencyHist *hist = &stats->hist[type][stage];
+    BlockLatencyHistogram *info = g_new0(BlockLatencyHistogram, 1);
+    intList **p_next = &info->bins;
+    int i;
+
+    info->count = hist->count;
+    info->total_ns = hist->total_ns;
+    info->max_ns = hist->max_ns;
+    for (i = 0; i < BLOCK_LATENCY_BINS; i++) {
+        *p_next = g_new0(intList, 1);
+        (*p_next)->value = hist->bins[i];
+        p_next = &(*p_next)->next;
+    }
+
+    return info;
+}
+
+static BlockLatencyOpStats *bdrv_query_latency_op_stats(
+    BlockAcctLatency *stats, enum BlockAcctType type)
+{
+    BlockLatencyOpStats *info = g_new0(BlockLatencyOpStats, 1);
+    intList **p_next = &info->queue_depth;
+    int i;
+
+    info->total = bdrv_query_latency_histogram(stats, type,
+                                               BLOCK_LATENCY_TOTAL);
+    info->queue = bdrv_query_latency_histogram(stats, type,
+                                               BLOCK_LATENCY_QUEUE);
+    info->driver = bdrv_query_latency_histogram(stats, type,
+                                                BLOCK_LATENCY_DRIVER);
+    info->lock = bdrv_query_latency_histogram(stats, type,
+                                              BLOCK_LATENCY_LOCK);
+    info->metadata = bdrv_query_latency_histogram(stats, type,
+                                                  BLOCK_LATENCY_METADATA);
+    info->data = bdrv_query_latency_histogram(stats, type,
+                                              BLOCK_LATENCY_DATA);
+    for (i = 0; i < BLOCK_QUEUE_DEPTH_BINS; i++) {
+        *p_next = g_new0(intList, 1);
+        (*p_next)->value = stats->queue_depth[type][i];
+        p_next = &(*p_next)->next;
+    }
+
+    return info;
+}
+
+static BlockLatencyStats *bdrv_query_latency_stats(BlockAcctLatency *stats)
+{
+    BlockLatencyStats *info = g_new0(BlockLatencyStats, 1);
+
+    info->enabled = stats->enabled;
+    info->rd = bdrv_query_latency_op_stats(stats, BLOCK_ACCT_READ);
+    info->wr = bdrv_query_latency_op_stats(stats, BLOCK_ACCT_WRITE);
+
+    return info;
+}
+
 static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
                                         bool blk_level)
 {
@@ -477,6 +538,16 @@ static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
 
     s->stats->wr_highest_offset = stat64_get(&bs->wr_highest_offset);
 
+    if (bs->drv && bs->drv->bdrv_get_specific_stats) {
+        s->has_driver_specific = true;
+        s->driver_specific = bs->drv->bdrv_get_specific_stats(bs);
+    }
+
+    if (bs->latency_stats) {
+        s->has_latency = true;
+        s->latency = bdrv_query_latency_stats(bs->latency_stats);
+    }
+
     if (bs->file) {
         s->has_parent = true;
         s->parent = bdrv_query_bds_stats(bs->file->bs, blk_level);
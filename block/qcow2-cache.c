@@ -25,6 +25,7 @@
 #include "qemu/osdep.h"
 #include "block/block_int.h"
 #include "qemu-common.h"
+#include "qemu/host-utils.h"
 #include "qcow2.h"
 #include "trace.h"
 
@@ -33,6 +34,10 @@ typedef struct Qcow2CachedTable {
     uint64_t lru_counter;
     int      ref;
     bool     dirty;
+    /* Next entry in the same hash bucket, or -1 */
+    int      hash_next;
+    /* Linked into Qcow2Cache.lru while ref == 0 */
+    QTAILQ_ENTRY(Qcow2CachedTable) lru_entry;
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
@@ -43,6 +48,18 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+
+    /* Cached tables by offset, chained through hash_next */
+    int                    *buckets;
+    unsigned                bucket_mask;
+    int                     used;
+
+    /* Unreferenced entries, free ones first, then least recently used */
+    QTAILQ_HEAD(, Qcow2CachedTable) lru;
+
+    uint64_t                hits;
+    uint64_t                misses;
+    uint64_t                evictions;
 };
 
 static inline void *qcow2_cache_get_table_addr(BlockDriverState *bs,
@@ -62,6 +79,64 @@ static inline int qcow2_cache_get_table_idx(BlockDriverState *bs,
     return idx;
 }
 
+static inline int *qcow2_cache_bucket(BlockDriverState *bs, Qcow2Cache *c,
+                                      uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    return &c->buckets[(offset >> s->cluster_bits) & c->bucket_mask];
+}
+
+static int qcow2_cache_find(BlockDriverState *bs, Qcow2Cache *c,
+                            uint64_t offset)
+{
+    int i = *qcow2_cache_bucket(bs, c, offset);
+
+    while (i >= 0 && c->entries[i].offset != offset) {
+        i = c->entries[i].hash_next;
+    }
+    return i;
+}
+
+static void qcow2_cache_set_offset(BlockDriverState *bs, Qcow2Cache *c,
+                                   int i, uint64_t offset)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+    int *p;
+
+    if (t->offset) {
+        p = qcow2_cache_bucket(bs, c, t->offset);
+        while (*p != i) {
+            assert(*p >= 0);
+            p = &c->entries[*p].hash_next;
+        }
+        *p = t->hash_next;
+        t->hash_next = -1;
+        c->used--;
+    }
+
+    t->offset = offset;
+    if (offset) {
+        p = qcow2_cache_bucket(bs, c, offset);
+        t->hash_next = *p;
+        *p = i;
+        c->used++;
+    }
+}
+
+/* Drop the table held by entry i, so that it is reused first */
+static void qcow2_cache_entry_forget(BlockDriverState *bs, Qcow2Cache *c,
+                                     int i)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    qcow2_cache_set_offset(bs, c, i, 0);
+    t->lru_counter = 0;
+    if (t->ref == 0) {
+        QTAILQ_REMOVE(&c->lru, t, lru_entry);
+        QTAILQ_INSERT_HEAD(&c->lru, t, lru_entry);
+    }
+}
+
 static void qcow2_cache_table_release(BlockDriverState *bs, Qcow2Cache *c,
                                       int i, int num_tables)
 {
@@ -99,8 +174,7 @@ void qcow2_cache_clean_unused(BlockDriverState *bs, Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
-            c->entries[i].lru_counter = 0;
+            qcow2_cache_entry_forget(bs, c, i);
             i++;
             to_clean++;
         }
@@ -117,18 +191,32 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables)
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    int i;
 
     c = g_new0(Qcow2Cache, 1);
     c->size = num_tables;
+    c->bucket_mask = pow2ceil(num_tables) - 1;
     c->entries = g_try_new0(Qcow2CachedTable, num_tables);
+    c->buckets = g_try_new(int, c->bucket_mask + 1);
+    /* Only the tables that are actually used get backed by memory */
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * s->cluster_size);
 
-    if (!c->entries || !c->table_array) {
+    if (!c->entries || !c->buckets || !c->table_array) {
         qemu_vfree(c->table_array);
+        g_free(c->buckets);
         g_free(c->entries);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    QTAILQ_INIT(&c->lru);
+    for (i = 0; i < num_tables; i++) {
+        c->entries[i].hash_next = -1;
+        QTAILQ_INSERT_TAIL(&c->lru, &c->entries[i], lru_entry);
+    }
+    for (i = 0; i <= c->bucket_mask; i++) {
+        c->buckets[i] = -1;
     }
 
     return c;
@@ -143,6 +231,7 @@ int qcow2_cache_destroy(BlockDriverState *bs, Qcow2Cache *c)
     }
 
     qemu_vfree(c->table_array);
+    g_free(c->buckets);
     g_free(c->entries);
     g_free(c);
 
@@ -293,8 +382,7 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
 
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
-        c->entries[i].offset = 0;
-        c->entries[i].lru_counter = 0;
+        qcow2_cache_entry_forget(bs, c, i);
     }
 
     qcow2_cache_table_release(bs, c, 0, c->size);
@@ -308,39 +396,33 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     uint64_t offset, void **table, bool read_from_disk)
 {
     BDRVQcow2State *s = bs->opaque;
+    Qcow2CachedTable *t;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     trace_qcow2_cache_get(qemu_coroutine_self(), c == s->l2_table_cache,
                           offset, read_from_disk);
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / s->cluster_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    i = qcow2_cache_find(bs, c, offset);
+    if (i >= 0) {
+        c->hits++;
+        goto found;
+    }
 
-    if (min_lru_index == -1) {
+    t = QTAILQ_FIRST(&c->lru);
+    if (t == NULL) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
+    i = t - c->entries;
+    c->misses++;
+    if (t->offset) {
+        c->evictions++;
+    }
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -351,7 +433,7 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    qcow2_cache_entry_forget(bs, c, i);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -365,11 +447,14 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
         }
     }
 
-    c->entries[i].offset = offset;
+    qcow2_cache_set_offset(bs, c, i, offset);
 
     /* And return the right table */
 found:
-    c->entries[i].ref++;
+    t = &c->entries[i];
+    if (t->ref++ == 0) {
+        QTAILQ_REMOVE(&c->lru, t, lru_entry);
+    }
     *table = qcow2_cache_get_table_addr(bs, c, i);
 
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
@@ -399,6 +484,7 @@ void qcow2_cache_put(BlockDriverState *bs, Qcow2Cache *c, void **table)
 
     if (c->entries[i].ref == 0) {
         c->entries[i].lru_counter = ++c->lru_counter;
+        QTAILQ_INSERT_TAIL(&c->lru, &c->entries[i], lru_entry);
     }
 
     assert(c->entries[i].ref >= 0);
@@ -407,22 +493,21 @@ void qcow2_cache_put(BlockDriverState *bs, Qcow2Cache *c, void **table)
 void qcow2_cache_entry_mark_dirty(BlockDriverState *bs, Qcow2Cache *c,
      void *table)
 {
+    BDRVQcow2State *s = bs->opaque;
     int i = qcow2_cache_get_table_idx(bs, c, table);
     assert(c->entries[i].offset != 0);
     c->entries[i].dirty = true;
+    if (c == s->l2_table_cache) {
+        qcow2_chain_changed(bs);
+    }
 }
 
 void *qcow2_cache_is_table_offset(BlockDriverState *bs, Qcow2Cache *c,
                                   uint64_t offset)
 {
-    int i;
+    int i = qcow2_cache_find(bs, c, offset);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(bs, c, i);
-        }
-    }
-    return NULL;
+    return i >= 0 ? qcow2_cache_get_table_addr(bs, c, i) : NULL;
 }
 
 void qcow2_cache_discard(BlockDriverState *bs, Qcow2Cache *c, void *table)
@@ -431,9 +516,22 @@ void qcow2_cache_discard(BlockDriverState *bs, Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
-    c->entries[i].lru_counter = 0;
+    qcow2_cache_entry_forget(bs, c, i);
     c->entries[i].dirty = false;
 
     qcow2_cache_table_release(bs, c, i, 1);
 }
+
+Qcow2CacheStats *qcow2_cache_get_stats(BlockDriverState *bs, Qcow2Cache *c)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CacheStats *stats = g_new0(Qcow2CacheStats, 1);
+
+    stats->size = (int64_t) c->size * s->cluster_size;
+    stats->used = (int64_t) c->used * s->cluster_size;
+    stats->hits = c->hits;
+    stats->misses = c->misses;
+    stats->evictions = c->evictions;
+
+    return stats;
+}
@@ -0,0 +1,280 @@
+/*
+ * qcow2 backing chain allocation index
+ *
+ * A read of a cluster that is unallocated in a qcow2 image recurses into its
+ * backing file.  With the deep chains of overlays left behind by repeated
+ * external snapshots, a read of an old cluster therefore walks the L1/L2
+ * tables of every layer until it reaches the one holding the data.
+ *
+ * The index remembers, for every cluster of the top image, which layer of
+ * its backing chain owns that cluster, so that reads can be sent straight
+ * to it.  Entries are filled lazily the first time a cluster is read
+ * through the chain.  Writes to the top image need no update, since the top
+ * image's own L2 tables are always looked up first.  The layers below are
+ * read-only in normal operation; if their mapping changes anyway (commit
+ * jobs, reopening after migration) or the block graph changes, the whole
+ * index is dropped and rebuilt on demand.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "block/block_int.h"
+#include "qcow2.h"
+
+#define QCOW2_CHAIN_PAGE_BITS   12
+#define QCOW2_CHAIN_PAGE_SIZE   (1 << QCOW2_CHAIN_PAGE_BITS)
+
+enum {
+    QCOW2_CHAIN_UNKNOWN = 0,    /* not looked up yet */
+    QCOW2_CHAIN_MIXED,          /* no single owner, use the normal path */
+    QCOW2_CHAIN_ZERO,           /* reads as zeroes */
+    QCOW2_CHAIN_LAYER0,         /* owned by layers[entry - LAYER0] */
+};
+
+#define QCOW2_CHAIN_MAX_LAYERS  (UINT16_MAX - QCOW2_CHAIN_LAYER0 + 1)
+
+struct Qcow2ChainIndex {
+    unsigned long graph_generation;
+    unsigned long generation;
+    /* layers[0] is bs->backing, each next one its predecessor's backing */
+    BdrvChild **layers;
+    int nb_layers;
+    uint64_t nb_clusters;
+    uint16_t **pages;
+};
+
+/* Bumped when the mapping of a qcow2 image used as a backing file changes */
+static unsigned long qcow2_chain_generation;
+
+void qcow2_chain_changed(BlockDriverState *bs)
+{
+    BdrvChild *c;
+
+    QLIST_FOREACH(c, &bs->parents, next_parent) {
+        if (c->role == &child_backing) {
+            atomic_inc(&qcow2_chain_generation);
+            return;
+        }
+    }
+}
+
+void qcow2_chain_index_free(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2ChainIndex *index = s->chain_index;
+    uint64_t i;
+
+    if (!index) {
+        return;
+    }
+    for (i = 0; i < DIV_ROUND_UP(index->nb_clusters, QCOW2_CHAIN_PAGE_SIZE);
+         i++) {
+        g_free(index->pages[i]);
+    }
+    g_free(index->pages);
+    g_free(index->layers);
+    g_free(index);
+    s->chain_index = NULL;
+}
+
+static bool qcow2_chain_index_valid(Qcow2ChainIndex *index)
+{
+    return index->graph_generation == atomic_read(&bdrv_graph_generation) &&
+           index->generation == atomic_read(&qcow2_chain_generation);
+}
+
+static Qcow2ChainIndex *qcow2_chain_index_get(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2ChainIndex *index = s->chain_index;
+    BdrvChild *child;
+    int n = 0;
+
+    if (index && qcow2_chain_index_valid(index)) {
+        return index;
+    }
+    qcow2_chain_index_free(bs);
+
+    index = g_new0(Qcow2ChainIndex, 1);
+    index->graph_generation = atomic_read(&bdrv_graph_generation);
+    index->generation = atomic_read(&qcow2_chain_generation);
+
+    /* The walk stops at the first layer that is not qcow2: reads that get
+     * there are simply forwarded to it.
+     */
+    for (child = bs->backing; child; child = child->bs->backing) {
+        if (n == QCOW2_CHAIN_MAX_LAYERS) {
+            break;
+        }
+        if (!(n & (n - 1))) {
+            index->layers = g_renew(BdrvChild *, index->layers,
+                                    n ? n * 2 : 1);
+        }
+        index->layers[n++] = child;
+        if (child->bs->drv != &bdrv_qcow2) {
+            break;
+        }
+    }
+    index->nb_layers = n;
+    index->nb_clusters = size_to_clusters(s, bs->total_sectors *
+                                             BDRV_SECTOR_SIZE);
+    index->pages = g_new0(uint16_t *,
+                          DIV_ROUND_UP(index->nb_clusters,
+                                       QCOW2_CHAIN_PAGE_SIZE));
+    s->chain_index = index;
+    return index;
+}
+
+/* Find the owner of the cluster at @offset, which must be unallocated in
+ * the top image.  An owner must hold the whole cluster, and every layer
+ * above it must have the whole cluster unallocated.
+ */
+static int coroutine_fn qcow2_chain_resolve(Qcow2ChainIndex *index,
+                                            uint64_t offset, uint64_t len)
+{
+    int i;
+
+    for (i = 0; i < index->nb_layers; i++) {
+        BlockDriverState *lbs = index->layers[i]->bs;
+        BDRVQcow2State *ls;
+        unsigned int bytes = len;
+        uint64_t cluster_offset;
+        int ret;
+
+        /* Past the end of a layer, the layer above reads zeroes */
+        if (offset + len > lbs->total_sectors * BDRV_SECTOR_SIZE) {
+            return QCOW2_CHAIN_MIXED;
+        }
+        if (lbs->drv != &bdrv_qcow2) {
+            return QCOW2_CHAIN_LAYER0 + i;
+        }
+
+        ls = lbs->opaque;
+        qemu_co_mutex_lock(&ls->lock);
+        ret = qcow2_get_cluster_offset(lbs, offset, &bytes, &cluster_offset);
+        qemu_co_mutex_unlock(&ls->lock);
+        if (ret < 0) {
+            return ret;
+        }
+        if (bytes < len) {
+            return QCOW2_CHAIN_MIXED;
+        }
+
+        switch (ret) {
+        case QCOW2_CLUSTER_UNALLOCATED:
+            if (!lbs->backing) {
+                return QCOW2_CHAIN_ZERO;
+            }
+            break;
+        case QCOW2_CLUSTER_ZERO_PLAIN:
+        case QCOW2_CLUSTER_ZERO_ALLOC:
+            return QCOW2_CHAIN_ZERO;
+        default:
+            return QCOW2_CHAIN_LAYER0 + i;
+        }
+    }
+
+    /* More layers than the index can hold: let the last one recurse */
+    return QCOW2_CHAIN_LAYER0 + index->nb_layers - 1;
+}
+
+static int coroutine_fn qcow2_chain_lookup(BlockDriverState *bs,
+                                           Qcow2ChainIndex *index,
+                                           uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t cluster = offset >> s->cluster_bits;
+    uint16_t **page;
+    uint16_t *entry;
+    int ret;
+
+    if (cluster >= index->nb_clusters || !index->nb_layers) {
+        return QCOW2_CHAIN_MIXED;
+    }
+    page = &index->pages[cluster >> QCOW2_CHAIN_PAGE_BITS];
+    if (!*page) {
+        *page = g_new0(uint16_t, QCOW2_CHAIN_PAGE_SIZE);
+    }
+    entry = &(*page)[cluster & (QCOW2_CHAIN_PAGE_SIZE - 1)];
+    if (*entry != QCOW2_CHAIN_UNKNOWN) {
+        return *entry;
+    }
+
+    ret = qcow2_chain_resolve(index, start_of_cluster(s, offset),
+                              MIN(s->cluster_size,
+                                  bs->total_sectors * BDRV_SECTOR_SIZE -
+                                  start_of_cluster(s, offset)));
+    /* The lookup may have yielded while the chain changed under it */
+    if (ret >= 0 && qcow2_chain_index_valid(index)) {
+        *entry = ret;
+    }
+    return ret;
+}
+
+/* Read @bytes at @offset from the backing chain of @bs into @qiov.  The
+ * range must be unallocated in @bs and lie within its backing file.
+ * Called with s->lock held; it is dropped while the data is read.
+ */
+int coroutine_fn qcow2_chain_read(BlockDriverState *bs, uint64_t offset,
+                                  uint64_t bytes, QEMUIOVector *qiov)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2ChainIndex *index = qcow2_chain_index_get(bs);
+    QEMUIOVector local_qiov;
+    uint64_t done = 0;
+    int ret = 0;
+
+    qemu_iovec_init(&local_qiov, qiov->niov);
+
+    while (done < bytes) {
+        uint64_t n = MIN(bytes - done,
+                         s->cluster_size - offset_into_cluster(s, offset));
+        BdrvChild *child;
+        int entry;
+
+        entry = qcow2_chain_lookup(bs, index, offset);
+        if (entry < 0) {
+            ret = entry;
+            break;
+        }
+        /* Merge following clusters with the same owner into one request */
+        while (done + n < bytes) {
+            ret = qcow2_chain_lookup(bs, index, offset + n);
+            if (ret != entry) {
+                break;
+            }
+            n = MIN(n + s->cluster_size, bytes - done);
+        }
+        if (ret < 0) {
+            break;
+        }
+
+        if (entry == QCOW2_CHAIN_ZERO) {
+            qemu_iovec_memset(qiov, done, 0, n);
+        } else {
+            child = entry == QCOW2_CHAIN_MIXED
+                    ? bs->backing : index->layers[entry - QCOW2_CHAIN_LAYER0];
+
+            qemu_iovec_reset(&local_qiov);
+            qemu_iovec_concat(&local_qiov, qiov, done, n);
+
+            qemu_co_mutex_unlock(&s->lock);
+            ret = bdrv_co_preadv(child, offset, n, &local_qiov, 0);
+            qemu_co_mutex_lock(&s->lock);
+            if (ret < 0) {
+                break;
+            }
+            /* The index may have been rebuilt while the lock was dropped */
+            index = qcow2_chain_index_get(bs);
+        }
+
+        ret = 0;
+        offset += n;
+        done += n;
+    }
+
+    qemu_iovec_destroy(&local_qiov);
+    return ret;
+}
@@ -69,7 +69,6 @@
 #include "block/block_int.h"
 #include "sysemu/block-backend.h"
 #include "qemu/module.h"
-#include <zlib.h>
 #include "block/qcow2.h"
 #include "qemu/error-report.h"
 #include "qapi/qmp/qerror.h"
@@ -716,6 +715,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_COMPRESS_THREADS,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of clusters compressed or decompressed in "
+                    "parallel",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -781,7 +786,7 @@ static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
                              uint64_t *refcount_cache_size, Error **errp)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t combined_cache_size;
+    uint64_t combined_cache_size, max_l2_cache;
     bool l2_cache_size_set, refcount_cache_size_set, combined_cache_size_set;
 
     combined_cache_size_set = qemu_opt_get(opts, QCOW2_OPT_CACHE_SIZE);
@@ -793,6 +798,11 @@ static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
     *refcount_cache_size = qemu_opt_get_size(opts,
                                              QCOW2_OPT_REFCOUNT_CACHE_SIZE, 0);
 
+    /* Enough L2 tables to map the whole image */
+    max_l2_cache = DIV_ROUND_UP(bs->total_sectors * BDRV_SECTOR_SIZE,
+                                s->cluster_size / sizeof(uint64_t));
+    max_l2_cache = ROUND_UP(max_l2_cache, s->cluster_size);
+
     if (combined_cache_size_set) {
         if (l2_cache_size_set && refcount_cache_size_set) {
             error_setg(errp, QCOW2_OPT_CACHE_SIZE ", " QCOW2_OPT_L2_CACHE_SIZE
@@ -820,11 +830,13 @@ static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
         }
     } else {
         if (!l2_cache_size_set && !refcount_cache_size_set) {
-            *l2_cache_size = MAX(DEFAULT_L2_CACHE_BYTE_SIZE,
+            *refcount_cache_size = MAX(DEFAULT_L2_CACHE_BYTE_SIZE,
+                                       (uint64_t)DEFAULT_L2_CACHE_CLUSTERS
+                                       * s->cluster_size)
+                                 / DEFAULT_L2_REFCOUNT_SIZE_RATIO;
+            *l2_cache_size = MAX(MIN(max_l2_cache, DEFAULT_L2_CACHE_MAX_SIZE),
                                  (uint64_t)DEFAULT_L2_CACHE_CLUSTERS
                                  * s->cluster_size);
-            *refcount_cache_size = *l2_cache_size
-                                 / DEFAULT_L2_REFCOUNT_SIZE_RATIO;
         } else if (!l2_cache_size_set) {
             *l2_cache_size = *refcount_cache_size
                            * DEFAULT_L2_REFCOUNT_SIZE_RATIO;
@@ -842,6 +854,7 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    uint64_t compress_threads;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -927,10 +940,13 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
-    /* New interval for cache cleanup timer */
+    /* New interval for cache cleanup timer.  A reopen that does not set it
+     * keeps the current one.
+     */
     r->cache_clean_interval =
         qemu_opt_get_number(opts, QCOW2_OPT_CACHE_CLEAN_INTERVAL,
-                            s->cache_clean_interval);
+                            s->l2_table_cache ? s->cache_clean_interval
+                                              : DEFAULT_CACHE_CLEAN_INTERVAL);
 #ifndef CONFIG_LINUX
     if (r->cache_clean_interval != 0) {
         error_setg(errp, QCOW2_OPT_CACHE_CLEAN_INTERVAL
@@ -945,6 +961,16 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    r->compress_threads =
+        qemu_opt_get_number(opts, QCOW2_OPT_COMPRESS_THREADS,
+                            QCOW2_DEFAULT_COMPRESS_THREADS);
+    if (r->compress_threads < 1 || r->compress_threads > QCOW2_MAX_THREADS) {
+        error_setg(errp, QCOW2_OPT_COMPRESS_THREADS
+                   " must be between 1 and %d", QCOW2_MAX_THREADS);
+        ret = -EINVAL;
+        goto fail;
+    }
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1096,6 +1122,9 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    /* Queued requests see a higher limit as soon as one of them finishes */
+    s->max_compress_threads = r->compress_threads;
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1404,7 +1433,6 @@ static int qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
-    s->cluster_cache_offset = -1;
     s->flags = flags;
 
     ret = qcow2_refcount_init(bs);
@@ -1504,6 +1532,7 @@ static int qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 
     /* Initialise locks */
     qemu_co_mutex_init(&s->lock);
+    qemu_co_queue_init(&s->compress_wait_queue);
     bs->supported_zero_flags = BDRV_REQ_MAY_UNMAP;
 
     /* Repair image if dirty */
@@ -1704,6 +1733,58 @@ static int64_t coroutine_fn qcow2_co_get_block_status(BlockDriverState *bs,
     return status;
 }
 
+/* Read @bytes at @offset_in_cluster of the compressed cluster described by
+ * the L2 entry @cluster_descriptor into @qiov.  The cluster is read and
+ * decompressed as a whole; decompression runs in the thread pool.  Called
+ * without s->lock.
+ */
+static int coroutine_fn
+qcow2_co_preadv_compressed(BlockDriverState *bs, uint64_t cluster_descriptor,
+                           int offset_in_cluster, uint64_t bytes,
+                           QEMUIOVector *qiov)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret, csize, nb_csectors;
+    uint64_t coffset;
+    uint8_t *buf, *out_buf;
+    struct iovec iov;
+    QEMUIOVector local_qiov;
+
+    coffset = cluster_descriptor & s->cluster_offset_mask;
+    nb_csectors = ((cluster_descriptor >> s->csize_shift) & s->csize_mask) + 1;
+    csize = nb_csectors * BDRV_SECTOR_SIZE -
+            (coffset & ~BDRV_SECTOR_MASK);
+
+    buf = g_try_malloc(csize);
+    if (!buf) {
+        return -ENOMEM;
+    }
+    iov.iov_base = buf;
+    iov.iov_len = csize;
+    qemu_iovec_init_external(&local_qiov, &iov, 1);
+
+    out_buf = qemu_blockalign(bs, s->cluster_size);
+
+    BLKDBG_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
+    ret = bdrv_co_preadv(bs->file, coffset, csize, &local_qiov, 0);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    if (qcow2_co_decompress(bs, out_buf, s->cluster_size, buf, csize) < 0) {
+        ret = -EIO;
+        goto fail;
+    }
+
+    qemu_iovec_from_buf(qiov, 0, out_buf + offset_in_cluster, bytes);
+
+fail:
+    qemu_vfree(out_buf);
+    g_free(buf);
+
+    return ret;
+}
+
 /* handle reading after the end of the backing file */
 int qcow2_backing_read1(BlockDriverState *bs, QEMUIOVector *qiov,
                         int64_t offset, int bytes)
@@ -1726,6 +1807,17 @@ int qcow2_backing_read1(BlockDriverState *bs, QEMUIOVector *qiov,
     return n1;
 }
 
+/* Take s->lock, accounting the wait to the latency of a request of @type */
+static void coroutine_fn qcow2_co_lock(BlockDriverState *bs,
+                                       enum BlockAcctType type)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int64_t start_ns = bdrv_latency_start(bs);
+
+    qemu_co_mutex_lock(&s->lock);
+    bdrv_latency_account(bs, type, BLOCK_LATENCY_LOCK, start_ns);
+}
+
 static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
                                         uint64_t bytes, QEMUIOVector *qiov,
                                         int flags)
@@ -1738,10 +1830,11 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
     uint64_t bytes_done = 0;
     QEMUIOVector hd_qiov;
     uint8_t *cluster_data = NULL;
+    int64_t start_ns;
 
     qemu_iovec_init(&hd_qiov, qiov->niov);
 
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(bs, BLOCK_ACCT_READ);
 
     while (bytes != 0) {
 
@@ -1752,7 +1845,10 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
                             QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size);
         }
 
+        start_ns = bdrv_latency_start(bs);
         ret = qcow2_get_cluster_offset(bs, offset, &cur_bytes, &cluster_offset);
+        bdrv_latency_account(bs, BLOCK_ACCT_READ, BLOCK_LATENCY_METADATA,
+                             start_ns);
         if (ret < 0) {
             goto fail;
         }
@@ -1770,19 +1866,11 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
                 n1 = qcow2_backing_read1(bs->backing->bs, &hd_qiov,
                                          offset, cur_bytes);
                 if (n1 > 0) {
-                    QEMUIOVector local_qiov;
-
-                    qemu_iovec_init(&local_qiov, hd_qiov.niov);
-                    qemu_iovec_concat(&local_qiov, &hd_qiov, 0, n1);
-
                     BLKDBG_EVENT(bs->file, BLKDBG_READ_BACKING_AIO);
-                    qemu_co_mutex_unlock(&s->lock);
-                    ret = bdrv_co_preadv(bs->backing, offset, n1,
-                                         &local_qiov, 0);
-                    qemu_co_mutex_lock(&s->lock);
-
-                    qemu_iovec_destroy(&local_qiov);
-
+                    start_ns = bdrv_latency_start(bs);
+                    ret = qcow2_chain_read(bs, offset, n1, &hd_qiov);
+                    bdrv_latency_account(bs, BLOCK_ACCT_READ,
+                                         BLOCK_LATENCY_DATA, start_ns);
                     if (ret < 0) {
                         goto fail;
                     }
@@ -1799,15 +1887,17 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
             break;
 
         case QCOW2_CLUSTER_COMPRESSED:
-            /* add AIO support for compressed blocks ? */
-            ret = qcow2_decompress_cluster(bs, cluster_offset);
+            qemu_co_mutex_unlock(&s->lock);
+            start_ns = bdrv_latency_start(bs);
+            ret = qcow2_co_preadv_compressed(bs, cluster_offset,
+                                             offset_in_cluster, cur_bytes,
+                                             &hd_qiov);
+            bdrv_latency_account(bs, BLOCK_ACCT_READ, BLOCK_LATENCY_DATA,
+                                 start_ns);
+            qcow2_co_lock(bs, BLOCK_ACCT_READ);
             if (ret < 0) {
                 goto fail;
             }
-
-            qemu_iovec_from_buf(&hd_qiov, 0,
-                                s->cluster_cache + offset_in_cluster,
-                                cur_bytes);
             break;
 
         case QCOW2_CLUSTER_NORMAL:
@@ -1841,10 +1931,13 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
 
             BLKDBG_EVENT(bs->file, BLKDBG_READ_AIO);
             qemu_co_mutex_unlock(&s->lock);
+            start_ns = bdrv_latency_start(bs);
             ret = bdrv_co_preadv(bs->file,
                                  cluster_offset + offset_in_cluster,
                                  cur_bytes, &hd_qiov, 0);
-            qemu_co_mutex_lock(&s->lock);
+            bdrv_latency_account(bs, BLOCK_ACCT_READ, BLOCK_LATENCY_DATA,
+                                 start_ns);
+            qcow2_co_lock(bs, BLOCK_ACCT_READ);
             if (ret < 0) {
                 goto fail;
             }
@@ -1938,14 +2031,13 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
     uint64_t bytes_done = 0;
     uint8_t *cluster_data = NULL;
     QCowL2Meta *l2meta = NULL;
+    int64_t start_ns;
 
     trace_qcow2_writev_start_req(qemu_coroutine_self(), offset, bytes);
 
     qemu_iovec_init(&hd_qiov, qiov->niov);
 
-    s->cluster_cache_offset = -1; /* disable compressed cache */
-
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(bs, BLOCK_ACCT_WRITE);
 
     while (bytes != 0) {
 
@@ -1960,8 +2052,11 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
                             - offset_in_cluster);
         }
 
+        start_ns = bdrv_latency_start(bs);
         ret = qcow2_alloc_cluster_offset(bs, offset, &cur_bytes,
                                          &cluster_offset, &l2meta);
+        bdrv_latency_account(bs, BLOCK_ACCT_WRITE, BLOCK_LATENCY_METADATA,
+                             start_ns);
         if (ret < 0) {
             goto fail;
         }
@@ -2016,15 +2111,20 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
             BLKDBG_EVENT(bs->file, BLKDBG_WRITE_AIO);
             trace_qcow2_writev_data(qemu_coroutine_self(),
                                     cluster_offset + offset_in_cluster);
+            start_ns = bdrv_latency_start(bs);
             ret = bdrv_co_pwritev(bs->file,
                                   cluster_offset + offset_in_cluster,
                                   cur_bytes, &hd_qiov, 0);
-            qemu_co_mutex_lock(&s->lock);
+            bdrv_latency_account(bs, BLOCK_ACCT_WRITE, BLOCK_LATENCY_DATA,
+                                 start_ns);
+            qcow2_co_lock(bs, BLOCK_ACCT_WRITE);
             if (ret < 0) {
                 goto fail;
             }
         }
 
+        /* Includes the guest data if it is written together with COW */
+        start_ns = bdrv_latency_start(bs);
         while (l2meta != NULL) {
             QCowL2Meta *next;
 
@@ -2044,6 +2144,8 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
             g_free(l2meta);
             l2meta = next;
         }
+        bdrv_latency_account(bs, BLOCK_ACCT_WRITE, BLOCK_LATENCY_METADATA,
+                             start_ns);
 
         bytes -= cur_bytes;
         offset += cur_bytes;
@@ -2134,10 +2236,9 @@ static void qcow2_close(BlockDriverState *bs)
     g_free(s->image_backing_file);
     g_free(s->image_backing_format);
 
-    g_free(s->cluster_cache);
-    qemu_vfree(s->cluster_data);
     qcow2_refcount_close(bs);
     qcow2_free_snapshots(bs);
+    qcow2_chain_index_free(bs);
 }
 
 static void qcow2_invalidate_cache(BlockDriverState *bs, Error **errp)
@@ -2158,6 +2259,7 @@ static void qcow2_invalidate_cache(BlockDriverState *bs, Error **errp)
     s->crypto = NULL;
 
     qcow2_close(bs);
+    qcow2_chain_changed(bs);
 
     memset(s, 0, sizeof(BDRVQcow2State));
     options = qdict_clone_shallow(bs->options);
@@ -3354,8 +3456,8 @@ qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
     BDRVQcow2State *s = bs->opaque;
     QEMUIOVector hd_qiov;
     struct iovec iov;
-    z_stream strm;
-    int ret, out_len;
+    ssize_t out_len;
+    int ret;
     uint8_t *buf, *out_buf;
     int64_t cluster_offset;
 
@@ -3384,38 +3486,18 @@ qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
 
     out_buf = g_malloc(s->cluster_size);
 
-    /* best compression, small window, no zlib header */
-    memset(&strm, 0, sizeof(strm));
-    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION,
-                       Z_DEFLATED, -12,
-                       9, Z_DEFAULT_STRATEGY);
-    if (ret != 0) {
-        ret = -EINVAL;
-        goto fail;
-    }
-
-    strm.avail_in = s->cluster_size;
-    strm.next_in = (uint8_t *)buf;
-    strm.avail_out = s->cluster_size;
-    strm.next_out = out_buf;
-
-    ret = deflate(&strm, Z_FINISH);
-    if (ret != Z_STREAM_END && ret != Z_OK) {
-        deflateEnd(&strm);
-        ret = -EINVAL;
-        goto fail;
-    }
-    out_len = strm.next_out - out_buf;
-
-    deflateEnd(&strm);
-
-    if (ret != Z_STREAM_END || out_len >= s->cluster_size) {
+    out_len = qcow2_co_compress(bs, out_buf, s->cluster_size - 1,
+                                buf, s->cluster_size);
+    if (out_len == -ENOMEM) {
         /* could not compress: write normal cluster */
         ret = qcow2_co_pwritev(bs, offset, bytes, qiov, 0);
         if (ret < 0) {
             goto fail;
         }
         goto success;
+    } else if (out_len < 0) {
+        ret = -EINVAL;
+        goto fail;
     }
 
     qemu_co_mutex_lock(&s->lock);
@@ -3613,6 +3695,7 @@ static int qcow2_make_empty(BlockDriverState *bs)
 
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / sizeof(uint64_t));
 
+    qcow2_chain_changed(bs);
     if (s->qcow_version >= 3 && !s->snapshots &&
         3 + l1_clusters <= s->refcount_block_size) {
         /* The following function only works for qcow2 v3 images (it requires
@@ -3809,6 +3892,24 @@ static int qcow2_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     return 0;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+
+    *stats = (BlockStatsSpecific){
+        .type  = BLOCK_STATS_SPECIFIC_KIND_QCOW2,
+        .u.qcow2.data = g_new(BlockStatsSpecificQcow2, 1),
+    };
+    *stats->u.qcow2.data = (BlockStatsSpecificQcow2){
+        .l2_cache       = qcow2_cache_get_stats(bs, s->l2_table_cache),
+        .refcount_cache = qcow2_cache_get_stats(bs,
+                                                s->refcount_block_cache),
+    };
+
+    return stats;
+}
+
 static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -4379,6 +4480,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure           = qcow2_measure,
     .bdrv_get_info          = qcow2_get_info,
     .bdrv_get_specific_info = qcow2_get_specific_info,
+    .bdrv_get_specific_stats = qcow2_get_specific_stats,
 
     .bdrv_save_vmstate    = qcow2_save_vmstate,
     .bdrv_load_vmstate    = qcow2_load_vmstate,
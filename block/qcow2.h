@@ -39,6 +39,14 @@
 #define QCOW_CRYPT_LUKS 2
 
 #define QCOW_MAX_CRYPT_CLUSTERS 32
+
+/* Compression requests of one image run in parallel in the thread pool,
+ * QCOW2_OPT_COMPRESS_THREADS of them by default.  The pool itself does not
+ * run more than 64 threads.
+ */
+#define QCOW2_DEFAULT_COMPRESS_THREADS 4
+#define QCOW2_MAX_THREADS 64
+
 #define QCOW_MAX_SNAPSHOTS 65536
 
 /* 8 MB refcount table is enough for 2 PB images at 64k cluster size
@@ -77,6 +85,20 @@
 #define DEFAULT_L2_CACHE_CLUSTERS 8 /* clusters */
 #define DEFAULT_L2_CACHE_BYTE_SIZE 1048576 /* bytes */
 
+/* By default the L2 cache covers the whole image, up to this many bytes.
+ * Cache memory is only touched for tables that are actually loaded, and the
+ * cache clean timer gives back what is left unused, so the memory used
+ * follows the working set.  32 MB cover 256 GB with 64 kB clusters.
+ */
+#ifdef CONFIG_LINUX
+#define DEFAULT_L2_CACHE_MAX_SIZE (32 * 1024 * 1024) /* bytes */
+#define DEFAULT_CACHE_CLEAN_INTERVAL 600 /* seconds */
+#else
+/* Without the clean timer, unused memory is never given back */
+#define DEFAULT_L2_CACHE_MAX_SIZE (8 * 1024 * 1024) /* bytes */
+#define DEFAULT_CACHE_CLEAN_INTERVAL 0 /* disabled */
+#endif
+
 /* The refblock cache needs only a fourth of the L2 cache size to cover as many
  * clusters */
 #define DEFAULT_L2_REFCOUNT_SIZE_RATIO 4
@@ -102,6 +124,7 @@
 #define QCOW2_OPT_L2_CACHE_SIZE "l2-cache-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_COMPRESS_THREADS "compress-threads"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -247,6 +270,8 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
+typedef struct Qcow2ChainIndex Qcow2ChainIndex;
+
 typedef struct BDRVQcow2State {
     int cluster_bits;
     int cluster_size;
@@ -268,9 +293,6 @@ typedef struct BDRVQcow2State {
     QEMUTimer *cache_clean_timer;
     unsigned cache_clean_interval;
 
-    uint8_t *cluster_cache;
-    uint8_t *cluster_data;
-    uint64_t cluster_cache_offset;
     QLIST_HEAD(QCowClusterAlloc, QCowL2Meta) cluster_allocs;
 
     uint64_t *refcount_table;
@@ -282,6 +304,11 @@ typedef struct BDRVQcow2State {
 
     CoMutex lock;
 
+    /* Compression requests running in the thread pool, see qcow2-threads.c */
+    int nb_compress_threads;
+    int max_compress_threads;
+    CoQueue compress_wait_queue;
+
     Qcow2CryptoHeaderExtension crypto_header; /* QCow2 header extension */
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
     QCryptoBlock *crypto; /* Disk encryption format driver */
@@ -327,6 +354,9 @@ typedef struct BDRVQcow2State {
      * override) */
     char *image_backing_file;
     char *image_backing_format;
+
+    /* Owner of each cluster in the backing chain, see qcow2-chain.c */
+    Qcow2ChainIndex *chain_index;
 } BDRVQcow2State;
 
 typedef struct Qcow2COWRegion {
@@ -604,7 +634,6 @@ int qcow2_grow_l1_table(BlockDriverState *bs, uint64_t min_size,
                         bool exact_size);
 int qcow2_shrink_l1_table(BlockDriverState *bs, uint64_t max_size);
 int qcow2_write_l1_entry(BlockDriverState *bs, int l1_index);
-int qcow2_decompress_cluster(BlockDriverState *bs, uint64_t cluster_offset);
 int qcow2_encrypt_sectors(BDRVQcow2State *s, int64_t sector_num,
                           uint8_t *buf, int nb_sectors, bool enc, Error **errp);
 
@@ -667,6 +696,21 @@ void qcow2_cache_put(BlockDriverState *bs, Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(BlockDriverState *bs, Qcow2Cache *c,
                                   uint64_t offset);
 void qcow2_cache_discard(BlockDriverState *bs, Qcow2Cache *c, void *table);
+Qcow2CacheStats *qcow2_cache_get_stats(BlockDriverState *bs, Qcow2Cache *c);
+
+/* qcow2-chain.c functions */
+int coroutine_fn qcow2_chain_read(BlockDriverState *bs, uint64_t offset,
+                                  uint64_t bytes, QEMUIOVector *qiov);
+void qcow2_chain_changed(BlockDriverState *bs);
+void qcow2_chain_index_free(BlockDriverState *bs);
+
+/* qcow2-threads.c functions */
+ssize_t coroutine_fn
+qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
+                  const void *src, size_t src_size);
+ssize_t coroutine_fn
+qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
+                    const void *src, size_t src_size);
 
 /* qcow2-bitmap.c functions */
 int qcow2_check_bitmaps_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
@@ -0,0 +1,416 @@
+/*
+ * Read cache of image files shared between QEMU processes
+ *
+ * Many QEMU processes on a host often run from the same base image at the
+ * bottom of their backing chains.  Each of them reads and, with
+ * cache.direct=on, fetches from the disk the same blocks of that image.
+ *
+ * The cache is a POSIX shared memory object named after the identity of
+ * the image file (device, inode, size and modification time), so every
+ * process that opens the same unmodified file read-only maps the same
+ * cache.  It holds aligned 64 KiB blocks of the file in a set associative
+ * table.  Lookups take no lock: each slot has a sequence count that is odd
+ * while the slot is being written, and a reader uses the data it copied out
+ * only if the count was even and unchanged around the copy.  Writers claim
+ * a slot with a compare-and-swap on that count and skip the insertion if
+ * another writer holds it.  A process that dies while writing a slot leaves
+ * it unusable, but never returns wrong data.
+ *
+ * The objects are created with mode 0600, so only processes of the same
+ * user share a cache.  Any user can create an object under the name, so an
+ * existing one is used only if it has that owner and mode.
+ *
+ * Every process holds a shared flock() on the object while it uses it, and
+ * the one that closes it last, which is the one that can upgrade to an
+ * exclusive lock, unlinks it.  The kernel drops the lock of a process that
+ * dies, so an object left behind by a crash is unlinked by the next process
+ * that opens the same file and closes it last.  Objects of files that are
+ * never opened again stay until the host reboots or they are removed from
+ * /dev/shm by hand, which is safe at any time.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/file.h>
+#include <sys/mman.h>
+#include "qapi/error.h"
+#include "qemu/atomic.h"
+#include "block/shared-cache.h"
+#include "trace.h"
+
+#define SHARED_CACHE_MAGIC          0x51534843  /* "QSHC" */
+#define SHARED_CACHE_VERSION        1
+#define SHARED_CACHE_WAYS           4
+#define SHARED_CACHE_HEADER_SIZE    4096
+
+/* How long to wait for another process to finish creating the cache */
+#define SHARED_CACHE_CREATE_WAIT_US (1000 * 1000)
+
+typedef struct SharedCacheHeader {
+    uint32_t magic;             /* set last by the creator */
+    uint32_t version;
+    uint32_t block_bits;
+    uint32_t ways;
+    uint64_t nb_sets;
+    uint64_t file_size;
+} SharedCacheHeader;
+
+typedef struct SharedCacheSlot {
+    uint32_t seq;               /* odd while written, 0 while never used */
+    uint32_t reserved;
+    uint64_t block;             /* block index + 1 */
+} SharedCacheSlot;
+
+typedef struct SharedCacheSet {
+    uint32_t hand;              /* next way to replace */
+    uint32_t reserved;
+    SharedCacheSlot slots[SHARED_CACHE_WAYS];
+} SharedCacheSet;
+
+struct SharedCache {
+    char *name;
+    int fd;                     /* holds our shared lock on the object */
+    void *map;
+    size_t map_size;
+    SharedCacheHeader *header;
+    SharedCacheSet *sets;
+    uint8_t *data;
+    uint64_t nb_sets;
+    uint64_t nb_blocks;
+
+    /* Statistics of this process */
+    uint64_t hits;
+    uint64_t misses;
+};
+
+uint64_t shared_cache_default_size;
+
+static size_t shared_cache_map_size(uint64_t nb_sets)
+{
+    return SHARED_CACHE_HEADER_SIZE +
+           ROUND_UP(nb_sets * sizeof(SharedCacheSet), SHARED_CACHE_BLOCK_SIZE) +
+           nb_sets * SHARED_CACHE_WAYS * SHARED_CACHE_BLOCK_SIZE;
+}
+
+static char *shared_cache_name(struct stat *st)
+{
+#ifdef CONFIG_LINUX
+    long mtime_ns = st->st_mtim.tv_nsec;
+#else
+    long mtime_ns = 0;
+#endif
+
+    return g_strdup_printf("/qemu-shared-cache-%" PRIx64 "-%" PRIx64
+                           "-%" PRIx64 "-%" PRIx64 ".%09ld",
+                           (uint64_t)st->st_dev, (uint64_t)st->st_ino,
+                           (uint64_t)st->st_size, (uint64_t)st->st_mtime,
+                           mtime_ns);
+}
+
+/* Wait for the process that created the object to size and set it up */
+static SharedCacheHeader *shared_cache_wait(int fd, size_t *map_size,
+                                            Error **errp)
+{
+    SharedCacheHeader *header;
+    struct stat st;
+    int waited = 0;
+    void *map;
+
+    for (;;) {
+        if (fstat(fd, &st) < 0) {
+            error_setg_errno(errp, errno, "Could not stat shared cache");
+            return NULL;
+        }
+        if (st.st_size >= SHARED_CACHE_HEADER_SIZE) {
+            break;
+        }
+        if (waited >= SHARED_CACHE_CREATE_WAIT_US) {
+            error_setg(errp, "Shared cache is not initialized");
+            return NULL;
+        }
+        g_usleep(1000);
+        waited += 1000;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        error_setg_errno(errp, errno, "Could not map shared cache");
+        return NULL;
+    }
+    header = map;
+
+    while (atomic_load_acquire(&header->magic) != SHARED_CACHE_MAGIC) {
+        if (waited >= SHARED_CACHE_CREATE_WAIT_US) {
+            error_setg(errp, "Shared cache is not initialized");
+            munmap(map, st.st_size);
+            return NULL;
+        }
+        g_usleep(1000);
+        waited += 1000;
+    }
+
+    *map_size = st.st_size;
+    return header;
+}
+
+SharedCache *shared_cache_open(int fd, uint64_t size, Error **errp)
+{
+    SharedCache *c;
+    SharedCacheHeader *header;
+    struct stat st, shm_st;
+    uint64_t nb_blocks, nb_sets;
+    size_t map_size;
+    char *name;
+    int shm_fd;
+
+    if (fstat(fd, &st) < 0) {
+        error_setg_errno(errp, errno, "Could not stat file");
+        return NULL;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        error_setg(errp, "Only regular files can use a shared cache");
+        return NULL;
+    }
+
+    nb_blocks = st.st_size >> SHARED_CACHE_BLOCK_BITS;
+    nb_sets = MIN(size / (SHARED_CACHE_WAYS * SHARED_CACHE_BLOCK_SIZE),
+                  DIV_ROUND_UP(nb_blocks, SHARED_CACHE_WAYS));
+    if (!nb_sets) {
+        error_setg(errp, "Shared cache too small or file too short");
+        return NULL;
+    }
+
+    name = shared_cache_name(&st);
+    shm_fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (shm_fd >= 0) {
+        map_size = shared_cache_map_size(nb_sets);
+        if (ftruncate(shm_fd, map_size) < 0) {
+            error_setg_errno(errp, errno, "Could not size shared cache");
+            goto fail_unlink;
+        }
+        /* Before anybody else can map it, see shared_cache_close() */
+        if (flock(shm_fd, LOCK_SH) < 0) {
+            error_setg_errno(errp, errno, "Could not lock shared cache");
+            goto fail_unlink;
+        }
+        header = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      shm_fd, 0);
+        if (header == MAP_FAILED) {
+            error_setg_errno(errp, errno, "Could not map shared cache");
+            goto fail_unlink;
+        }
+        header->version = SHARED_CACHE_VERSION;
+        header->block_bits = SHARED_CACHE_BLOCK_BITS;
+        header->ways = SHARED_CACHE_WAYS;
+        header->nb_sets = nb_sets;
+        header->file_size = st.st_size;
+        atomic_store_release(&header->magic, SHARED_CACHE_MAGIC);
+    } else if (errno == EEXIST) {
+        /* The geometry is that of the process that created the cache */
+        shm_fd = shm_open(name, O_RDWR, 0);
+        if (shm_fd < 0) {
+            error_setg_errno(errp, errno, "Could not open shared cache %s",
+                             name);
+            goto fail;
+        }
+        /* Anybody can guess the name, so a cache that another user could
+         * have created or can write would let them choose what we read.
+         */
+        if (fstat(shm_fd, &shm_st) < 0) {
+            error_setg_errno(errp, errno, "Could not stat shared cache %s",
+                             name);
+            goto fail_close;
+        }
+        if (shm_st.st_uid != geteuid() || (shm_st.st_mode & 077)) {
+            error_setg(errp, "Shared cache %s is not private to this user",
+                       name);
+            goto fail_close;
+        }
+        if (flock(shm_fd, LOCK_SH) < 0) {
+            error_setg_errno(errp, errno, "Could not lock shared cache %s",
+                             name);
+            goto fail_close;
+        }
+        header = shared_cache_wait(shm_fd, &map_size, errp);
+        if (!header) {
+            error_append_hint(errp, "Remove /dev/shm%s if no process is "
+                              "creating it\n", name);
+            goto fail_close;
+        }
+        nb_sets = header->nb_sets;
+        if (header->version != SHARED_CACHE_VERSION ||
+            header->block_bits != SHARED_CACHE_BLOCK_BITS ||
+            header->ways != SHARED_CACHE_WAYS ||
+            header->file_size != st.st_size ||
+            map_size < shared_cache_map_size(nb_sets)) {
+            error_setg(errp, "Shared cache %s has an incompatible format",
+                       name);
+            munmap(header, map_size);
+            goto fail_close;
+        }
+    } else {
+        error_setg_errno(errp, errno, "Could not create shared cache %s",
+                         name);
+        goto fail;
+    }
+
+    c = g_new0(SharedCache, 1);
+    c->name = name;
+    c->fd = shm_fd;
+    c->map = header;
+    c->map_size = map_size;
+    c->header = header;
+    c->sets = (void *)header + SHARED_CACHE_HEADER_SIZE;
+    c->data = (void *)c->sets + ROUND_UP(nb_sets * sizeof(SharedCacheSet),
+                                         SHARED_CACHE_BLOCK_SIZE);
+    c->nb_sets = nb_sets;
+    c->nb_blocks = nb_blocks;
+
+    trace_shared_cache_open(c, name, nb_sets * SHARED_CACHE_WAYS);
+    return c;
+
+fail_unlink:
+    shm_unlink(name);
+fail_close:
+    close(shm_fd);
+fail:
+    g_free(name);
+    return NULL;
+}
+
+/* Whether the name of @c still refers to the object we have mapped */
+static bool shared_cache_linked(SharedCache *c)
+{
+    struct stat st, shm_st;
+    bool ret;
+    int fd;
+
+    fd = shm_open(c->name, O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    ret = fstat(c->fd, &st) == 0 && fstat(fd, &shm_st) == 0 &&
+          st.st_dev == shm_st.st_dev && st.st_ino == shm_st.st_ino;
+    close(fd);
+    return ret;
+}
+
+void shared_cache_close(SharedCache *c)
+{
+    trace_shared_cache_close(c, c->hits, c->misses);
+    munmap(c->map, c->map_size);
+
+    /* Nobody else holds a shared lock, so nobody else uses the object.  A
+     * process that opens it right now finds it unlinked once it gets its
+     * lock, and just uses it on its own.
+     */
+    if (flock(c->fd, LOCK_EX | LOCK_NB) == 0 && shared_cache_linked(c)) {
+        shm_unlink(c->name);
+    }
+    close(c->fd);
+    g_free(c->name);
+    g_free(c);
+}
+
+uint64_t shared_cache_nb_blocks(SharedCache *c)
+{
+    return c->nb_blocks;
+}
+
+static SharedCacheSet *shared_cache_set(SharedCache *c, uint64_t block)
+{
+    return &c->sets[block % c->nb_sets];
+}
+
+static uint8_t *shared_cache_data(SharedCache *c, SharedCacheSet *set, int way)
+{
+    uint64_t slot = (set - c->sets) * SHARED_CACHE_WAYS + way;
+
+    return c->data + (slot << SHARED_CACHE_BLOCK_BITS);
+}
+
+static int shared_cache_find(SharedCacheSet *set, uint64_t block,
+                             uint32_t *seq)
+{
+    int i;
+
+    for (i = 0; i < SHARED_CACHE_WAYS; i++) {
+        SharedCacheSlot *slot = &set->slots[i];
+
+        *seq = atomic_load_acquire(&slot->seq);
+        if (*seq && !(*seq & 1) && slot->block == block + 1) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool shared_cache_contains(SharedCache *c, uint64_t block)
+{
+    uint32_t seq;
+
+    return shared_cache_find(shared_cache_set(c, block), block, &seq) >= 0;
+}
+
+/* Copy @bytes at @offset into the cached @block to @qiov, if it is cached */
+bool shared_cache_read(SharedCache *c, uint64_t block, uint64_t offset,
+                       uint64_t bytes, QEMUIOVector *qiov, size_t qiov_offset)
+{
+    SharedCacheSet *set = shared_cache_set(c, block);
+    uint32_t seq;
+    int way;
+
+    assert(block < c->nb_blocks);
+    assert(offset + bytes <= SHARED_CACHE_BLOCK_SIZE);
+
+    way = shared_cache_find(set, block, &seq);
+    if (way >= 0) {
+        qemu_iovec_from_buf(qiov, qiov_offset,
+                            shared_cache_data(c, set, way) + offset, bytes);
+        smp_rmb();
+        /* Unchanged count: no writer replaced the slot during the copy */
+        if (atomic_read(&set->slots[way].seq) == seq) {
+            c->hits++;
+            return true;
+        }
+    }
+
+    c->misses++;
+    return false;
+}
+
+void shared_cache_insert(SharedCache *c, uint64_t block, const void *buf)
+{
+    SharedCacheSet *set = shared_cache_set(c, block);
+    SharedCacheSlot *slot = NULL;
+    uint32_t seq;
+    int i;
+
+    assert(block < c->nb_blocks);
+
+    /* Another process may have been faster */
+    if (shared_cache_find(set, block, &seq) >= 0) {
+        return;
+    }
+
+    for (i = 0; i < SHARED_CACHE_WAYS; i++) {
+        if (!atomic_read(&set->slots[i].seq)) {
+            slot = &set->slots[i];
+            break;
+        }
+    }
+    if (!slot) {
+        i = atomic_fetch_inc(&set->hand) % SHARED_CACHE_WAYS;
+        slot = &set->slots[i];
+    }
+
+    seq = atomic_read(&slot->seq);
+    if ((seq & 1) || atomic_cmpxchg(&slot->seq, seq, seq + 1) != seq) {
+        return;
+    }
+    slot->block = block + 1;
+    memcpy(shared_cache_data(c, set, i), buf, SHARED_CACHE_BLOCK_SIZE);
+    atomic_store_release(&slot->seq, seq + 2);
+}
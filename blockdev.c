@@ -2604,6 +2604,40 @@ fail:
     bdrv_unref(medium_bs);
 }
 
+static void block_latency_stats_set(BlockDriverState *bs, bool enable,
+                                    bool recursive)
+{
+    BdrvChild *child;
+
+    bdrv_latency_stats_enable(bs, enable);
+
+    if (recursive) {
+        QLIST_FOREACH(child, &bs->children, next) {
+            block_latency_stats_set(child->bs, enable, recursive);
+        }
+    }
+}
+
+void qmp_block_latency_stats_set(const char *node, bool enable,
+                                 bool has_recursive, bool recursive,
+                                 Error **errp)
+{
+    BlockDriverState *bs;
+    AioContext *aio_context;
+
+    bs = bdrv_lookup_bs(node, node, errp);
+    if (!bs) {
+        return;
+    }
+
+    aio_context = bdrv_get_aio_context(bs);
+    aio_context_acquire(aio_context);
+
+    block_latency_stats_set(bs, enable, has_recursive && recursive);
+
+    aio_context_release(aio_context);
+}
+
 /* throttling disk I/O limits */
 void qmp_block_set_io_throttle(BlockIOThrottle *arg, Error **errp)
 {
@@ -500,21 +500,52 @@ void configure_phases(QemuOpts *opts, Error **errp) {
 }
 void configure_ckpt(QemuOpts *opts, Error **errp) {
     const char* every_opt, *end_opt;
+    Error *err = NULL;
     every_opt = qemu_opt_get(opts, "every");
     end_opt = qemu_opt_get(opts, "end");
 
     if (!every_opt) {
         error_setg(errp, "no interval given for ckpt option. cant continue");
+        return;
     }
     if (!end_opt) {
         error_setg(errp, "no end given for ckpt option. cant continue");
+        return;
     }
 
-    processForOpts(&ckpt_state.ckpt_interval, every_opt, errp);
-    processForOpts(&ckpt_state.ckpt_end, end_opt, errp);
+    processForOpts(&ckpt_state.ckpt_interval, every_opt, &err);
+    if (err) {
+        error_propagate(errp, err);
+        return;
+    }
+    processForOpts(&ckpt_state.ckpt_end, end_opt, &err);
+    if (err) {
+        error_propagate(errp, err);
+        return;
+    }
 
     if (ckpt_state.ckpt_end < ckpt_state.ckpt_interval) {
         error_setg(errp, "ckpt end cant be smaller than ckpt interval");
+        return;
+    }
+
+    /* Send pages dirtied since the previous checkpoint as XBZRLE deltas */
+    if (qemu_opt_get_bool(opts, "delta", false)) {
+        MigrationCapabilityStatus xbzrle = {
+            .capability = MIGRATION_CAPABILITY_XBZRLE,
+            .state = true,
+        };
+        MigrationCapabilityStatusList caps = { .value = &xbzrle };
+        uint64_t cache_size = qemu_opt_get_size(opts, "delta-cache", 0);
+
+        qmp_migrate_set_capabilities(&caps, &err);
+        if (err) {
+            error_propagate(errp, err);
+            return;
+        }
+        if (cache_size) {
+            qmp_migrate_set_cache_size(cache_size, errp);
+        }
     }
 }
 #endif /* CONFIG_EXTSNAP */
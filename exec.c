@@ -1893,7 +1893,8 @@ static void dirty_memory_extend(ram_addr_t old_ram_size,
         }
 
         for (j = old_num_blocks; j < new_num_blocks; j++) {
-            new_blocks->blocks[j] = bitmap_new(DIRTY_MEMORY_BLOCK_SIZE);
+            new_blocks->blocks[j] = bitmap_new(DIRTY_MEMORY_BLOCK_SIZE +
+                                               DIRTY_MEMORY_SUMMARY_BITS);
         }
 
         atomic_rcu_set(&ram_list.dirty_memory[i], new_blocks);
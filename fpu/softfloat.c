@@ -83,6 +83,8 @@ this code that are retained.
  * target-dependent and needs the TARGET_* macros.
  */
 #include "qemu/osdep.h"
+#include <math.h>
+#include <float.h>
 
 #include "fpu/softfloat.h"
 
@@ -2183,7 +2185,7 @@ static float32 subFloat32Sigs(float32 a, float32 b, flag zSign,
 | Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_add(float32 a, float32 b, float_status *status)
+static float32 soft_float32_add(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign;
     a = float32_squash_input_denormal(a, status);
@@ -2206,7 +2208,7 @@ float32 float32_add(float32 a, float32 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_sub(float32 a, float32 b, float_status *status)
+static float32 soft_float32_sub(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign;
     a = float32_squash_input_denormal(a, status);
@@ -2229,7 +2231,7 @@ float32 float32_sub(float32 a, float32 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_mul(float32 a, float32 b, float_status *status)
+static float32 soft_float32_mul(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
@@ -2294,7 +2296,7 @@ float32 float32_mul(float32 a, float32 b, float_status *status)
 | IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_div(float32 a, float32 b, float_status *status)
+static float32 soft_float32_div(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
@@ -2471,8 +2473,8 @@ float32 float32_rem(float32 a, float32 b, float_status *status)
 | externally will flip the sign bit on NaNs.)
 *----------------------------------------------------------------------------*/
 
-float32 float32_muladd(float32 a, float32 b, float32 c, int flags,
-                       float_status *status)
+static float32 soft_float32_muladd(float32 a, float32 b, float32 c, int flags,
+                                   float_status *status)
 {
     flag aSign, bSign, cSign, zSign;
     int aExp, bExp, cExp, pExp, zExp, expDiff;
@@ -2692,7 +2694,7 @@ float32 float32_muladd(float32 a, float32 b, float32 c, int flags,
 | Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_sqrt(float32 a, float_status *status)
+static float32 soft_float32_sqrt(float32 a, float_status *status)
 {
     flag aSign;
     int aExp, zExp;
@@ -3978,7 +3980,7 @@ static float64 subFloat64Sigs(float64 a, float64 b, flag zSign,
 | Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_add(float64 a, float64 b, float_status *status)
+static float64 soft_float64_add(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign;
     a = float64_squash_input_denormal(a, status);
@@ -4001,7 +4003,7 @@ float64 float64_add(float64 a, float64 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_sub(float64 a, float64 b, float_status *status)
+static float64 soft_float64_sub(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign;
     a = float64_squash_input_denormal(a, status);
@@ -4024,7 +4026,7 @@ float64 float64_sub(float64 a, float64 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_mul(float64 a, float64 b, float_status *status)
+static float64 soft_float64_mul(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
@@ -4087,7 +4089,7 @@ float64 float64_mul(float64 a, float64 b, float_status *status)
 | the IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_div(float64 a, float64 b, float_status *status)
+static float64 soft_float64_div(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
@@ -4258,8 +4260,8 @@ float64 float64_rem(float64 a, float64 b, float_status *status)
 | externally will flip the sign bit on NaNs.)
 *----------------------------------------------------------------------------*/
 
-float64 float64_muladd(float64 a, float64 b, float64 c, int flags,
-                       float_status *status)
+static float64 soft_float64_muladd(float64 a, float64 b, float64 c, int flags,
+                                   float_status *status)
 {
     flag aSign, bSign, cSign, zSign;
     int aExp, bExp, cExp, pExp, zExp, expDiff;
@@ -4500,7 +4502,7 @@ float64 float64_muladd(float64 a, float64 b, float64 c, int flags,
 | Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_sqrt(float64 a, float_status *status)
+static float64 soft_float64_sqrt(float64 a, float_status *status)
 {
     flag aSign;
     int aExp, zExp;
@@ -7915,3 +7917,267 @@ float128 float128_scalbn(float128 a, int n, float_status *status)
                                          , status);
 
 }
+
+/*----------------------------------------------------------------------------
+| Host FPU fast path for single- and double-precision add, sub, mul, div,
+| muladd and sqrt.
+|
+| The operation is computed by the host FPU whenever the result is known to
+| be bit-identical to the software one, i.e. when
+|   - the rounding mode is round-to-nearest-even (QEMU never changes the
+|     host rounding mode, so host and guest then agree);
+|   - the inexact flag is already raised, so that we need not find out from
+|     the host whether the result was rounded.  Guests such as AArch64 keep
+|     it sticky in FPSR, so this holds for all but the first few operations;
+|   - every input is zero or normal, which rules out NaN propagation and
+|     input denormal flushing.
+| Overflowing results raise the overflow flag here.  Results that are zero or
+| possibly tiny are recomputed in software so that underflow, tininess
+| detection and flush-to-zero behave exactly as before.
+*----------------------------------------------------------------------------*/
+
+#if defined(__FAST_MATH__) || !defined(FLT_EVAL_METHOD) || FLT_EVAL_METHOD != 0
+/* Excess precision (e.g. x87) would round twice; fast math is not IEEE.  */
+#define QEMU_NO_HARDFLOAT 1
+#endif
+
+typedef union {
+    float32 s;
+    float h;
+} union_float32;
+
+typedef union {
+    float64 s;
+    double h;
+} union_float64;
+
+static inline bool can_use_fpu(const float_status *s)
+{
+#ifdef QEMU_NO_HARDFLOAT
+    return false;
+#else
+    return likely((s->float_exception_flags & float_flag_inexact) &&
+                  s->float_rounding_mode == float_round_nearest_even);
+#endif
+}
+
+static inline bool float32_is_zero_or_normal(float32 a)
+{
+    uint32_t exp = float32_val(a) & 0x7f800000;
+
+    return exp != 0x7f800000 && (exp != 0 || float32_is_zero(a));
+}
+
+static inline bool float64_is_zero_or_normal(float64 a)
+{
+    uint64_t exp = float64_val(a) & LIT64(0x7ff0000000000000);
+
+    return exp != LIT64(0x7ff0000000000000) && (exp != 0 || float64_is_zero(a));
+}
+
+/* Returns true if the host result can be used as is.  */
+static inline bool float32_hard_result_ok(float r, float_status *status)
+{
+    if (unlikely(isinf(r))) {
+        status->float_exception_flags |= float_flag_overflow;
+        return true;
+    }
+    return fabsf(r) > FLT_MIN;
+}
+
+static inline bool float64_hard_result_ok(double r, float_status *status)
+{
+    if (unlikely(isinf(r))) {
+        status->float_exception_flags |= float_flag_overflow;
+        return true;
+    }
+    return fabs(r) > DBL_MIN;
+}
+
+float32 float32_add(float32 a, float32 b, float_status *status)
+{
+    if (can_use_fpu(status) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b)) {
+        union_float32 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h + ub.h;
+        if (float32_hard_result_ok(ur.h, status)) {
+            return ur.s;
+        }
+    }
+    return soft_float32_add(a, b, status);
+}
+
+float32 float32_sub(float32 a, float32 b, float_status *status)
+{
+    if (can_use_fpu(status) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b)) {
+        union_float32 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h - ub.h;
+        if (float32_hard_result_ok(ur.h, status)) {
+            return ur.s;
+        }
+    }
+    return soft_float32_sub(a, b, status);
+}
+
+float32 float32_mul(float32 a, float32 b, float_status *status)
+{
+    if (can_use_fpu(status) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b)) {
+        union_float32 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h * ub.h;
+        if (float32_hard_result_ok(ur.h, status)) {
+            return ur.s;
+        }
+    }
+    return soft_float32_mul(a, b, status);
+}
+
+float32 float32_div(float32 a, float32 b, float_status *status)
+{
+    /* A zero divisor raises divbyzero or invalid: leave it to software.  */
+    if (can_use_fpu(status) && float32_is_zero_or_normal(a) &&
+        float32_is_zero_or_normal(b) && !float32_is_zero(b)) {
+        union_float32 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h / ub.h;
+        if (float32_hard_result_ok(ur.h, status)) {
+            return ur.s;
+        }
+    }
+    return soft_float32_div(a, b, status);
+}
+
+float32 float32_muladd(float32 a, float32 b, float32 c, int flags,
+                       float_status *status)
+{
+    if (can_use_fpu(status) && !(flags & float_muladd_halve_result) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b) &&
+        float32_is_zero_or_normal(c)) {
+        union_float32 ua = { .s = a }, ub = { .s = b }, uc = { .s = c }, ur;
+
+        if (flags & float_muladd_negate_product) {
+            ua.h = -ua.h;
+        }
+        if (flags & float_muladd_negate_c) {
+            uc.h = -uc.h;
+        }
+        ur.h = fmaf(ua.h, ub.h, uc.h);
+        if (float32_hard_result_ok(ur.h, status)) {
+            if (flags & float_muladd_negate_result) {
+                ur.h = -ur.h;
+            }
+            return ur.s;
+        }
+    }
+    return soft_float32_muladd(a, b, c, flags, status);
+}
+
+float32 float32_sqrt(float32 a, float_status *status)
+{
+    /* The square root of a positive normal is always normal.  */
+    if (can_use_fpu(status) && float32_is_zero_or_normal(a) &&
+        !float32_is_zero(a) && !float32_is_neg(a)) {
+        union_float32 ua = { .s = a }, ur;
+
+        ur.h = sqrtf(ua.h);
+        return ur.s;
+    }
+    return soft_float32_sqrt(a, status);
+}
+
+float64 float64_add(float64 a, float64 b, float_status *status)
+{
+    if (can_use_fpu(status) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b)) {
+        union_float64 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h + ub.h;
+        if (float64_hard_result_ok(ur.h, status)) {
+            return ur.s;
+        }
+    }
+    return soft_float64_add(a, b, status);
+}
+
+float64 float64_sub(float64 a, float64 b, float_status *status)
+{
+    if (can_use_fpu(status) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b)) {
+        union_float64 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h - ub.h;
+        if (float64_hard_result_ok(ur.h, status)) {
+            return ur.s;
+        }
+    }
+    return soft_float64_sub(a, b, status);
+}
+
+float64 float64_mul(float64 a, float64 b, float_status *status)
+{
+    if (can_use_fpu(status) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b)) {
+        union_float64 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h * ub.h;
+        if (float64_hard_result_ok(ur.h, status)) {
+            return ur.s;
+        }
+    }
+    return soft_float64_mul(a, b, status);
+}
+
+float64 float64_div(float64 a, float64 b, float_status *status)
+{
+    if (can_use_fpu(status) && float64_is_zero_or_normal(a) &&
+        float64_is_zero_or_normal(b) && !float64_is_zero(b)) {
+        union_float64 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h / ub.h;
+        if (float64_hard_result_ok(ur.h, status)) {
+            return ur.s;
+        }
+    }
+    return soft_float64_div(a, b, status);
+}
+
+float64 float64_muladd(float64 a, float64 b, float64 c, int flags,
+                       float_status *status)
+{
+    if (can_use_fpu(status) && !(flags & float_muladd_halve_result) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b) &&
+        float64_is_zero_or_normal(c)) {
+        union_float64 ua = { .s = a }, ub = { .s = b }, uc = { .s = c }, ur;
+
+        if (flags & float_muladd_negate_product) {
+            ua.h = -ua.h;
+        }
+        if (flags & float_muladd_negate_c) {
+            uc.h = -uc.h;
+        }
+        ur.h = fma(ua.h, ub.h, uc.h);
+        if (float64_hard_result_ok(ur.h, status)) {
+            if (flags & float_muladd_negate_result) {
+                ur.h = -ur.h;
+            }
+            return ur.s;
+        }
+    }
+    return soft_float64_muladd(a, b, c, flags, status);
+}
+
+float64 float64_sqrt(float64 a, float_status *status)
+{
+    if (can_use_fpu(status) && float64_is_zero_or_normal(a) &&
+        !float64_is_zero(a) && !float64_is_neg(a)) {
+        union_float64 ua = { .s = a }, ur;
+
+        ur.h = sqrt(ua.h);
+        return ur.s;
+    }
+    return soft_float64_sqrt(a, status);
+}
@@ -2878,6 +2878,26 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-max-ns=%" PRId64 "\n", value->poll_max_ns);
         monitor_printf(mon, "  poll-grow=%" PRId64 "\n", value->poll_grow);
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
+        monitor_printf(mon, "  aio-max-events=%" PRId64 "\n",
+                       value->aio_max_events);
+        monitor_printf(mon, "  aio-max-batch=%" PRId64 "\n",
+                       value->aio_max_batch);
+        if (value->has_linux_aio) {
+            LinuxAioStats *st = value->linux_aio;
+            intList *bin;
+            int i;
+
+            monitor_printf(mon, "  linux-aio: queue-depth=%" PRId64
+                           " in-flight=%" PRId64 " submits=%" PRId64
+                           " requests=%" PRId64 " polled=%" PRId64 "\n",
+                           st->queue_depth, st->in_flight, st->submits,
+                           st->requests, st->polled_requests);
+            monitor_printf(mon, "  linux-aio batch sizes:");
+            for (bin = st->batch_sizes, i = 0; bin; bin = bin->next, i++) {
+                monitor_printf(mon, " <=%d:%" PRId64, 1 << i, bin->value);
+            }
+            monitor_printf(mon, "\n");
+        }
     }
 
     qapi_free_IOThreadInfoList(info_list);
@@ -59,6 +59,45 @@ struct BlockAcctStats {
     bool account_failed;
 };
 
+/* Stages of a request on a block node whose latency is tracked separately.
+ * The generic block layer measures the first three for every node, format
+ * drivers break down the time they spend in the driver into the others.
+ */
+enum BlockLatencyStage {
+    BLOCK_LATENCY_TOTAL,        /* submission to completion */
+    BLOCK_LATENCY_QUEUE,        /* alignment and waits for serialisation */
+    BLOCK_LATENCY_DRIVER,       /* in the driver */
+    BLOCK_LATENCY_LOCK,         /* waiting for the driver's coroutine lock */
+    BLOCK_LATENCY_METADATA,     /* metadata lookups and updates */
+    BLOCK_LATENCY_DATA,         /* guest data I/O to the children */
+    BLOCK_MAX_LATENCY_STAGE,
+};
+
+/* Bin 0 counts latencies below 1024 ns, bin i > 0 those in
+ * [2^(i+9), 2^(i+10)) ns, and the last bin all from 2^40 ns (about 18.3
+ * minutes) up.
+ */
+#define BLOCK_LATENCY_BINS      32
+
+/* Bin i counts requests that found between 2^i and 2^(i+1) - 1 requests,
+ * themselves included, in flight on the node.
+ */
+#define BLOCK_QUEUE_DEPTH_BINS  16
+
+typedef struct BlockAcctLatencyHist {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t bins[BLOCK_LATENCY_BINS];
+} BlockAcctLatencyHist;
+
+/* Updated from the node's AioContext only, so no lock is taken */
+typedef struct BlockAcctLatency {
+    bool enabled;
+    BlockAcctLatencyHist hist[BLOCK_MAX_IOTYPE][BLOCK_MAX_LATENCY_STAGE];
+    uint64_t queue_depth[BLOCK_MAX_IOTYPE][BLOCK_QUEUE_DEPTH_BINS];
+} BlockAcctLatency;
+
 typedef struct BlockAcctCookie {
     int64_t bytes;
     int64_t start_time_ns;
@@ -83,4 +122,11 @@ int64_t block_acct_idle_time_ns(BlockAcctStats *stats);
 double block_acct_queue_depth(BlockAcctTimedStats *stats,
                               enum BlockAcctType type);
 
+int64_t block_latency_now(void);
+void block_latency_account(BlockAcctLatency *stats, enum BlockAcctType type,
+                           enum BlockLatencyStage stage, int64_t ns);
+void block_latency_account_queue_depth(BlockAcctLatency *stats,
+                                       enum BlockAcctType type,
+                                       unsigned int depth);
+
 #endif
@@ -143,6 +143,10 @@ struct AioContext {
     /* Are we in polling mode or monitoring file descriptors? */
     bool poll_started;
 
+    /* Native Linux AIO parameters, 0 meaning the default */
+    int64_t aio_max_events; /* queue depth */
+    int64_t aio_max_batch;  /* maximum number of requests per io_submit() */
+
     /* epoll(7) state used when built with CONFIG_EPOLL */
     int epollfd;
     bool epoll_enabled;
@@ -564,4 +568,19 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+#define AIO_MAX_EVENTS_LIMIT    65536
+#define AIO_MAX_BATCH_LIMIT     256
+
+/**
+ * aio_context_set_aio_params:
+ * @ctx: the aio context
+ * @max_events: queue depth of native Linux AIO, 0 for the default
+ * @max_batch: maximum number of requests submitted at once, 0 for the default
+ *
+ * The queue depth cannot be changed any more once native Linux AIO has been
+ * used in @ctx.
+ */
+void aio_context_set_aio_params(AioContext *ctx, int64_t max_events,
+                                int64_t max_batch, Error **errp);
+
 #endif
@@ -81,6 +81,10 @@ typedef struct BdrvTrackedRequest {
     CoQueue wait_queue; /* coroutines blocked on this request */
 
     struct BdrvTrackedRequest *waiting_for;
+
+    /* Submission and driver entry times, or -1 if latencies are not tracked */
+    int64_t latency_start_ns;
+    int64_t latency_driver_ns;
 } BdrvTrackedRequest;
 
 struct BlockDriver {
@@ -131,6 +135,8 @@ struct BlockDriver {
                           Error **errp);
     void (*bdrv_close)(BlockDriverState *bs);
     int (*bdrv_create)(const char *filename, QemuOpts *opts, Error **errp);
+    /* Copy the file @src to @dst, sharing storage between them if possible */
+    int (*bdrv_clone_file)(const char *src, const char *dst, Error **errp);
     int (*bdrv_make_empty)(BlockDriverState *bs);
 
     void (*bdrv_refresh_filename)(BlockDriverState *bs, QDict *options);
@@ -266,6 +272,8 @@ struct BlockDriver {
                                   Error **errp);
     int (*bdrv_get_info)(BlockDriverState *bs, BlockDriverInfo *bdi);
     ImageInfoSpecific *(*bdrv_get_specific_info)(BlockDriverState *bs);
+    /* Driver-specific statistics for query-blockstats */
+    BlockStatsSpecific *(*bdrv_get_specific_stats)(BlockDriverState *bs);
 
     int coroutine_fn (*bdrv_save_vmstate)(BlockDriverState *bs,
                                           QEMUIOVector *qiov,
@@ -680,6 +688,11 @@ struct BlockDriverState {
     /* Offset after the highest byte written to */
     Stat64 wr_highest_offset;
 
+    /* Latency breakdown of the requests on the node, allocated when first
+     * enabled and kept until the node is deleted.
+     */
+    BlockAcctLatency *latency_stats;
+
     /* If true, copy read backing sectors into image.  Can be >1 if more
      * than one client has requested copy-on-read.  Accessed with atomic
      * ops.
@@ -751,6 +764,13 @@ extern BlockDriver bdrv_file;
 extern BlockDriver bdrv_raw;
 extern BlockDriver bdrv_qcow2;
 
+/* Incremented whenever a BdrvChild is attached, detached or pointed to
+ * another node, and whenever a node is resized.  Drivers that cache facts
+ * about the nodes below them (e.g. the qcow2 backing chain index) compare it
+ * to notice such changes.
+ */
+extern unsigned long bdrv_graph_generation;
+
 int coroutine_fn bdrv_co_preadv(BdrvChild *child,
     int64_t offset, unsigned int bytes, QEMUIOVector *qiov,
     BdrvRequestFlags flags);
@@ -1043,6 +1063,29 @@ void bdrv_undo_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap *in);
 void bdrv_inc_in_flight(BlockDriverState *bs);
 void bdrv_dec_in_flight(BlockDriverState *bs);
 
+void bdrv_latency_stats_enable(BlockDriverState *bs, bool enable);
+
+/* Start time of a request stage, or -1 if the node tracks no latencies */
+static inline int64_t bdrv_latency_start(BlockDriverState *bs)
+{
+    BlockAcctLatency *stats = atomic_read(&bs->latency_stats);
+
+    return stats && atomic_read(&stats->enabled) ? block_latency_now() : -1;
+}
+
+/* Account the time since @start_ns, as returned by bdrv_latency_start(),
+ * to @stage of a request of @type */
+static inline void bdrv_latency_account(BlockDriverState *bs,
+                                        enum BlockAcctType type,
+                                        enum BlockLatencyStage stage,
+                                        int64_t start_ns)
+{
+    if (start_ns >= 0) {
+        block_latency_account(bs->latency_stats, type, stage,
+                              block_latency_now() - start_ns);
+    }
+}
+
 void blockdev_close_all_bdrv_states(void);
 
 #endif /* BLOCK_INT_H */
@@ -17,6 +17,7 @@
 
 #include "qemu/coroutine.h"
 #include "qemu/iov.h"
+#include "qapi-types.h"
 
 /* AIO request types */
 #define QEMU_AIO_READ         0x0001
@@ -37,7 +38,7 @@
 /* linux-aio.c - Linux native implementation */
 #ifdef CONFIG_LINUX_AIO
 typedef struct LinuxAioState LinuxAioState;
-LinuxAioState *laio_init(void);
+LinuxAioState *laio_init(unsigned int max_events);
 void laio_cleanup(LinuxAioState *s);
 int coroutine_fn laio_co_submit(BlockDriverState *bs, LinuxAioState *s, int fd,
                                 uint64_t offset, QEMUIOVector *qiov, int type);
@@ -48,6 +49,7 @@ void laio_detach_aio_context(LinuxAioState *s, AioContext *old_context);
 void laio_attach_aio_context(LinuxAioState *s, AioContext *new_context);
 void laio_io_plug(BlockDriverState *bs, LinuxAioState *s);
 void laio_io_unplug(BlockDriverState *bs, LinuxAioState *s);
+LinuxAioStats *laio_get_stats(LinuxAioState *s);
 #endif
 
 #ifdef _WIN32
@@ -0,0 +1,37 @@
+/*
+ * Read cache of image files shared between QEMU processes
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef BLOCK_SHARED_CACHE_H
+#define BLOCK_SHARED_CACHE_H
+
+#include "qemu/iov.h"
+
+#define SHARED_CACHE_BLOCK_BITS 16
+#define SHARED_CACHE_BLOCK_SIZE (1 << SHARED_CACHE_BLOCK_BITS)
+
+typedef struct SharedCache SharedCache;
+
+/* Size of the cache of base images of backing chains opened without an
+ * explicit shared-cache-size option, set with -shared-cache; 0 disables the
+ * cache.
+ */
+extern uint64_t shared_cache_default_size;
+
+SharedCache *shared_cache_open(int fd, uint64_t size, Error **errp);
+void shared_cache_close(SharedCache *c);
+
+/* Number of blocks of the file that can be cached; the last, partial block
+ * of the file never is.
+ */
+uint64_t shared_cache_nb_blocks(SharedCache *c);
+
+bool shared_cache_contains(SharedCache *c, uint64_t block);
+bool shared_cache_read(SharedCache *c, uint64_t block, uint64_t offset,
+                       uint64_t bytes, QEMUIOVector *qiov, size_t qiov_offset);
+void shared_cache_insert(SharedCache *c, uint64_t block, const void *buf);
+
+#endif
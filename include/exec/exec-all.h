@@ -360,12 +360,19 @@ struct TranslationBlock {
 #define CF_NOCACHE     0x10000 /* To be freed after execution */
 #define CF_USE_ICOUNT  0x20000
 #define CF_IGNORE_ICOUNT 0x40000 /* Do not generate icount code */
+#define CF_TRACE       0x80000 /* Superblock: follow hot in-page branches */
 
     /* Per-vCPU dynamic tracing state used to generate this TB */
     uint32_t trace_vcpu_dstate;
 
     uint16_t invalid;
 
+    /* Executed since the last code region eviction, set by gen_tb_start() */
+    uint16_t used;
+
+    /* Executions of the trace counter, see tb_trace_hot() */
+    uint32_t exec_count;
+
     void *tc_ptr;    /* pointer to the translated code */
     uint8_t *tc_search;  /* pointer to search data */
     /* original tb when cflags has CF_NOCACHE */
@@ -409,6 +416,12 @@ TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
                                    target_ulong cs_base, uint32_t flags);
 void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr);
 
+/* Number of executions after which a TB is retranslated with CF_TRACE */
+#ifndef TB_TRACE_THRESHOLD
+#define TB_TRACE_THRESHOLD 256
+#endif
+void tb_trace_hot(CPUState *cpu, TranslationBlock *tb);
+
 /* GETPC is the true target of the return instruction that we'll execute.  */
 #if defined(CONFIG_TCG_INTERPRETER)
 extern uintptr_t tci_tb_ptr;
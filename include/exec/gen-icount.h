@@ -36,6 +36,17 @@ static inline void gen_tb_start(TranslationBlock *tb)
 
     tcg_gen_brcondi_i32(TCG_COND_LT, count, 0, exitreq_label);
 
+    /* Chained TBs never return to tb_find, so the TB itself records that
+     * it ran and its code region is kept by the next eviction.  */
+    if (tcg_ctx.tb_ctx.n_regions > 1) {
+        TCGv_ptr tcg_tb = tcg_const_ptr(tb);
+
+        imm = tcg_const_i32(1);
+        tcg_gen_st16_i32(imm, tcg_tb, offsetof(TranslationBlock, used));
+        tcg_temp_free_i32(imm);
+        tcg_temp_free_ptr(tcg_tb);
+    }
+
     if (tb->cflags & CF_USE_ICOUNT) {
         tcg_gen_st16_i32(count, tcg_ctx.tcg_env,
                          -ENV_OFFSET + offsetof(CPUState, icount_decr.u16.low));
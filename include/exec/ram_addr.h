@@ -91,6 +91,8 @@ struct RAMBlock {
      * of the postcopy phase
      */
     unsigned long *unsentmap;
+    /* incoming compressed pages queued but not yet written to the block */
+    unsigned decompress_pending;
 };
 
 static inline bool offset_in_ramblock(RAMBlock *b, ram_addr_t offset)
@@ -245,6 +247,22 @@ static inline uint8_t cpu_physical_memory_range_includes_clean(ram_addr_t start,
     return ret;
 }
 
+/* Mark the summary bits covering @num pages at @offset of a migration dirty
+ * block.  Must be called after setting the dirty bits themselves.
+ */
+static inline void cpu_physical_memory_set_dirty_summary(unsigned long *block,
+                                                         unsigned long offset,
+                                                         unsigned long num)
+{
+    unsigned long *summary = dirty_memory_summary(block);
+    unsigned long first = offset / DIRTY_MEMORY_SUMMARY_PAGES;
+    unsigned long last = (offset + num - 1) / DIRTY_MEMORY_SUMMARY_PAGES;
+
+    for (; first <= last; first++) {
+        set_bit_atomic(first, summary);
+    }
+}
+
 static inline void cpu_physical_memory_set_dirty_flag(ram_addr_t addr,
                                                       unsigned client)
 {
@@ -262,6 +280,9 @@ static inline void cpu_physical_memory_set_dirty_flag(ram_addr_t addr,
     blocks = atomic_rcu_read(&ram_list.dirty_memory[client]);
 
     set_bit_atomic(offset, blocks->blocks[idx]);
+    if (client == DIRTY_MEMORY_MIGRATION) {
+        cpu_physical_memory_set_dirty_summary(blocks->blocks[idx], offset, 1);
+    }
 
     rcu_read_unlock();
 }
@@ -297,6 +318,9 @@ static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
         if (likely(mask & (1 << DIRTY_MEMORY_MIGRATION))) {
             bitmap_set_atomic(blocks[DIRTY_MEMORY_MIGRATION]->blocks[idx],
                               offset, next - page);
+            cpu_physical_memory_set_dirty_summary(
+                blocks[DIRTY_MEMORY_MIGRATION]->blocks[idx],
+                offset, next - page);
         }
         if (unlikely(mask & (1 << DIRTY_MEMORY_VGA))) {
             bitmap_set_atomic(blocks[DIRTY_MEMORY_VGA]->blocks[idx],
@@ -355,13 +379,15 @@ static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
                 unsigned long temp = leul_to_cpu(bitmap[k]);
 
                 atomic_or(&blocks[DIRTY_MEMORY_MIGRATION][idx][offset], temp);
+                set_bit_atomic(offset / DIRTY_MEMORY_SUMMARY_WORDS,
+                    dirty_memory_summary(blocks[DIRTY_MEMORY_MIGRATION][idx]));
                 atomic_or(&blocks[DIRTY_MEMORY_VGA][idx][offset], temp);
                 if (tcg_enabled()) {
                     atomic_or(&blocks[DIRTY_MEMORY_CODE][idx][offset], temp);
                 }
             }
 
-            if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
+            if (++offset >= DIRTY_MEMORY_BLOCK_WORDS) {
                 offset = 0;
                 idx++;
             }
@@ -441,18 +467,42 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
         src = atomic_rcu_read(
                 &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks;
 
-        for (k = page; k < page + nr; k++) {
-            if (src[idx][offset]) {
-                unsigned long bits = atomic_xchg(&src[idx][offset], 0);
-                unsigned long new_dirty;
-                *real_dirty_pages += ctpopl(bits);
-                new_dirty = ~dest[k];
-                dest[k] |= bits;
-                new_dirty &= bits;
-                num_dirty += ctpopl(new_dirty);
+        for (k = page; k < page + nr; ) {
+            unsigned long *bmap = src[idx];
+            int n = MIN(page + nr - k, DIRTY_MEMORY_SUMMARY_WORDS -
+                                       offset % DIRTY_MEMORY_SUMMARY_WORDS);
+            int j;
+
+            /* Groups that lie entirely within the range are skipped when
+             * clean; otherwise their summary bit is cleared before the
+             * words are harvested, so that concurrent writers set it again.
+             */
+            if (n == DIRTY_MEMORY_SUMMARY_WORDS) {
+                unsigned long *summary = dirty_memory_summary(bmap);
+                unsigned long s = offset / DIRTY_MEMORY_SUMMARY_WORDS;
+
+                if (!test_bit(s, summary)) {
+                    goto next;
+                }
+                atomic_and(&summary[BIT_WORD(s)], ~BIT_MASK(s));
             }
 
-            if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
+            for (j = 0; j < n; j++) {
+                if (bmap[offset + j]) {
+                    unsigned long bits = atomic_xchg(&bmap[offset + j], 0);
+                    unsigned long new_dirty;
+                    *real_dirty_pages += ctpopl(bits);
+                    new_dirty = ~dest[k + j];
+                    dest[k + j] |= bits;
+                    new_dirty &= bits;
+                    num_dirty += ctpopl(new_dirty);
+                }
+            }
+
+next:
+            k += n;
+            offset += n;
+            if (offset >= DIRTY_MEMORY_BLOCK_WORDS) {
                 offset = 0;
                 idx++;
             }
@@ -498,12 +548,32 @@ static inline void ram_list_clean(ram_addr_t start, ram_addr_t length)
         src = atomic_rcu_read(
                 &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks;
 
-        for (k = page; k < page + nr; k++) {
-            if (src[idx][offset]) {
-                atomic_set(&src[idx][offset], 0);
+        for (k = page; k < page + nr; ) {
+            unsigned long *bmap = src[idx];
+            long n = MIN(page + nr - k, DIRTY_MEMORY_SUMMARY_WORDS -
+                                        offset % DIRTY_MEMORY_SUMMARY_WORDS);
+            long j;
+
+            if (n == DIRTY_MEMORY_SUMMARY_WORDS) {
+                unsigned long *summary = dirty_memory_summary(bmap);
+                unsigned long s = offset / DIRTY_MEMORY_SUMMARY_WORDS;
+
+                if (!test_bit(s, summary)) {
+                    goto next;
+                }
+                atomic_and(&summary[BIT_WORD(s)], ~BIT_MASK(s));
+            }
+
+            for (j = 0; j < n; j++) {
+                if (bmap[offset + j]) {
+                    atomic_set(&bmap[offset + j], 0);
+                }
             }
 
-            if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
+next:
+            k += n;
+            offset += n;
+            if (offset >= DIRTY_MEMORY_BLOCK_WORDS) {
                 offset = 0;
                 idx++;
             }
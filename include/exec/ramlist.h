@@ -39,6 +39,24 @@ typedef struct RAMBlockNotifier RAMBlockNotifier;
  * pointed to from the new DirtyMemoryBlocks).
  */
 #define DIRTY_MEMORY_BLOCK_SIZE ((ram_addr_t)256 * 1024 * 8)
+#define DIRTY_MEMORY_BLOCK_WORDS BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)
+
+/* Each block is followed by a summary bitmap with one bit for every
+ * DIRTY_MEMORY_SUMMARY_WORDS words of the block.  It is only maintained for
+ * DIRTY_MEMORY_MIGRATION: a summary bit is set after the dirty bits it
+ * covers, and cleared before they are harvested, so a clear summary bit
+ * means the whole group is clean.  A set summary bit may be stale.
+ */
+#define DIRTY_MEMORY_SUMMARY_WORDS BITS_PER_LONG
+#define DIRTY_MEMORY_SUMMARY_PAGES (DIRTY_MEMORY_SUMMARY_WORDS * BITS_PER_LONG)
+#define DIRTY_MEMORY_SUMMARY_BITS \
+    (DIRTY_MEMORY_BLOCK_WORDS / DIRTY_MEMORY_SUMMARY_WORDS)
+
+static inline unsigned long *dirty_memory_summary(unsigned long *block)
+{
+    return block + DIRTY_MEMORY_BLOCK_WORDS;
+}
+
 typedef struct {
     struct rcu_head rcu;
     unsigned long *blocks[];
@@ -26,21 +26,46 @@
 #define CODE_GEN_HTABLE_BITS     15
 #define CODE_GEN_HTABLE_SIZE     (1 << CODE_GEN_HTABLE_BITS)
 
+/* code_gen_buffer is split into at most TB_REGIONS_MAX regions of at
+ * least TB_REGION_MIN_SIZE bytes.  Regions are filled in turn; when the
+ * last free one fills up, the one whose TBs ran least since the previous
+ * eviction is evicted instead of the whole buffer.
+ */
+#define TB_REGIONS_MAX           16
+#define TB_REGION_MIN_SIZE       (4 * 1024 * 1024)
+
 typedef struct TranslationBlock TranslationBlock;
 typedef struct TBContext TBContext;
+typedef struct TBRegion TBRegion;
+
+struct TBRegion {
+    void *start;
+    void *end;
+    /* fill pointer; tcg_ctx.code_gen_ptr holds it for the current region */
+    void *ptr;
+    /* TBs in this region, sorted by tc_ptr */
+    TranslationBlock **tbs;
+    size_t tbs_size;
+    int nb_tbs;
+};
 
 struct TBContext {
 
-    TranslationBlock **tbs;
+    TBRegion regions[TB_REGIONS_MAX];
+    size_t n_regions;
+    size_t cur_region;
     struct qht htable;
-    size_t tbs_size;
     int nb_tbs;
     /* any access to the tbs or the page table must use this lock */
     QemuMutex tb_lock;
 
     /* statistics */
     unsigned tb_flush_count;
+    unsigned tb_evict_count;
+    unsigned tb_evict_kept;     /* evictions that spared the oldest region */
+    uint64_t tb_evicted_tbs;
     int tb_phys_invalidate_count;
+    int tb_trace_count;
 };
 
 #endif
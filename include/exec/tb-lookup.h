@@ -0,0 +1,79 @@
+/*
+ * TB jump cache lookup
+ *
+ * Copyright (c) 2003 Fabrice Bellard
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXEC_TB_LOOKUP_H
+#define EXEC_TB_LOOKUP_H
+
+#include "exec/exec-all.h"
+#include "exec/tb-hash.h"
+
+static inline struct TranslationBlock **tb_jmp_cache_set(CPUState *cpu,
+                                                         target_ulong pc)
+{
+    return &cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc) * TB_JMP_CACHE_WAYS];
+}
+
+/* Probe all ways of the jump cache set for @pc.  Lookups run lock-free on
+ * the vCPU thread; other threads may only clear entries (see
+ * tb_phys_invalidate), never move them around.
+ */
+static inline TranslationBlock *tb_jmp_cache_lookup(CPUState *cpu,
+                                                    target_ulong pc,
+                                                    target_ulong cs_base,
+                                                    uint32_t flags)
+{
+    struct TranslationBlock **set = tb_jmp_cache_set(cpu, pc);
+    int i;
+
+    for (i = 0; i < TB_JMP_CACHE_WAYS; i++) {
+        TranslationBlock *tb = atomic_rcu_read(&set[i]);
+
+        if (likely(tb &&
+                   tb->pc == pc &&
+                   tb->cs_base == cs_base &&
+                   tb->flags == flags &&
+                   tb->trace_vcpu_dstate == *cpu->trace_dstate)) {
+            cpu->tb_jmp_cache_hits++;
+            return tb;
+        }
+    }
+    cpu->tb_jmp_cache_misses++;
+    return NULL;
+}
+
+/* Fill an empty way if there is one, otherwise evict one in round-robin
+ * order.  Entries are never copied between ways, so an entry cleared by a
+ * concurrent invalidation cannot be resurrected.
+ */
+static inline void tb_jmp_cache_insert(CPUState *cpu, target_ulong pc,
+                                       TranslationBlock *tb)
+{
+    struct TranslationBlock **set = tb_jmp_cache_set(cpu, pc);
+    int i;
+
+    for (i = 0; i < TB_JMP_CACHE_WAYS; i++) {
+        if (!atomic_read(&set[i])) {
+            atomic_set(&set[i], tb);
+            return;
+        }
+    }
+    atomic_set(&set[cpu->tb_jmp_cache_misses & (TB_JMP_CACHE_WAYS - 1)], tb);
+}
+
+#endif
@@ -48,6 +48,10 @@ struct QIOChannelSocket {
     socklen_t localAddrLen;
     struct sockaddr_storage remoteAddr;
     socklen_t remoteAddrLen;
+    bool zero_copy;
+    /* number of MSG_ZEROCOPY writes issued and completed */
+    uint64_t zero_copy_queued;
+    uint64_t zero_copy_sent;
 };
 
 
@@ -248,4 +252,43 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
                           Error **errp);
 
 
+/**
+ * qio_channel_socket_set_zero_copy:
+ * @ioc: the socket channel object
+ * @enabled: whether to send without copying
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Make writes to the socket pass the caller's buffers to the
+ * kernel (MSG_ZEROCOPY) instead of copying them.  The buffers
+ * must then stay unchanged until the write has completed, see
+ * qio_channel_socket_flush_zero_copy().  Only available on
+ * Linux.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc,
+                                 bool enabled,
+                                 Error **errp);
+
+
+/**
+ * qio_channel_socket_flush_zero_copy:
+ * @ioc: the socket channel object
+ * @seq: number of zero copy writes to wait for
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Wait until the first @seq zero copy writes issued on the
+ * socket have completed, so that the buffers they used may
+ * be reused.  @seq is compared against the zero_copy_queued
+ * counter of @ioc.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+qio_channel_socket_flush_zero_copy(QIOChannelSocket *ioc,
+                                   uint64_t seq,
+                                   Error **errp);
+
+
 #endif /* QIO_CHANNEL_SOCKET_H */
@@ -284,8 +284,21 @@ struct kvm_run;
 
 struct hax_vcpu_state;
 
+/* The TB jump cache is set-associative: TB_JMP_CACHE_SIZE sets of
+ * TB_JMP_CACHE_WAYS entries each.  Both can be chosen at configure time.
+ */
+#ifdef CONFIG_TB_JMP_CACHE_BITS
+#define TB_JMP_CACHE_BITS CONFIG_TB_JMP_CACHE_BITS
+#else
 #define TB_JMP_CACHE_BITS 12
+#endif
+#ifdef CONFIG_TB_JMP_CACHE_WAYS
+#define TB_JMP_CACHE_WAYS CONFIG_TB_JMP_CACHE_WAYS
+#else
+#define TB_JMP_CACHE_WAYS 2
+#endif
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
+#define TB_JMP_CACHE_ENTRIES (TB_JMP_CACHE_SIZE * TB_JMP_CACHE_WAYS)
 
 /* work queue */
 
@@ -356,6 +369,11 @@ struct qemu_work_item;
  * @trace_dstate_delayed: Delayed changes to trace_dstate (includes all changes
  *                        to @trace_dstate).
  * @trace_dstate: Dynamic tracing state of events for this vCPU (bitmask).
+ * @tb_jmp_cache_hits: Number of TB lookups served by @tb_jmp_cache.
+ * @tb_jmp_cache_misses: Number of TB lookups that fell back to the TB
+ *                       hash table.
+ * @trace_pc: Guest PC whose next translation should be a superblock.
+ * @trace_pending: Whether @trace_pc is valid.
  * @ignore_memory_transaction_failures: Cached copy of the MachineState
  *    flag of the same name: allows the board to suppress calling of the
  *    CPU do_transaction_failed hook function.
@@ -410,7 +428,12 @@ struct CPUState {
     void *env_ptr; /* CPUArchState */
 
     /* Accessed in parallel; all accesses must be atomic */
-    struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_ENTRIES];
+    /* Only written by the vCPU thread */
+    uint64_t tb_jmp_cache_hits;
+    uint64_t tb_jmp_cache_misses;
+    vaddr trace_pc;
+    bool trace_pending;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -491,7 +514,7 @@ static inline void cpu_tb_jmp_cache_clear(CPUState *cpu)
 {
     unsigned int i;
 
-    for (i = 0; i < TB_JMP_CACHE_SIZE; i++) {
+    for (i = 0; i < TB_JMP_CACHE_ENTRIES; i++) {
         atomic_set(&cpu->tb_jmp_cache[i], NULL);
     }
 }
@@ -80,6 +80,10 @@ typedef struct IOThread {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+
+    /* AioContext native Linux AIO parameters */
+    int64_t aio_max_events;
+    int64_t aio_max_batch;
 } IOThread;
 
 #define IOTHREAD(obj) \
@@ -145,6 +145,8 @@ int save_vmstate_ext_test(Monitor *mon, const char *name);
 int incremental_load_vmstate_ext(const char *name, Monitor* mon);
 int create_tmp_overlay(void);
 int delete_tmp_overlay(void);
+void squash_vmstate_ext(const char *top, const char *base, const char *job_id,
+                        int64_t speed, Error **errp);
 
 #endif
 
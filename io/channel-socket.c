@@ -24,6 +24,13 @@
 #include "io/channel-watch.h"
 #include "trace.h"
 #include "qapi/clone-visitor.h"
+#ifdef CONFIG_LINUX
+#include <poll.h>
+#include <linux/errqueue.h>
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define QEMU_MSG_ZEROCOPY
+#endif
+#endif
 
 #define SOCKET_MAX_FDS 16
 
@@ -370,6 +377,100 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
     return NULL;
 }
 
+int
+qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc,
+                                 bool enabled,
+                                 Error **errp)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    int v = enabled ? 1 : 0;
+
+    if (qemu_setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY,
+                        &v, sizeof(v)) < 0) {
+        error_setg_errno(errp, errno,
+                         "Unable to set zero copy on socket");
+        return -1;
+    }
+    ioc->zero_copy = enabled;
+    return 0;
+#else
+    if (enabled) {
+        error_setg(errp, "Zero copy sends are not supported on this host");
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+
+int
+qio_channel_socket_flush_zero_copy(QIOChannelSocket *ioc,
+                                   uint64_t seq,
+                                   Error **errp)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    while (ioc->zero_copy_sent < seq) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+        struct msghdr msg = { NULL, };
+        struct cmsghdr *cmsg;
+        ssize_t ret;
+
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ret = recvmsg(ioc->fd, &msg, MSG_ERRQUEUE);
+        if (ret < 0) {
+            struct pollfd pfd = { .fd = ioc->fd, .events = 0 };
+
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                error_setg_errno(errp, errno,
+                                 "Unable to read zero copy completions");
+                return -1;
+            }
+            /* The error queue becoming readable is reported as POLLERR */
+            if (poll(&pfd, 1, -1) > 0 &&
+                (pfd.revents & (POLLHUP | POLLNVAL)) &&
+                !(pfd.revents & POLLERR)) {
+                error_setg(errp, "Socket closed with zero copy writes "
+                           "in flight");
+                return -1;
+            }
+            continue;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            struct sock_extended_err *serr;
+
+            if (!((cmsg->cmsg_level == SOL_IP &&
+                   cmsg->cmsg_type == IP_RECVERR) ||
+                  (cmsg->cmsg_level == SOL_IPV6 &&
+                   cmsg->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            if (serr->ee_errno) {
+                error_setg_errno(errp, serr->ee_errno,
+                                 "Zero copy write failed");
+                return -1;
+            }
+            /* Completions cover the 32-bit range [ee_info, ee_data]
+             * and are reported in order.
+             */
+            ioc->zero_copy_sent +=
+                (uint32_t)(serr->ee_data - (uint32_t)ioc->zero_copy_sent) + 1;
+        }
+    }
+#endif
+    return 0;
+}
+
+
 static void qio_channel_socket_init(Object *obj)
 {
     QIOChannelSocket *ioc = QIO_CHANNEL_SOCKET(obj);
@@ -508,6 +609,7 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
     char control[CMSG_SPACE(sizeof(int) * SOCKET_MAX_FDS)];
     size_t fdsize = sizeof(int) * nfds;
     struct cmsghdr *cmsg;
+    int flags = 0;
 
     memset(control, 0, CMSG_SPACE(sizeof(int) * SOCKET_MAX_FDS));
 
@@ -532,8 +634,14 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
         memcpy(CMSG_DATA(cmsg), fds, fdsize);
     }
 
+#ifdef QEMU_MSG_ZEROCOPY
+    if (sioc->zero_copy && !nfds) {
+        flags = MSG_ZEROCOPY;
+    }
+#endif
+
  retry:
-    ret = sendmsg(sioc->fd, &msg, 0);
+    ret = sendmsg(sioc->fd, &msg, flags);
     if (ret <= 0) {
         if (errno == EAGAIN) {
             return QIO_CHANNEL_ERR_BLOCK;
@@ -541,10 +649,20 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
         if (errno == EINTR) {
             goto retry;
         }
+#ifdef QEMU_MSG_ZEROCOPY
+        if (errno == ENOBUFS && flags) {
+            /* Out of locked memory for pinned pages, copy this one.  */
+            flags = 0;
+            goto retry;
+        }
+#endif
         error_setg_errno(errp, errno,
                          "Unable to write to socket");
         return -1;
     }
+    if (flags) {
+        sioc->zero_copy_queued++;
+    }
     return ret;
 }
 #else /* WIN32 */
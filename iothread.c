@@ -61,6 +61,7 @@
 #include "qemu/module.h"
 #include "block/aio.h"
 #include "block/block.h"
+#include "block/raw-aio.h"
 #include "sysemu/iothread.h"
 #include "qmp-commands.h"
 #include "qemu/error-report.h"
@@ -200,6 +201,17 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
         return;
     }
 
+    aio_context_set_aio_params(iothread->ctx,
+                               iothread->aio_max_events,
+                               iothread->aio_max_batch,
+                               &local_error);
+    if (local_error) {
+        error_propagate(errp, local_error);
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+        return;
+    }
+
     qemu_mutex_init(&iothread->init_done_lock);
     qemu_cond_init(&iothread->init_done_cond);
     iothread->once = (GOnce) G_ONCE_INIT;
@@ -237,6 +249,12 @@ static PollParamInfo poll_grow_info = {
 static PollParamInfo poll_shrink_info = {
     "poll-shrink", offsetof(IOThread, poll_shrink),
 };
+static PollParamInfo aio_max_events_info = {
+    "aio-max-events", offsetof(IOThread, aio_max_events),
+};
+static PollParamInfo aio_max_batch_info = {
+    "aio-max-batch", offsetof(IOThread, aio_max_batch),
+};
 
 static void iothread_get_poll_param(Object *obj, Visitor *v,
         const char *name, void *opaque, Error **errp)
@@ -282,6 +300,38 @@ out:
     error_propagate(errp, local_err);
 }
 
+static void iothread_set_aio_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    PollParamInfo *info = opaque;
+    int64_t *field = (void *)iothread + info->offset;
+    Error *local_err = NULL;
+    int64_t value, old;
+
+    visit_type_int64(v, name, &value, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    old = *field;
+    *field = value;
+
+    /* Range checks are left to iothread_complete() before creation */
+    if (iothread->ctx) {
+        aio_context_set_aio_params(iothread->ctx,
+                                   iothread->aio_max_events,
+                                   iothread->aio_max_batch,
+                                   &local_err);
+        if (local_err) {
+            *field = old;
+        }
+    }
+
+out:
+    error_propagate(errp, local_err);
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
@@ -299,6 +349,14 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info, &error_abort);
+    object_class_property_add(klass, "aio-max-events", "int",
+                              iothread_get_poll_param,
+                              iothread_set_aio_param,
+                              NULL, &aio_max_events_info, &error_abort);
+    object_class_property_add(klass, "aio-max-batch", "int",
+                              iothread_get_poll_param,
+                              iothread_set_aio_param,
+                              NULL, &aio_max_batch_info, &error_abort);
 }
 
 static const TypeInfo iothread_info = {
@@ -349,6 +407,15 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_max_ns = iothread->poll_max_ns;
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
+    info->aio_max_events = iothread->aio_max_events;
+    info->aio_max_batch = iothread->aio_max_batch;
+#ifdef CONFIG_LINUX_AIO
+    /* Like the poll parameters, read without synchronization */
+    if (iothread->ctx && iothread->ctx->linux_aio) {
+        info->has_linux_aio = true;
+        info->linux_aio = laio_get_stats(iothread->ctx->linux_aio);
+    }
+#endif
 
     elem = g_new0(IOThreadInfoList, 1);
     elem->value = info;
@@ -67,6 +67,7 @@
 #include "qapi/visitor.h"
 #include "qemu/bitops.h"
 #include "qemu/error-report.h"
+#include "qemu/timer.h"
 #include "qom/object.h"
 #include "trace-root.h"
 
@@ -93,6 +94,20 @@ static QTAILQ_HEAD(, AddressSpace) address_spaces
 
 static GHashTable *flat_views;
 
+/* Regions changed by the current transaction.  Only the FlatViews whose
+ * tree contains one of them are rendered again on commit, unless
+ * memory_region_update_all says that every view is affected.
+ */
+static GHashTable *memory_region_update_regions;
+static bool memory_region_update_all;
+
+static struct {
+    unsigned commits;
+    unsigned renders;
+    unsigned reuses;
+    int64_t render_ns;
+} flatview_stats;
+
 typedef struct AddrRange AddrRange;
 
 /*
@@ -825,6 +840,8 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
 /* Render a memory topology into a list of disjoint absolute ranges. */
 static FlatView *generate_memory_topology(MemoryRegion *mr)
 {
+    int64_t start = get_clock();
+    int64_t ns;
     int i;
     FlatView *view;
 
@@ -845,6 +862,11 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     address_space_dispatch_compact(view->dispatch);
     g_hash_table_replace(flat_views, mr, view);
 
+    ns = get_clock() - start;
+    flatview_stats.renders++;
+    flatview_stats.render_ns += ns;
+    trace_flatview_render(view, mr, view->nr, ns);
+
     return view;
 }
 
@@ -1033,26 +1055,116 @@ static void flatviews_init(void)
     }
 }
 
-static void flatviews_reset(void)
+/* Render unique FVs */
+static void flatviews_render_missing(void)
 {
     AddressSpace *as;
 
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+
+        if (g_hash_table_lookup(flat_views, physmr)) {
+            continue;
+        }
+
+        generate_memory_topology(physmr);
+    }
+}
+
+static void flatviews_reset(void)
+{
     if (flat_views) {
         g_hash_table_unref(flat_views);
         flat_views = NULL;
     }
     flatviews_init();
+    flatviews_render_missing();
+}
 
-    /* Render unique FVs */
-    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
-        MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+/* Walk the tree the same way render_memory_region does, but including
+ * disabled regions, which may have just been toggled.
+ */
+static bool memory_region_contains_any(MemoryRegion *mr, GHashTable *regions)
+{
+    MemoryRegion *subregion;
 
-        if (g_hash_table_lookup(flat_views, physmr)) {
-            continue;
+    if (g_hash_table_contains(regions, mr)) {
+        return true;
+    }
+    if (mr->alias) {
+        return memory_region_contains_any(mr->alias, regions);
+    }
+    QTAILQ_FOREACH(subregion, &mr->subregions, subregions_link) {
+        if (memory_region_contains_any(subregion, regions)) {
+            return true;
         }
+    }
+    return false;
+}
 
-        generate_memory_topology(physmr);
+typedef struct FlatViewUpdate {
+    GHashTable *roots;
+    GHashTable *changed;
+} FlatViewUpdate;
+
+static gboolean flatview_drop_stale(gpointer key, gpointer value,
+                                    gpointer opaque)
+{
+    MemoryRegion *root = key;
+    FlatViewUpdate *u = opaque;
+
+    if (!root) {
+        return false;
+    }
+    if (!g_hash_table_contains(u->roots, root) ||
+        memory_region_contains_any(root, u->changed)) {
+        return true;
+    }
+    flatview_stats.reuses++;
+    return false;
+}
+
+/* Drop the views that are no longer used by any address space or that
+ * contain a region changed by the transaction, and render what is missing.
+ * The others are kept, so that their address spaces see no change at all.
+ */
+static void flatviews_update(void)
+{
+    FlatViewUpdate u;
+    AddressSpace *as;
+
+    if (!flat_views || memory_region_update_all ||
+        !memory_region_update_regions) {
+        flatviews_reset();
+        return;
+    }
+
+    u.roots = g_hash_table_new(g_direct_hash, g_direct_equal);
+    u.changed = memory_region_update_regions;
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        g_hash_table_add(u.roots, memory_region_get_flatview_root(as->root));
+    }
+    g_hash_table_foreach_remove(flat_views, flatview_drop_stale, &u);
+    g_hash_table_unref(u.roots);
+
+    flatviews_render_missing();
+}
+
+/* Record that the views containing @mr must be rendered again.  A NULL
+ * @mr affects all of them.
+ */
+static void memory_region_update_mark(MemoryRegion *mr)
+{
+    memory_region_update_pending = true;
+    if (!mr) {
+        memory_region_update_all = true;
+        return;
+    }
+    if (!memory_region_update_regions) {
+        memory_region_update_regions = g_hash_table_new(g_direct_hash,
+                                                        g_direct_equal);
     }
+    g_hash_table_add(memory_region_update_regions, mr);
 }
 
 static void address_space_set_flatview(AddressSpace *as)
@@ -1127,7 +1239,8 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
-            flatviews_reset();
+            flatview_stats.commits++;
+            flatviews_update();
 
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
@@ -1136,6 +1249,10 @@ void memory_region_transaction_commit(void)
                 address_space_update_ioeventfds(as);
             }
             memory_region_update_pending = false;
+            memory_region_update_all = false;
+            if (memory_region_update_regions) {
+                g_hash_table_remove_all(memory_region_update_regions);
+            }
             MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
         } else if (ioeventfd_update_pending) {
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
@@ -1981,7 +2098,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_mark(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2061,7 +2180,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_mark(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2071,7 +2192,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_mark(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2341,7 +2464,9 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_mark(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2379,8 +2504,10 @@ void memory_region_del_subregion(MemoryRegion *mr,
     assert(subregion->container == mr);
     subregion->container = NULL;
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_mark(mr);
+    }
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
 
@@ -2391,7 +2518,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_update_mark(mr);
     memory_region_transaction_commit();
 }
 
@@ -2407,7 +2534,7 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
     }
     memory_region_transaction_begin();
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_update_mark(mr);
     memory_region_transaction_commit();
 }
 
@@ -2444,7 +2571,9 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_mark(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2586,7 +2715,7 @@ void memory_global_dirty_log_start(void)
 
     /* Refresh DIRTY_LOG_MIGRATION bit.  */
     memory_region_transaction_begin();
-    memory_region_update_pending = true;
+    memory_region_update_mark(NULL);
     memory_region_transaction_commit();
 }
 
@@ -2596,7 +2725,7 @@ static void memory_global_dirty_log_do_stop(void)
 
     /* Refresh DIRTY_LOG_MIGRATION bit.  */
     memory_region_transaction_begin();
-    memory_region_update_pending = true;
+    memory_region_update_mark(NULL);
     memory_region_transaction_commit();
 
     MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
@@ -3111,6 +3240,11 @@ void mtree_info(fprintf_function mon_printf, void *f, bool flatview,
         g_hash_table_foreach_remove(views, mtree_info_flatview_free, 0);
         g_hash_table_unref(views);
 
+        mon_printf(f, "FlatView renders: %u, reused: %u, commits: %u, "
+                   "render time: %" PRId64 " us\n",
+                   flatview_stats.renders, flatview_stats.reuses,
+                   flatview_stats.commits, flatview_stats.render_ns / 1000);
+
         return;
     }
 
@@ -18,6 +18,7 @@
 #include "trace.h"
 #include "qapi/error.h"
 #include "io/channel-tls.h"
+#include "io/channel-socket.h"
 
 /**
  * @migration_channel_process_incoming - Create new incoming migration channel
@@ -74,7 +75,18 @@ void migration_channel_connect(MigrationState *s,
             error_free(local_err);
         }
     } else {
-        QEMUFile *f = qemu_fopen_channel_output(ioc);
+        QEMUFile *f;
+
+        if (migrate_use_zero_copy() &&
+            object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_SOCKET)) {
+            Error *local_err = NULL;
+
+            if (qio_channel_socket_set_zero_copy(QIO_CHANNEL_SOCKET(ioc),
+                                                 true, &local_err) < 0) {
+                warn_report_err(local_err);
+            }
+        }
+        f = qemu_fopen_channel_output(ioc);
 
         s->to_dst_file = f;
 
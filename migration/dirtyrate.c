@@ -0,0 +1,318 @@
+/*
+ * Dirty page rate estimation
+ *
+ * A measurement samples pages of every RAMBlock, hashes them, waits and
+ * hashes them again.  The share of sampled pages whose hash changed gives
+ * both the overall dirty rate and a coarse per-region heatmap of each
+ * block.  Unlike the dirty log this needs no cooperation from migration or
+ * extsnap, so it can run while either of them owns the dirty bitmap.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include <zlib.h>
+#include "qapi/error.h"
+#include "qapi/clone-visitor.h"
+#include "qemu/cutils.h"
+#include "qemu/thread.h"
+#include "qemu/rcu.h"
+#include "qemu/rcu_queue.h"
+#include "exec/ram_addr.h"
+#include "migration/dirtyrate.h"
+#include "qapi-visit.h"
+#include "qmp-commands.h"
+
+#define DIRTY_RATE_DEFAULT_SAMPLE_PAGES 512
+#define DIRTY_RATE_MAX_SAMPLE_PAGES     (1 << 20)
+#define DIRTY_RATE_DEFAULT_REGIONS      16
+#define DIRTY_RATE_MAX_REGIONS          1024
+#define DIRTY_RATE_MAX_CALC_TIME        60
+
+typedef struct DirtyRateBlockState {
+    char idstr[256];
+    ram_addr_t length;
+    /* pages per heatmap region */
+    uint64_t region_pages;
+    uint32_t nsamples;
+    uint64_t *page;
+    uint32_t *hash;
+    /* per region */
+    uint32_t *sampled;
+    uint32_t *dirty;
+    QTAILQ_ENTRY(DirtyRateBlockState) next;
+} DirtyRateBlockState;
+
+typedef struct DirtyRateJob {
+    int64_t calc_time;
+    int64_t sample_pages;
+    int64_t regions;
+    QTAILQ_HEAD(, DirtyRateBlockState) blocks;
+} DirtyRateJob;
+
+static struct {
+    QemuMutex lock;
+    DirtyRateStatus status;
+    int64_t start_time;
+    int64_t calc_time;
+    int64_t dirty_rate;
+    DirtyRateBlockList *blocks;
+} dirty_rate = {
+    .status = DIRTY_RATE_STATUS_UNSTARTED,
+};
+
+static void __attribute__((constructor)) dirty_rate_init(void)
+{
+    qemu_mutex_init(&dirty_rate.lock);
+}
+
+static uint32_t dirty_rate_hash_page(RAMBlock *block, uint64_t page)
+{
+    return crc32(0, block->host + (page << TARGET_PAGE_BITS),
+                 TARGET_PAGE_SIZE);
+}
+
+static bool dirty_rate_skip_block(RAMBlock *block)
+{
+    return !block->host || !block->used_length ||
+           (block->mr && memory_region_is_ram_device(block->mr));
+}
+
+/* Pick the sample pages of every block and record their hash.  The pages
+ * of a region are distinct, so that a dirty page is never counted twice.
+ * Called within an RCU critical section.
+ */
+static void dirty_rate_record(DirtyRateJob *job)
+{
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH(block) {
+        DirtyRateBlockState *bs;
+        uint64_t npages, nsamples, per_region, r;
+        uint32_t n = 0;
+
+        if (dirty_rate_skip_block(block)) {
+            continue;
+        }
+        npages = block->used_length >> TARGET_PAGE_BITS;
+        nsamples = DIV_ROUND_UP((block->used_length >> 20) * job->sample_pages,
+                                1024);
+        nsamples = MIN(MAX(nsamples, job->regions), npages);
+
+        bs = g_new0(DirtyRateBlockState, 1);
+        pstrcpy(bs->idstr, sizeof(bs->idstr), block->idstr);
+        bs->length = block->used_length;
+        bs->region_pages = DIV_ROUND_UP(npages, job->regions);
+        per_region = DIV_ROUND_UP(nsamples, job->regions);
+        bs->page = g_new(uint64_t, per_region * job->regions);
+        bs->hash = g_new(uint32_t, per_region * job->regions);
+        bs->sampled = g_new0(uint32_t, job->regions);
+        bs->dirty = g_new0(uint32_t, job->regions);
+
+        for (r = 0; r < job->regions; r++) {
+            uint64_t start = r * bs->region_pages;
+            uint64_t len, count, offset, i;
+
+            if (start >= npages) {
+                break;
+            }
+            len = MIN(bs->region_pages, npages - start);
+            count = MIN(per_region, len);
+            offset = MIN((uint64_t)(g_random_double() * len), len - 1);
+
+            for (i = 0; i < count; i++) {
+                uint64_t page = start +
+                                dirty_rate_sample_page(len, count, i, offset);
+
+                bs->page[n] = page;
+                bs->hash[n] = dirty_rate_hash_page(block, page);
+                bs->sampled[r]++;
+                n++;
+            }
+        }
+        bs->nsamples = n;
+        QTAILQ_INSERT_TAIL(&job->blocks, bs, next);
+    }
+}
+
+/* Hash the sample pages again and count the ones that changed.  Blocks
+ * that went away or were resized meanwhile are dropped.  Called within an
+ * RCU critical section.
+ */
+static void dirty_rate_compare(DirtyRateJob *job)
+{
+    DirtyRateBlockState *bs;
+
+    QTAILQ_FOREACH(bs, &job->blocks, next) {
+        RAMBlock *block = qemu_ram_block_by_name(bs->idstr);
+        uint32_t i;
+
+        if (!block || dirty_rate_skip_block(block) ||
+            block->used_length != bs->length) {
+            bs->nsamples = 0;
+            continue;
+        }
+        for (i = 0; i < bs->nsamples; i++) {
+            if (dirty_rate_hash_page(block, bs->page[i]) != bs->hash[i]) {
+                bs->dirty[bs->page[i] / bs->region_pages]++;
+            }
+        }
+    }
+}
+
+static void dirty_rate_publish(DirtyRateJob *job)
+{
+    DirtyRateBlockState *bs;
+    DirtyRateBlockList *list = NULL, **tail = &list;
+    uint64_t dirty_bytes = 0;
+
+    QTAILQ_FOREACH(bs, &job->blocks, next) {
+        DirtyRateBlockList *entry;
+        DirtyRateBlock *info;
+        intList **heat;
+        uint64_t dirty = 0;
+        int64_t r;
+
+        if (!bs->nsamples) {
+            continue;
+        }
+        info = g_new0(DirtyRateBlock, 1);
+        info->id = g_strdup(bs->idstr);
+        info->length = bs->length;
+        info->sampled_pages = bs->nsamples;
+        heat = &info->heatmap;
+        for (r = 0; r < job->regions; r++) {
+            intList *h = g_new0(intList, 1);
+
+            h->value = bs->sampled[r] ? bs->dirty[r] * 100 / bs->sampled[r]
+                                      : 0;
+            *heat = h;
+            heat = &h->next;
+            dirty += bs->dirty[r];
+        }
+        info->dirty_pages = dirty;
+        info->dirty_bytes = (uint64_t)((double)bs->length * dirty /
+                                       bs->nsamples);
+        dirty_bytes += info->dirty_bytes;
+
+        entry = g_new0(DirtyRateBlockList, 1);
+        entry->value = info;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    qemu_mutex_lock(&dirty_rate.lock);
+    qapi_free_DirtyRateBlockList(dirty_rate.blocks);
+    dirty_rate.blocks = list;
+    dirty_rate.dirty_rate = dirty_bytes / job->calc_time / (1024 * 1024);
+    dirty_rate.status = DIRTY_RATE_STATUS_MEASURED;
+    qemu_mutex_unlock(&dirty_rate.lock);
+}
+
+static void dirty_rate_job_free(DirtyRateJob *job)
+{
+    DirtyRateBlockState *bs, *next;
+
+    QTAILQ_FOREACH_SAFE(bs, &job->blocks, next, next) {
+        QTAILQ_REMOVE(&job->blocks, bs, next);
+        g_free(bs->page);
+        g_free(bs->hash);
+        g_free(bs->sampled);
+        g_free(bs->dirty);
+        g_free(bs);
+    }
+    g_free(job);
+}
+
+static void *dirty_rate_thread(void *opaque)
+{
+    DirtyRateJob *job = opaque;
+
+    rcu_register_thread();
+
+    rcu_read_lock();
+    dirty_rate_record(job);
+    rcu_read_unlock();
+
+    g_usleep(job->calc_time * G_USEC_PER_SEC);
+
+    rcu_read_lock();
+    dirty_rate_compare(job);
+    rcu_read_unlock();
+
+    dirty_rate_publish(job);
+    dirty_rate_job_free(job);
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+void qmp_calc_dirty_rate(int64_t calc_time, bool has_sample_pages,
+                         int64_t sample_pages, bool has_regions,
+                         int64_t regions, Error **errp)
+{
+    DirtyRateJob *job;
+    QemuThread thread;
+
+    if (calc_time < 1 || calc_time > DIRTY_RATE_MAX_CALC_TIME) {
+        error_setg(errp, "calc-time must be between 1 and %d seconds",
+                   DIRTY_RATE_MAX_CALC_TIME);
+        return;
+    }
+    if (!has_sample_pages) {
+        sample_pages = DIRTY_RATE_DEFAULT_SAMPLE_PAGES;
+    } else if (sample_pages < 1 ||
+               sample_pages > DIRTY_RATE_MAX_SAMPLE_PAGES) {
+        error_setg(errp, "sample-pages must be between 1 and %d",
+                   DIRTY_RATE_MAX_SAMPLE_PAGES);
+        return;
+    }
+    if (!has_regions) {
+        regions = DIRTY_RATE_DEFAULT_REGIONS;
+    } else if (regions < 1 || regions > DIRTY_RATE_MAX_REGIONS) {
+        error_setg(errp, "regions must be between 1 and %d",
+                   DIRTY_RATE_MAX_REGIONS);
+        return;
+    }
+
+    qemu_mutex_lock(&dirty_rate.lock);
+    if (dirty_rate.status == DIRTY_RATE_STATUS_MEASURING) {
+        qemu_mutex_unlock(&dirty_rate.lock);
+        error_setg(errp, "A dirty rate measurement is already in progress");
+        return;
+    }
+    dirty_rate.status = DIRTY_RATE_STATUS_MEASURING;
+    dirty_rate.start_time = g_get_real_time() / G_USEC_PER_SEC;
+    dirty_rate.calc_time = calc_time;
+    qemu_mutex_unlock(&dirty_rate.lock);
+
+    job = g_new0(DirtyRateJob, 1);
+    job->calc_time = calc_time;
+    job->sample_pages = sample_pages;
+    job->regions = regions;
+    QTAILQ_INIT(&job->blocks);
+
+    qemu_thread_create(&thread, "dirtyrate", dirty_rate_thread, job,
+                       QEMU_THREAD_DETACHED);
+}
+
+DirtyRateInfo *qmp_query_dirty_rate(Error **errp)
+{
+    DirtyRateInfo *info = g_new0(DirtyRateInfo, 1);
+
+    qemu_mutex_lock(&dirty_rate.lock);
+    info->status = dirty_rate.status;
+    info->start_time = dirty_rate.start_time;
+    info->calc_time = dirty_rate.calc_time;
+    if (dirty_rate.status == DIRTY_RATE_STATUS_MEASURED) {
+        info->has_dirty_rate = true;
+        info->dirty_rate = dirty_rate.dirty_rate;
+        info->has_blocks = true;
+        info->blocks = QAPI_CLONE(DirtyRateBlockList, dirty_rate.blocks);
+    }
+    qemu_mutex_unlock(&dirty_rate.lock);
+
+    return info;
+}
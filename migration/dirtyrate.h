@@ -0,0 +1,22 @@
+/*
+ * Dirty page rate estimation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_DIRTYRATE_H
+#define QEMU_MIGRATION_DIRTYRATE_H
+
+/* Return the @i-th of @n samples taken from a region of @len pages, as a
+ * page index within the region.  0 <= @i < @n <= @len and 0 <= @offset <
+ * @len.  The samples are one per stride of @len / @n pages, shifted by
+ * @offset, so they are all distinct and increase with @i.
+ */
+static inline uint64_t dirty_rate_sample_page(uint64_t len, uint64_t n,
+                                              uint64_t i, uint64_t offset)
+{
+    return (i * len + offset) / n;
+}
+
+#endif
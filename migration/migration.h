@@ -177,6 +177,7 @@ bool migrate_zero_blocks(void);
 
 bool migrate_auto_converge(void);
 bool migrate_use_multifd(void);
+bool migrate_use_zero_copy(void);
 int migrate_multifd_channels(void);
 int migrate_multifd_page_count(void);
 
@@ -137,6 +137,27 @@ static int channel_set_blocking(void *opaque,
     return 0;
 }
 
+static uint64_t channel_zero_copy_queued(void *opaque)
+{
+    QIOChannelSocket *sioc;
+
+    sioc = (QIOChannelSocket *)object_dynamic_cast(OBJECT(opaque),
+                                                   TYPE_QIO_CHANNEL_SOCKET);
+    return sioc ? sioc->zero_copy_queued : 0;
+}
+
+
+static int channel_zero_copy_flush(void *opaque, uint64_t seq)
+{
+    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(opaque);
+
+    if (qio_channel_socket_flush_zero_copy(sioc, seq, NULL) < 0) {
+        /* XXX handle Error * object */
+        return -EIO;
+    }
+    return 0;
+}
+
 static QEMUFile *channel_get_input_return_path(void *opaque)
 {
     QIOChannel *ioc = QIO_CHANNEL(opaque);
@@ -166,6 +187,8 @@ static const QEMUFileOps channel_output_ops = {
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_output_return_path,
+    .zero_copy_queued = channel_zero_copy_queued,
+    .zero_copy_flush = channel_zero_copy_flush,
 };
 
 
@@ -31,7 +31,7 @@
 #include "trace.h"
 
 #define IO_BUF_SIZE 32768
-#define MAX_IOV_SIZE MIN(IOV_MAX, 64)
+#define MAX_IOV_SIZE MIN(IOV_MAX, 512)
 
 struct QEMUFile {
     const QEMUFileOps *ops;
@@ -45,7 +45,15 @@ struct QEMUFile {
                     when reading */
     int buf_index;
     int buf_size; /* 0 when writing */
-    uint8_t buf[IO_BUF_SIZE];
+    uint8_t *buf; /* one of bufs[] */
+
+    /* With zero copy transports the kernel may still read the buffer
+     * after writev_buffer returns, so writes alternate between two
+     * buffers.  bufs_seq[i] is the number of zero copy writes that must
+     * complete before bufs[i] can be reused.
+     */
+    uint8_t *bufs[2];
+    uint64_t bufs_seq[2];
 
     DECLARE_BITMAP(may_free, MAX_IOV_SIZE);
     struct iovec iov[MAX_IOV_SIZE];
@@ -98,6 +106,8 @@ QEMUFile *qemu_fopen_ops(void *opaque, const QEMUFileOps *ops)
 
     f->opaque = opaque;
     f->ops = ops;
+    f->bufs[0] = g_malloc(IO_BUF_SIZE);
+    f->buf = f->bufs[0];
     return f;
 }
 
@@ -131,6 +141,44 @@ bool qemu_file_is_writable(QEMUFile *f)
     return f->ops->writev_buffer;
 }
 
+static uint64_t qemu_file_zero_copy_queued(QEMUFile *f)
+{
+    if (!f->ops->zero_copy_queued) {
+        return 0;
+    }
+    return f->ops->zero_copy_queued(f->opaque);
+}
+
+static void qemu_file_zero_copy_flush(QEMUFile *f, uint64_t seq)
+{
+    int ret;
+
+    if (!seq) {
+        return;
+    }
+    ret = f->ops->zero_copy_flush(f->opaque, seq);
+    if (ret < 0) {
+        qemu_file_set_error(f, ret);
+    }
+}
+
+/* Switch to the other buffer once the kernel may still be reading this
+ * one, waiting for the other one to be released if needed.
+ */
+static void qemu_file_swap_buf(QEMUFile *f, uint64_t seq)
+{
+    int cur = f->buf == f->bufs[1];
+    int next = !cur;
+
+    f->bufs_seq[cur] = seq;
+    if (!f->bufs[next]) {
+        f->bufs[next] = g_malloc(IO_BUF_SIZE);
+    } else {
+        qemu_file_zero_copy_flush(f, f->bufs_seq[next]);
+    }
+    f->buf = f->bufs[next];
+}
+
 static void qemu_iovec_release_ram(QEMUFile *f)
 {
     struct iovec iov;
@@ -183,9 +231,19 @@ void qemu_fflush(QEMUFile *f)
     }
 
     if (f->iovcnt > 0) {
+        uint64_t seq;
+
         expect = iov_size(f->iov, f->iovcnt);
         ret = f->ops->writev_buffer(f->opaque, f->iov, f->iovcnt, f->pos);
 
+        seq = qemu_file_zero_copy_queued(f);
+        if (seq) {
+            /* Pages must not be discarded while the kernel reads them */
+            if (find_first_bit(f->may_free, f->iovcnt) < f->iovcnt) {
+                qemu_file_zero_copy_flush(f, seq);
+            }
+            qemu_file_swap_buf(f, seq);
+        }
         qemu_iovec_release_ram(f);
     }
 
@@ -321,6 +379,9 @@ int qemu_fclose(QEMUFile *f)
 {
     int ret;
     qemu_fflush(f);
+    if (qemu_file_is_writable(f)) {
+        qemu_file_zero_copy_flush(f, qemu_file_zero_copy_queued(f));
+    }
     ret = qemu_file_get_error(f);
 
     if (f->ops->close) {
@@ -335,6 +396,8 @@ int qemu_fclose(QEMUFile *f)
     if (f->last_error) {
         ret = f->last_error;
     }
+    g_free(f->bufs[0]);
+    g_free(f->bufs[1]);
     g_free(f);
     trace_qemu_file_fclose();
     return ret;
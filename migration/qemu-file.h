@@ -97,6 +97,18 @@ typedef QEMUFile *(QEMURetPathFunc)(void *opaque);
  */
 typedef int (QEMUFileShutdownFunc)(void *opaque, bool rd, bool wr);
 
+/*
+ * For transports that send writev_buffer data without copying it: return
+ * the number of such writes issued so far, or 0 if data is always copied.
+ */
+typedef uint64_t (QEMUFileZeroCopyQueuedFunc)(void *opaque);
+
+/*
+ * Wait until the first 'seq' zero copy writes have completed and their
+ * buffers may be reused.  Returns 0 on success, -err on error.
+ */
+typedef int (QEMUFileZeroCopyFlushFunc)(void *opaque, uint64_t seq);
+
 typedef struct QEMUFileOps {
     QEMUFileGetBufferFunc *get_buffer;
     QEMUFileCloseFunc *close;
@@ -104,6 +116,8 @@ typedef struct QEMUFileOps {
     QEMUFileWritevBufferFunc *writev_buffer;
     QEMURetPathFunc *get_return_path;
     QEMUFileShutdownFunc *shut_down;
+    QEMUFileZeroCopyQueuedFunc *zero_copy_queued;
+    QEMUFileZeroCopyFlushFunc *zero_copy_flush;
 } QEMUFileOps;
 
 typedef struct QEMUFileHooks {
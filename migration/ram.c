@@ -110,6 +110,7 @@
 #define RAM_SAVE_FLAG_XBZRLE   0x40
 /* 0x80 is reserved in migration.h start with 0x100 next */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
+#define RAM_SAVE_FLAG_MULTIFD_PAGE     0x200
 
 static inline bool is_zero_range(uint8_t *p, uint64_t size)
 {
@@ -192,6 +193,29 @@ out:
     return ret;
 }
 
+#ifdef CONFIG_EXTSNAP
+/* With XBZRLE enabled, the cache outlives a checkpoint: it then holds
+ * pages as they were sent in earlier checkpoints of the chain, which is
+ * what the guest memory contains when the next checkpoint is loaded on
+ * top of them.  Pages dirtied since the parent checkpoint are then sent
+ * as deltas against it.  Anything that breaks that correspondence
+ * (loading a snapshot, saving without XBZRLE, RAM hotplug) drops it.
+ */
+static uint32_t xbzrle_snapshot_version;
+
+static void xbzrle_snapshot_cache_drop(void)
+{
+    XBZRLE_cache_lock();
+    if (XBZRLE.cache) {
+        cache_fini(XBZRLE.cache);
+        g_free(XBZRLE.zero_target_page);
+        XBZRLE.cache = NULL;
+        XBZRLE.zero_target_page = NULL;
+    }
+    XBZRLE_cache_unlock();
+}
+#endif
+
 /*
  * An outstanding page request, on the source, having been received
  * and queued
@@ -218,6 +242,10 @@ struct RAMState {
     uint32_t last_version;
     /* We are in the first round */
     bool ram_bulk_stage;
+#ifdef CONFIG_EXTSNAP
+    /* The XBZRLE cache holds the pages of the parent checkpoint */
+    bool xbzrle_incremental;
+#endif
     /* How many times we have dirty too many pages */
     int dirty_rate_high_cnt;
     /* these variables are used for bitmap sync */
@@ -276,16 +304,45 @@ struct CompressParam {
 };
 typedef struct CompressParam CompressParam;
 
-struct DecompressParam {
-    bool done;
+/* Compressed pages are loaded in batches: the thread reading the stream
+ * copies the compressed data of up to DECOMPRESS_BATCH_PAGES pages into a
+ * batch and queues it, and the first idle decompression thread writes
+ * them to their host addresses.
+ */
+#define DECOMPRESS_BATCH_PAGES 64
+
+typedef struct DecompressPage {
+    RAMBlock *block;
+    void *host;
+    uint32_t offset;
+    uint32_t len;
+} DecompressPage;
+
+typedef struct DecompressBatch {
+    int nr;
+    uint32_t used;
+    uint8_t *buf;
+    DecompressPage page[DECOMPRESS_BATCH_PAGES];
+    QSIMPLEQ_ENTRY(DecompressBatch) next;
+} DecompressBatch;
+
+typedef struct DecompressState {
+    QemuMutex lock;
+    /* signalled when a batch is queued or the threads must quit */
+    QemuCond work_cond;
+    /* signalled when a batch has been written to guest memory */
+    QemuCond done_cond;
+    QSIMPLEQ_HEAD(, DecompressBatch) work;
+    QSIMPLEQ_HEAD(, DecompressBatch) free;
+    int in_flight;
     bool quit;
-    QemuMutex mutex;
-    QemuCond cond;
-    void *des;
-    uint8_t *compbuf;
-    int len;
-};
-typedef struct DecompressParam DecompressParam;
+    /* batch being filled, only accessed by the loading thread */
+    DecompressBatch *cur;
+    DecompressBatch *batches;
+    int nr_batches;
+    QemuThread *threads;
+    int nr_threads;
+} DecompressState;
 
 static CompressParam *comp_param;
 static QemuThread *compress_threads;
@@ -298,10 +355,7 @@ static QemuCond comp_done_cond;
 /* The empty QEMUFileOps will be used by file in CompressParam */
 static const QEMUFileOps empty_ops = { };
 
-static DecompressParam *decomp_param;
-static QemuThread *decompress_threads;
-static QemuMutex decomp_done_lock;
-static QemuCond decomp_done_cond;
+static DecompressState *decomp_state;
 
 static int do_compress_ram_page(QEMUFile *f, RAMBlock *block,
                                 ram_addr_t offset);
@@ -403,6 +457,38 @@ static void compress_threads_save_setup(void)
 
 /* Multiple fd's */
 
+/* Dirty pages are handed to the multifd threads in batches of up to
+ * x-multifd-page-count pages of one RAMBlock.  A channel thread looks
+ * for zero pages and, with the compress capability, deflates the batch
+ * with its own zlib stream.  The migration thread then writes the batch
+ * to the stream as a single RAM_SAVE_FLAG_MULTIFD_PAGE record:
+ *
+ *   be32 number of pages
+ *   be32 encoding (MULTIFD_ENC_*)
+ *   be64 page offset in the block, for every page; MULTIFD_PAGE_ZERO
+ *        is set for pages that are all zeroes and carry no data
+ *   MULTIFD_ENC_RAW:  the data of every non-zero page
+ *   MULTIFD_ENC_ZLIB: be32 length, then one zlib stream holding the
+ *                     data of every non-zero page
+ *
+ * On the destination the data of raw batches is read straight into guest
+ * RAM, and compressed ones are inflated into guest RAM by the multifd
+ * receive threads.
+ */
+#define MULTIFD_ENC_RAW     0
+#define MULTIFD_ENC_ZLIB    1
+#define MULTIFD_PAGE_ZERO   0x1
+/* Upper bound of x-multifd-page-count */
+#define MULTIFD_MAX_PAGES   10000
+
+typedef struct {
+    RAMBlock *block;
+    /* page offsets inside @block, with MULTIFD_PAGE_ZERO in the low bits */
+    ram_addr_t *offset;
+    uint32_t num;
+    uint32_t allocated;
+} MultiFDPages;
+
 struct MultiFDSendParams {
     uint8_t id;
     char *name;
@@ -410,6 +496,20 @@ struct MultiFDSendParams {
     QemuSemaphore sem;
     QemuMutex mutex;
     bool quit;
+    /* batch handed over by the migration thread, protected by @mutex */
+    bool pending;
+    MultiFDPages pages;
+    /* set once the batch is encoded, protected by multifd_send_state->
+     * done_lock.  Everything below is only accessed by the migration
+     * thread while @done is set.
+     */
+    bool done;
+    uint32_t zero_pages;
+    z_stream zs;
+    uint8_t *zbuf;
+    size_t zbuf_size;
+    size_t zlen;
+    int error;
 };
 typedef struct MultiFDSendParams MultiFDSendParams;
 
@@ -417,8 +517,31 @@ struct {
     MultiFDSendParams *params;
     /* number of created threads */
     int count;
+    /* batch being filled by the migration thread */
+    MultiFDPages pages;
+    /* next channel to try */
+    int next;
+    QemuMutex done_lock;
+    QemuCond done_cond;
 } *multifd_send_state;
 
+static void multifd_pages_init(MultiFDPages *pages, uint32_t size)
+{
+    pages->block = NULL;
+    pages->offset = g_new0(ram_addr_t, size);
+    pages->num = 0;
+    pages->allocated = size;
+}
+
+static void multifd_pages_clear(MultiFDPages *pages)
+{
+    g_free(pages->offset);
+    pages->offset = NULL;
+    pages->num = 0;
+    pages->allocated = 0;
+    pages->block = NULL;
+}
+
 static void terminate_multifd_send_threads(Error *errp)
 {
     int i;
@@ -438,7 +561,7 @@ int multifd_save_cleanup(Error **errp)
     int i;
     int ret = 0;
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_send_state) {
         return 0;
     }
     terminate_multifd_send_threads(NULL);
@@ -450,7 +573,16 @@ int multifd_save_cleanup(Error **errp)
         qemu_sem_destroy(&p->sem);
         g_free(p->name);
         p->name = NULL;
+        multifd_pages_clear(&p->pages);
+        if (p->zbuf) {
+            deflateEnd(&p->zs);
+            g_free(p->zbuf);
+            p->zbuf = NULL;
+        }
     }
+    multifd_pages_clear(&multifd_send_state->pages);
+    qemu_mutex_destroy(&multifd_send_state->done_lock);
+    qemu_cond_destroy(&multifd_send_state->done_cond);
     g_free(multifd_send_state->params);
     multifd_send_state->params = NULL;
     g_free(multifd_send_state);
@@ -458,6 +590,50 @@ int multifd_save_cleanup(Error **errp)
     return ret;
 }
 
+/* Look for zero pages and compress the rest of the batch if asked to */
+static void multifd_send_encode(MultiFDSendParams *p)
+{
+    MultiFDPages *pages = &p->pages;
+    uint8_t *host = pages->block->host;
+    uint32_t i;
+    int ret;
+
+    p->zero_pages = 0;
+    p->zlen = 0;
+    p->error = 0;
+    for (i = 0; i < pages->num; i++) {
+        if (is_zero_range(host + pages->offset[i], TARGET_PAGE_SIZE)) {
+            pages->offset[i] |= MULTIFD_PAGE_ZERO;
+            p->zero_pages++;
+        }
+    }
+    if (!p->zbuf) {
+        return;
+    }
+
+    deflateReset(&p->zs);
+    p->zs.next_out = p->zbuf;
+    p->zs.avail_out = p->zbuf_size;
+    for (i = 0; i < pages->num; i++) {
+        if (pages->offset[i] & MULTIFD_PAGE_ZERO) {
+            continue;
+        }
+        p->zs.next_in = host + pages->offset[i];
+        p->zs.avail_in = TARGET_PAGE_SIZE;
+        ret = deflate(&p->zs, Z_NO_FLUSH);
+        if (ret != Z_OK || p->zs.avail_in) {
+            p->error = -EIO;
+            return;
+        }
+    }
+    ret = deflate(&p->zs, Z_FINISH);
+    if (ret != Z_STREAM_END) {
+        p->error = -EIO;
+        return;
+    }
+    p->zlen = p->zbuf_size - p->zs.avail_out;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
@@ -468,6 +644,18 @@ static void *multifd_send_thread(void *opaque)
             qemu_mutex_unlock(&p->mutex);
             break;
         }
+        if (p->pending) {
+            p->pending = false;
+            qemu_mutex_unlock(&p->mutex);
+
+            multifd_send_encode(p);
+
+            qemu_mutex_lock(&multifd_send_state->done_lock);
+            p->done = true;
+            qemu_cond_signal(&multifd_send_state->done_cond);
+            qemu_mutex_unlock(&multifd_send_state->done_lock);
+            continue;
+        }
         qemu_mutex_unlock(&p->mutex);
         qemu_sem_wait(&p->sem);
     }
@@ -475,25 +663,44 @@ static void *multifd_send_thread(void *opaque)
     return NULL;
 }
 
+/* Called both when a migration starts and from ram_save_setup, as
+ * savevm streams do not go through migrate_fd_connect.
+ */
 int multifd_save_setup(void)
 {
-    int thread_count;
+    int thread_count, page_count;
     uint8_t i;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || multifd_send_state) {
         return 0;
     }
     thread_count = migrate_multifd_channels();
+    page_count = migrate_multifd_page_count();
     multifd_send_state = g_malloc0(sizeof(*multifd_send_state));
     multifd_send_state->params = g_new0(MultiFDSendParams, thread_count);
     multifd_send_state->count = 0;
+    multifd_pages_init(&multifd_send_state->pages, page_count);
+    qemu_mutex_init(&multifd_send_state->done_lock);
+    qemu_cond_init(&multifd_send_state->done_cond);
     for (i = 0; i < thread_count; i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
 
+        if (migrate_use_compression()) {
+            if (deflateInit(&p->zs, migrate_compress_level()) != Z_OK) {
+                error_report("multifd: failed to initialize zlib");
+                multifd_save_cleanup(NULL);
+                return -1;
+            }
+            p->zbuf_size = compressBound(page_count * TARGET_PAGE_SIZE);
+            p->zbuf = g_malloc(p->zbuf_size);
+        }
         qemu_mutex_init(&p->mutex);
         qemu_sem_init(&p->sem, 0);
         p->quit = false;
+        p->pending = false;
+        p->done = true;
         p->id = i;
+        multifd_pages_init(&p->pages, page_count);
         p->name = g_strdup_printf("multifdsend_%d", i);
         qemu_thread_create(&p->thread, p->name, multifd_send_thread, p,
                            QEMU_THREAD_JOINABLE);
@@ -510,6 +717,19 @@ struct MultiFDRecvParams {
     QemuSemaphore sem;
     QemuMutex mutex;
     bool quit;
+    /* batch handed over by the load thread, protected by @mutex */
+    bool pending;
+    /* destination of every compressed page, in stream order */
+    uint8_t **host;
+    uint32_t num;
+    uint32_t allocated;
+    z_stream zs;
+    uint8_t *zbuf;
+    size_t zbuf_size;
+    size_t zlen;
+    /* protected by multifd_recv_state->done_lock */
+    bool done;
+    int error;
 };
 typedef struct MultiFDRecvParams MultiFDRecvParams;
 
@@ -517,6 +737,8 @@ struct {
     MultiFDRecvParams *params;
     /* number of created threads */
     int count;
+    QemuMutex done_lock;
+    QemuCond done_cond;
 } *multifd_recv_state;
 
 static void terminate_multifd_recv_threads(Error *errp)
@@ -538,7 +760,7 @@ int multifd_load_cleanup(Error **errp)
     int i;
     int ret = 0;
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_recv_state) {
         return 0;
     }
     terminate_multifd_recv_threads(NULL);
@@ -550,7 +772,12 @@ int multifd_load_cleanup(Error **errp)
         qemu_sem_destroy(&p->sem);
         g_free(p->name);
         p->name = NULL;
+        inflateEnd(&p->zs);
+        g_free(p->host);
+        g_free(p->zbuf);
     }
+    qemu_mutex_destroy(&multifd_recv_state->done_lock);
+    qemu_cond_destroy(&multifd_recv_state->done_cond);
     g_free(multifd_recv_state->params);
     multifd_recv_state->params = NULL;
     g_free(multifd_recv_state);
@@ -559,6 +786,26 @@ int multifd_load_cleanup(Error **errp)
     return ret;
 }
 
+/* Inflate a compressed batch straight into guest RAM */
+static int multifd_recv_decode(MultiFDRecvParams *p)
+{
+    uint32_t i;
+    int ret;
+
+    inflateReset(&p->zs);
+    p->zs.next_in = p->zbuf;
+    p->zs.avail_in = p->zlen;
+    for (i = 0; i < p->num; i++) {
+        p->zs.next_out = p->host[i];
+        p->zs.avail_out = TARGET_PAGE_SIZE;
+        ret = inflate(&p->zs, Z_SYNC_FLUSH);
+        if ((ret != Z_OK && ret != Z_STREAM_END) || p->zs.avail_out) {
+            return -EIO;
+        }
+    }
+    return 0;
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
@@ -569,6 +816,21 @@ static void *multifd_recv_thread(void *opaque)
             qemu_mutex_unlock(&p->mutex);
             break;
         }
+        if (p->pending) {
+            int ret;
+
+            p->pending = false;
+            qemu_mutex_unlock(&p->mutex);
+
+            ret = multifd_recv_decode(p);
+
+            qemu_mutex_lock(&multifd_recv_state->done_lock);
+            p->error = ret;
+            p->done = true;
+            qemu_cond_signal(&multifd_recv_state->done_cond);
+            qemu_mutex_unlock(&multifd_recv_state->done_lock);
+            continue;
+        }
         qemu_mutex_unlock(&p->mutex);
         qemu_sem_wait(&p->sem);
     }
@@ -576,24 +838,36 @@ static void *multifd_recv_thread(void *opaque)
     return NULL;
 }
 
+/* Called both for incoming migration and from ram_load_setup, as
+ * loadvm streams do not go through migration_incoming_setup.
+ */
 int multifd_load_setup(void)
 {
     int thread_count;
     uint8_t i;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || multifd_recv_state) {
         return 0;
     }
     thread_count = migrate_multifd_channels();
     multifd_recv_state = g_malloc0(sizeof(*multifd_recv_state));
     multifd_recv_state->params = g_new0(MultiFDRecvParams, thread_count);
     multifd_recv_state->count = 0;
+    qemu_mutex_init(&multifd_recv_state->done_lock);
+    qemu_cond_init(&multifd_recv_state->done_cond);
     for (i = 0; i < thread_count; i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
 
+        if (inflateInit(&p->zs) != Z_OK) {
+            error_report("multifd: failed to initialize zlib");
+            multifd_load_cleanup(NULL);
+            return -1;
+        }
         qemu_mutex_init(&p->mutex);
         qemu_sem_init(&p->sem, 0);
         p->quit = false;
+        p->pending = false;
+        p->done = true;
         p->id = i;
         p->name = g_strdup_printf("multifdrecv_%d", i);
         qemu_thread_create(&p->thread, p->name, multifd_recv_thread, p,
@@ -910,6 +1184,231 @@ static void migration_bitmap_sync(RAMState *rs)
     }
 }
 
+/* Zero pages are looked for ahead of the sender by a helper thread, one
+ * window of ZERO_SCAN_PAGES target pages at a time: while the sender
+ * works through a window, the helper scans the dirty pages of the next
+ * one in the same block.  The result of a scan may be stale by the time
+ * the page is sent, but any write after the scan also set the page in the
+ * dirty log; since the windows are dropped at the end of each iteration,
+ * before the next bitmap sync, the page will be sent again.
+ */
+#define ZERO_SCAN_PAGES 4096
+
+typedef enum {
+    ZERO_SCAN_IDLE,
+    ZERO_SCAN_QUEUED,
+    ZERO_SCAN_READY,
+} ZeroScanWindowState;
+
+typedef struct ZeroScanWindow {
+    ZeroScanWindowState state;
+    RAMBlock *block;
+    unsigned long start;
+    /* dirty pages of the window when it was queued */
+    unsigned long todo[BITS_TO_LONGS(ZERO_SCAN_PAGES)];
+    unsigned long zero[BITS_TO_LONGS(ZERO_SCAN_PAGES)];
+} ZeroScanWindow;
+
+typedef struct ZeroScanState {
+    QemuThread thread;
+    QemuMutex lock;
+    QemuCond cond;
+    bool quit;
+    ZeroScanWindow win[2];
+    /* window the sender is working through */
+    int cur;
+} ZeroScanState;
+
+static ZeroScanState *zero_scan_state;
+
+static void zero_scan_window(ZeroScanWindow *w)
+{
+    uint8_t *base = w->block->host + (w->start << TARGET_PAGE_BITS);
+    unsigned long i, page;
+
+    memset(w->zero, 0, sizeof(w->zero));
+    for (i = 0; i < ARRAY_SIZE(w->todo); i++) {
+        unsigned long bits = w->todo[i];
+
+        /* A run of idle memory is checked with a single call */
+        if (bits == ~0UL &&
+            buffer_is_zero(base + ((i * BITS_PER_LONG) << TARGET_PAGE_BITS),
+                           BITS_PER_LONG * TARGET_PAGE_SIZE)) {
+            w->zero[i] = ~0UL;
+            continue;
+        }
+        while (bits) {
+            page = i * BITS_PER_LONG + ctzl(bits);
+            bits &= bits - 1;
+            if (is_zero_range(base + (page << TARGET_PAGE_BITS),
+                              TARGET_PAGE_SIZE)) {
+                set_bit(page, w->zero);
+            }
+        }
+    }
+}
+
+static void *zero_scan_thread(void *opaque)
+{
+    ZeroScanState *zs = opaque;
+    ZeroScanWindow *w;
+
+    rcu_register_thread();
+    qemu_mutex_lock(&zs->lock);
+    while (!zs->quit) {
+        if (zs->win[0].state == ZERO_SCAN_QUEUED) {
+            w = &zs->win[0];
+        } else if (zs->win[1].state == ZERO_SCAN_QUEUED) {
+            w = &zs->win[1];
+        } else {
+            qemu_cond_wait(&zs->cond, &zs->lock);
+            continue;
+        }
+        qemu_mutex_unlock(&zs->lock);
+
+        rcu_read_lock();
+        zero_scan_window(w);
+        rcu_read_unlock();
+
+        qemu_mutex_lock(&zs->lock);
+        w->state = ZERO_SCAN_READY;
+        qemu_cond_broadcast(&zs->cond);
+    }
+    qemu_mutex_unlock(&zs->lock);
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+/* Called with zs->lock held */
+static void zero_scan_wait(ZeroScanState *zs, ZeroScanWindow *w)
+{
+    while (w->state == ZERO_SCAN_QUEUED) {
+        qemu_cond_wait(&zs->cond, &zs->lock);
+    }
+}
+
+/* Queue the window starting at @start for the helper, unless it is past
+ * the end of @block.  Called with zs->lock held and @w not queued.
+ */
+static void zero_scan_queue(ZeroScanState *zs, ZeroScanWindow *w,
+                            RAMBlock *block, unsigned long start)
+{
+    unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+    unsigned long words;
+
+    w->state = ZERO_SCAN_IDLE;
+    w->block = NULL;
+    if (start >= pages) {
+        return;
+    }
+    words = MIN(BITS_TO_LONGS(pages) - BIT_WORD(start), ARRAY_SIZE(w->todo));
+    memset(w->todo, 0, sizeof(w->todo));
+    memcpy(w->todo, block->bmap + BIT_WORD(start), words * sizeof(long));
+    w->block = block;
+    w->start = start;
+    w->state = ZERO_SCAN_QUEUED;
+    qemu_cond_broadcast(&zs->cond);
+}
+
+/**
+ * zero_scan_lookup: look up the result of the zero page pre-scan
+ *
+ * Returns true if @page was scanned, in which case @zero says whether it
+ * was found empty.  Moving on to a new window queues the following one.
+ *
+ * @block: block that contains the page
+ * @page: index of the target page inside @block
+ * @zero: set to true if the page was found to be all zeroes
+ */
+static bool zero_scan_lookup(RAMBlock *block, unsigned long page, bool *zero)
+{
+    ZeroScanState *zs = zero_scan_state;
+    unsigned long start = QEMU_ALIGN_DOWN(page, ZERO_SCAN_PAGES);
+    ZeroScanWindow *w, *next;
+
+    if (!zs) {
+        return false;
+    }
+
+    w = &zs->win[zs->cur];
+    if (w->block != block || w->start != start) {
+        next = &zs->win[zs->cur ^ 1];
+        qemu_mutex_lock(&zs->lock);
+        zero_scan_wait(zs, w);
+        zero_scan_wait(zs, next);
+        if (next->block == block && next->start == start) {
+            zs->cur ^= 1;
+            w = next;
+            next = &zs->win[zs->cur ^ 1];
+        } else {
+            /* Out of sequence (new block, queued page or wrap around):
+             * handle this window in the sender and get the helper ahead.
+             */
+            w->state = ZERO_SCAN_IDLE;
+            w->block = block;
+            w->start = start;
+            memset(w->todo, 0, sizeof(w->todo));
+        }
+        zero_scan_queue(zs, next, block, start + ZERO_SCAN_PAGES);
+        qemu_mutex_unlock(&zs->lock);
+    }
+
+    if (!test_bit(page - start, w->todo)) {
+        return false;
+    }
+    *zero = test_bit(page - start, w->zero);
+    return true;
+}
+
+/* Drop both windows, waiting for the helper to be done with them */
+static void zero_scan_reset(void)
+{
+    ZeroScanState *zs = zero_scan_state;
+    int i;
+
+    if (!zs) {
+        return;
+    }
+    qemu_mutex_lock(&zs->lock);
+    for (i = 0; i < ARRAY_SIZE(zs->win); i++) {
+        zero_scan_wait(zs, &zs->win[i]);
+        zs->win[i].state = ZERO_SCAN_IDLE;
+        zs->win[i].block = NULL;
+    }
+    qemu_mutex_unlock(&zs->lock);
+}
+
+static void zero_scan_setup(void)
+{
+    ZeroScanState *zs = g_new0(ZeroScanState, 1);
+
+    qemu_mutex_init(&zs->lock);
+    qemu_cond_init(&zs->cond);
+    qemu_thread_create(&zs->thread, "zeroscan", zero_scan_thread, zs,
+                       QEMU_THREAD_JOINABLE);
+    zero_scan_state = zs;
+}
+
+static void zero_scan_cleanup(void)
+{
+    ZeroScanState *zs = zero_scan_state;
+
+    if (!zs) {
+        return;
+    }
+    zero_scan_reset();
+    qemu_mutex_lock(&zs->lock);
+    zs->quit = true;
+    qemu_cond_broadcast(&zs->cond);
+    qemu_mutex_unlock(&zs->lock);
+    qemu_thread_join(&zs->thread);
+    qemu_cond_destroy(&zs->cond);
+    qemu_mutex_destroy(&zs->lock);
+    g_free(zs);
+    zero_scan_state = NULL;
+}
+
 /**
  * save_zero_page: send the zero page to the stream
  *
@@ -924,8 +1423,12 @@ static int save_zero_page(RAMState *rs, RAMBlock *block, ram_addr_t offset,
                           uint8_t *p)
 {
     int pages = -1;
+    bool zero;
 
-    if (is_zero_range(p, TARGET_PAGE_SIZE)) {
+    if (!zero_scan_lookup(block, offset >> TARGET_PAGE_BITS, &zero)) {
+        zero = is_zero_range(p, TARGET_PAGE_SIZE);
+    }
+    if (zero) {
         ram_counters.duplicate++;
         ram_counters.transferred +=
             save_page_header(rs, rs->f, block, offset | RAM_SAVE_FLAG_ZERO);
@@ -946,6 +1449,161 @@ static void ram_release_pages(const char *rbname, uint64_t offset, int pages)
     ram_discard_range(rbname, offset, pages << TARGET_PAGE_BITS);
 }
 
+/**
+ * multifd_send_splice: write an encoded batch to the stream
+ *
+ * Called with the channel idle, i.e. with @p->done set.
+ *
+ * @rs: current RAM state
+ * @p: channel holding the batch
+ */
+static void multifd_send_splice(RAMState *rs, MultiFDSendParams *p)
+{
+    MultiFDPages *pages = &p->pages;
+    uint8_t *host = pages->block ? pages->block->host : NULL;
+    uint32_t i;
+
+    if (!pages->num) {
+        return;
+    }
+    if (p->error) {
+        qemu_file_set_error(rs->f, p->error);
+        error_report("multifd: compressing pages failed");
+        pages->num = 0;
+        return;
+    }
+
+    ram_counters.transferred +=
+        save_page_header(rs, rs->f, pages->block,
+                         (pages->offset[0] & TARGET_PAGE_MASK) |
+                         RAM_SAVE_FLAG_MULTIFD_PAGE);
+    qemu_put_be32(rs->f, pages->num);
+    qemu_put_be32(rs->f, p->zbuf ? MULTIFD_ENC_ZLIB : MULTIFD_ENC_RAW);
+    for (i = 0; i < pages->num; i++) {
+        qemu_put_be64(rs->f, pages->offset[i]);
+    }
+    ram_counters.transferred += 8 + 8 * pages->num;
+
+    if (p->zbuf) {
+        qemu_put_be32(rs->f, p->zlen);
+        qemu_put_buffer(rs->f, p->zbuf, p->zlen);
+        ram_counters.transferred += 4 + p->zlen;
+    } else {
+        for (i = 0; i < pages->num; i++) {
+            if (!(pages->offset[i] & MULTIFD_PAGE_ZERO)) {
+                qemu_put_buffer_async(rs->f, host + pages->offset[i],
+                                      TARGET_PAGE_SIZE, false);
+            }
+        }
+        ram_counters.transferred +=
+            (uint64_t)(pages->num - p->zero_pages) * TARGET_PAGE_SIZE;
+    }
+    ram_counters.duplicate += p->zero_pages;
+    ram_counters.normal += pages->num - p->zero_pages;
+    pages->num = 0;
+}
+
+/**
+ * multifd_send_pages: hand the batch being filled over to a channel
+ *
+ * Waits for a channel to become idle and writes out the batch that
+ * channel encoded last before giving it the new one.
+ *
+ * @rs: current RAM state
+ */
+static void multifd_send_pages(RAMState *rs)
+{
+    MultiFDPages *pages = &multifd_send_state->pages;
+    MultiFDPages tmp;
+    MultiFDSendParams *p = NULL;
+    int i, count = multifd_send_state->count;
+
+    if (!pages->num) {
+        return;
+    }
+
+    qemu_mutex_lock(&multifd_send_state->done_lock);
+    while (!p) {
+        for (i = 0; i < count; i++) {
+            int idx = (multifd_send_state->next + i) % count;
+
+            if (multifd_send_state->params[idx].done) {
+                p = &multifd_send_state->params[idx];
+                multifd_send_state->next = (idx + 1) % count;
+                break;
+            }
+        }
+        if (!p) {
+            qemu_cond_wait(&multifd_send_state->done_cond,
+                           &multifd_send_state->done_lock);
+        }
+    }
+    p->done = false;
+    qemu_mutex_unlock(&multifd_send_state->done_lock);
+
+    multifd_send_splice(rs, p);
+
+    qemu_mutex_lock(&p->mutex);
+    tmp = p->pages;
+    p->pages = *pages;
+    *pages = tmp;
+    p->pending = true;
+    qemu_mutex_unlock(&p->mutex);
+    qemu_sem_post(&p->sem);
+}
+
+/**
+ * multifd_send_flush: write out every pending batch
+ *
+ * Must be called before the end of each round, as the destination only
+ * guarantees that pages are in place once it sees RAM_SAVE_FLAG_EOS.
+ *
+ * @rs: current RAM state
+ */
+static void multifd_send_flush(RAMState *rs)
+{
+    int i;
+
+    if (!multifd_send_state) {
+        return;
+    }
+    multifd_send_pages(rs);
+
+    qemu_mutex_lock(&multifd_send_state->done_lock);
+    for (i = 0; i < multifd_send_state->count; i++) {
+        while (!multifd_send_state->params[i].done) {
+            qemu_cond_wait(&multifd_send_state->done_cond,
+                           &multifd_send_state->done_lock);
+        }
+    }
+    qemu_mutex_unlock(&multifd_send_state->done_lock);
+
+    for (i = 0; i < multifd_send_state->count; i++) {
+        multifd_send_splice(rs, &multifd_send_state->params[i]);
+    }
+}
+
+/**
+ * ram_save_multifd_page: queue the given page on the multifd channels
+ *
+ * Returns the number of pages queued.
+ *
+ * @rs: current RAM state
+ * @pss: data about the page we want to send
+ */
+static int ram_save_multifd_page(RAMState *rs, PageSearchStatus *pss)
+{
+    MultiFDPages *pages = &multifd_send_state->pages;
+
+    if (pages->block != pss->block || pages->num == pages->allocated) {
+        multifd_send_pages(rs);
+        pages->block = pss->block;
+    }
+    pages->offset[pages->num++] = pss->page << TARGET_PAGE_BITS;
+
+    return 1;
+}
+
 /**
  * ram_save_page: send the given page to the stream
  *
@@ -1461,7 +2119,10 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
          * round of migration even if compression is enabled. In theory,
          * xbzrle can do better than compression.
          */
-        if (migrate_use_compression() &&
+        if (multifd_send_state && !migration_in_postcopy() &&
+            !migrate_use_xbzrle()) {
+            res = ram_save_multifd_page(rs, pss);
+        } else if (migrate_use_compression() &&
             (rs->ram_bulk_stage || !migrate_use_xbzrle())) {
             res = ram_save_compressed_page(rs, pss, last_stage);
         } else {
@@ -1630,18 +2291,22 @@ static void ram_save_cleanup(void *opaque)
 
     XBZRLE_cache_lock();
     if (XBZRLE.cache) {
+#ifndef CONFIG_EXTSNAP
         cache_fini(XBZRLE.cache);
-        g_free(XBZRLE.encoded_buf);
-        g_free(XBZRLE.current_buf);
         g_free(XBZRLE.zero_target_page);
         XBZRLE.cache = NULL;
+        XBZRLE.zero_target_page = NULL;
+#endif
+        g_free(XBZRLE.encoded_buf);
+        g_free(XBZRLE.current_buf);
         XBZRLE.encoded_buf = NULL;
         XBZRLE.current_buf = NULL;
-        XBZRLE.zero_target_page = NULL;
     }
     XBZRLE_cache_unlock();
     migration_page_queue_free(*rsp);
+    zero_scan_cleanup();
     compress_threads_save_cleanup();
+    multifd_save_cleanup(NULL);
     g_free(*rsp);
     *rsp = NULL;
 }
@@ -1652,7 +2317,14 @@ static void ram_state_reset(RAMState *rs)
     rs->last_sent_block = NULL;
     rs->last_page = 0;
     rs->last_version = ram_list.version;
+#ifdef CONFIG_EXTSNAP
+    /* An incremental checkpoint only sends pages dirtied since its parent,
+     * as XBZRLE deltas, which the bulk stage would disable
+     */
+    rs->ram_bulk_stage = !(migrate_use_xbzrle() && rs->xbzrle_incremental);
+#else
     rs->ram_bulk_stage = true;
+#endif
 }
 
 #define MAX_WAIT 50 /* ms, half buffered_file limit */
@@ -2060,12 +2732,23 @@ static int ram_state_init(RAMState **rsp)
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
 
+#ifdef CONFIG_EXTSNAP
+    if (!migrate_use_xbzrle() || ram_list.version != xbzrle_snapshot_version) {
+        xbzrle_snapshot_cache_drop();
+    }
+    xbzrle_snapshot_version = ram_list.version;
+#endif
     if (migrate_use_xbzrle()) {
         XBZRLE_cache_lock();
-        XBZRLE.zero_target_page = g_malloc0(TARGET_PAGE_SIZE);
-        XBZRLE.cache = cache_init(migrate_xbzrle_cache_size() /
-                                  TARGET_PAGE_SIZE,
-                                  TARGET_PAGE_SIZE);
+#ifdef CONFIG_EXTSNAP
+        (*rsp)->xbzrle_incremental = XBZRLE.cache != NULL;
+#endif
+        if (!XBZRLE.cache) {
+            XBZRLE.zero_target_page = g_malloc0(TARGET_PAGE_SIZE);
+            XBZRLE.cache = cache_init(migrate_xbzrle_cache_size() /
+                                      TARGET_PAGE_SIZE,
+                                      TARGET_PAGE_SIZE);
+        }
         if (!XBZRLE.cache) {
             XBZRLE_cache_unlock();
             error_report("Error creating cache");
@@ -2192,7 +2875,11 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     }
 
     rcu_read_unlock();
+    zero_scan_setup();
     compress_threads_save_setup();
+    if (multifd_save_setup()) {
+        return -1;
+    }
 
     ram_control_before_iterate(f, RAM_CONTROL_SETUP);
     ram_control_after_iterate(f, RAM_CONTROL_SETUP);
@@ -2257,6 +2944,8 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
         i++;
     }
     flush_compressed_data(rs);
+    multifd_send_flush(rs);
+    zero_scan_reset();
     rcu_read_unlock();
 
     /*
@@ -2290,6 +2979,7 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 {
     RAMState **temp = opaque;
     RAMState *rs = *temp;
+    bool last_stage = !migration_in_colo_state();
 
     rcu_read_lock();
 
@@ -2301,11 +2991,16 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
     /* try transferring iterative blocks of memory */
 
+#ifdef CONFIG_EXTSNAP
+    /* The XBZRLE cache is still needed by the next checkpoint */
+    last_stage = last_stage && !migrate_use_xbzrle();
+#endif
+
     /* flush all remaining blocks regardless of rate limiting */
     while (true) {
         int pages;
 
-        pages = ram_find_and_save_block(rs, !migration_in_colo_state());
+        pages = ram_find_and_save_block(rs, last_stage);
         /* no more blocks to sent */
         if (pages == 0) {
             break;
@@ -2313,6 +3008,8 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
     }
 
     flush_compressed_data(rs);
+    multifd_send_flush(rs);
+    zero_scan_reset();
     ram_control_after_iterate(f, RAM_CONTROL_FINISH);
 
     rcu_read_unlock();
@@ -2450,138 +3147,212 @@ void ram_handle_compressed(void *host, uint8_t ch, uint64_t size)
 
 static void *do_data_decompress(void *opaque)
 {
-    DecompressParam *param = opaque;
-    unsigned long pagesize;
-    uint8_t *des;
-    int len;
+    DecompressState *ds = opaque;
+    DecompressBatch *batch;
+    int i;
 
-    qemu_mutex_lock(&param->mutex);
-    while (!param->quit) {
-        if (param->des) {
-            des = param->des;
-            len = param->len;
-            param->des = 0;
-            qemu_mutex_unlock(&param->mutex);
+    qemu_mutex_lock(&ds->lock);
+    while (true) {
+        while (!ds->quit && QSIMPLEQ_EMPTY(&ds->work)) {
+            qemu_cond_wait(&ds->work_cond, &ds->lock);
+        }
+        if (ds->quit) {
+            break;
+        }
+        batch = QSIMPLEQ_FIRST(&ds->work);
+        QSIMPLEQ_REMOVE_HEAD(&ds->work, next);
+        qemu_mutex_unlock(&ds->lock);
+
+        for (i = 0; i < batch->nr; i++) {
+            DecompressPage *page = &batch->page[i];
+            unsigned long pagesize = TARGET_PAGE_SIZE;
 
-            pagesize = TARGET_PAGE_SIZE;
             /* uncompress() will return failed in some case, especially
              * when the page is dirted when doing the compression, it's
              * not a problem because the dirty page will be retransferred
              * and uncompress() won't break the data in other pages.
              */
-            uncompress((Bytef *)des, &pagesize,
-                       (const Bytef *)param->compbuf, len);
-
-            qemu_mutex_lock(&decomp_done_lock);
-            param->done = true;
-            qemu_cond_signal(&decomp_done_cond);
-            qemu_mutex_unlock(&decomp_done_lock);
+            uncompress((Bytef *)page->host, &pagesize,
+                       (const Bytef *)batch->buf + page->offset, page->len);
+        }
 
-            qemu_mutex_lock(&param->mutex);
-        } else {
-            qemu_cond_wait(&param->cond, &param->mutex);
+        qemu_mutex_lock(&ds->lock);
+        for (i = 0; i < batch->nr; i++) {
+            atomic_dec(&batch->page[i].block->decompress_pending);
         }
+        batch->nr = 0;
+        batch->used = 0;
+        QSIMPLEQ_INSERT_TAIL(&ds->free, batch, next);
+        ds->in_flight--;
+        qemu_cond_broadcast(&ds->done_cond);
     }
-    qemu_mutex_unlock(&param->mutex);
+    qemu_mutex_unlock(&ds->lock);
 
     return NULL;
 }
 
+/* Queue the batch being filled, if any, to the decompression threads */
+static void decompress_flush(void)
+{
+    DecompressState *ds = decomp_state;
+    DecompressBatch *batch = ds->cur;
+
+    if (!batch || !batch->nr) {
+        return;
+    }
+    ds->cur = NULL;
+    qemu_mutex_lock(&ds->lock);
+    QSIMPLEQ_INSERT_TAIL(&ds->work, batch, next);
+    ds->in_flight++;
+    qemu_cond_signal(&ds->work_cond);
+    qemu_mutex_unlock(&ds->lock);
+}
+
 static void wait_for_decompress_done(void)
 {
-    int idx, thread_count;
+    DecompressState *ds = decomp_state;
 
-    if (!migrate_use_compression()) {
+    if (!ds) {
         return;
     }
 
-    thread_count = migrate_decompress_threads();
-    qemu_mutex_lock(&decomp_done_lock);
-    for (idx = 0; idx < thread_count; idx++) {
-        while (!decomp_param[idx].done) {
-            qemu_cond_wait(&decomp_done_cond, &decomp_done_lock);
-        }
+    decompress_flush();
+    qemu_mutex_lock(&ds->lock);
+    while (ds->in_flight) {
+        qemu_cond_wait(&ds->done_cond, &ds->lock);
     }
-    qemu_mutex_unlock(&decomp_done_lock);
+    qemu_mutex_unlock(&ds->lock);
+}
+
+/**
+ * wait_for_block_decompressed: wait until the compressed pages queued for
+ *   @block have been written to it
+ *
+ * @block: RAMBlock about to be accessed directly by the loading thread
+ */
+static void wait_for_block_decompressed(RAMBlock *block)
+{
+    DecompressState *ds = decomp_state;
+
+    if (!ds || !atomic_read(&block->decompress_pending)) {
+        return;
+    }
+
+    decompress_flush();
+    qemu_mutex_lock(&ds->lock);
+    while (atomic_read(&block->decompress_pending)) {
+        qemu_cond_wait(&ds->done_cond, &ds->lock);
+    }
+    qemu_mutex_unlock(&ds->lock);
 }
 
 static void compress_threads_load_setup(void)
 {
-    int i, thread_count;
+    DecompressState *ds;
+    size_t bufsize = DECOMPRESS_BATCH_PAGES * compressBound(TARGET_PAGE_SIZE);
+    int i;
 
     if (!migrate_use_compression()) {
         return;
     }
-    thread_count = migrate_decompress_threads();
-    decompress_threads = g_new0(QemuThread, thread_count);
-    decomp_param = g_new0(DecompressParam, thread_count);
-    qemu_mutex_init(&decomp_done_lock);
-    qemu_cond_init(&decomp_done_cond);
-    for (i = 0; i < thread_count; i++) {
-        qemu_mutex_init(&decomp_param[i].mutex);
-        qemu_cond_init(&decomp_param[i].cond);
-        decomp_param[i].compbuf = g_malloc0(compressBound(TARGET_PAGE_SIZE));
-        decomp_param[i].done = true;
-        decomp_param[i].quit = false;
-        qemu_thread_create(decompress_threads + i, "decompress",
-                           do_data_decompress, decomp_param + i,
-                           QEMU_THREAD_JOINABLE);
+    ds = g_new0(DecompressState, 1);
+    qemu_mutex_init(&ds->lock);
+    qemu_cond_init(&ds->work_cond);
+    qemu_cond_init(&ds->done_cond);
+    QSIMPLEQ_INIT(&ds->work);
+    QSIMPLEQ_INIT(&ds->free);
+
+    /* Two batches per thread, so that the loading thread can fill one
+     * while the other is being decompressed.
+     */
+    ds->nr_threads = migrate_decompress_threads();
+    ds->nr_batches = 2 * ds->nr_threads;
+    ds->batches = g_new0(DecompressBatch, ds->nr_batches);
+    for (i = 0; i < ds->nr_batches; i++) {
+        ds->batches[i].buf = g_malloc(bufsize);
+        QSIMPLEQ_INSERT_TAIL(&ds->free, &ds->batches[i], next);
     }
+
+    ds->threads = g_new0(QemuThread, ds->nr_threads);
+    for (i = 0; i < ds->nr_threads; i++) {
+        qemu_thread_create(ds->threads + i, "decompress",
+                           do_data_decompress, ds, QEMU_THREAD_JOINABLE);
+    }
+    decomp_state = ds;
 }
 
 static void compress_threads_load_cleanup(void)
 {
-    int i, thread_count;
+    DecompressState *ds = decomp_state;
+    int i;
 
-    if (!migrate_use_compression()) {
+    if (!ds) {
         return;
     }
-    thread_count = migrate_decompress_threads();
-    for (i = 0; i < thread_count; i++) {
-        qemu_mutex_lock(&decomp_param[i].mutex);
-        decomp_param[i].quit = true;
-        qemu_cond_signal(&decomp_param[i].cond);
-        qemu_mutex_unlock(&decomp_param[i].mutex);
+    wait_for_decompress_done();
+
+    qemu_mutex_lock(&ds->lock);
+    ds->quit = true;
+    qemu_cond_broadcast(&ds->work_cond);
+    qemu_mutex_unlock(&ds->lock);
+    for (i = 0; i < ds->nr_threads; i++) {
+        qemu_thread_join(ds->threads + i);
     }
-    for (i = 0; i < thread_count; i++) {
-        qemu_thread_join(decompress_threads + i);
-        qemu_mutex_destroy(&decomp_param[i].mutex);
-        qemu_cond_destroy(&decomp_param[i].cond);
-        g_free(decomp_param[i].compbuf);
+
+    for (i = 0; i < ds->nr_batches; i++) {
+        g_free(ds->batches[i].buf);
     }
-    g_free(decompress_threads);
-    g_free(decomp_param);
-    decompress_threads = NULL;
-    decomp_param = NULL;
+    g_free(ds->batches);
+    g_free(ds->threads);
+    qemu_cond_destroy(&ds->done_cond);
+    qemu_cond_destroy(&ds->work_cond);
+    qemu_mutex_destroy(&ds->lock);
+    g_free(ds);
+    decomp_state = NULL;
 }
 
-static void decompress_data_with_multi_threads(QEMUFile *f,
+/**
+ * decompress_data_with_multi_threads: queue a compressed page for loading
+ *
+ * The compressed data is read into the current batch right away; the page
+ * is written to @host by a decompression thread once the batch is full or
+ * flushed.
+ *
+ * @f: QEMUFile where to read the compressed data from
+ * @block: RAMBlock the page belongs to
+ * @host: host address of the page
+ * @len: length of the compressed data
+ */
+static void decompress_data_with_multi_threads(QEMUFile *f, RAMBlock *block,
                                                void *host, int len)
 {
-    int idx, thread_count;
+    DecompressState *ds = decomp_state;
+    DecompressBatch *batch = ds->cur;
+    DecompressPage *page;
 
-    thread_count = migrate_decompress_threads();
-    qemu_mutex_lock(&decomp_done_lock);
-    while (true) {
-        for (idx = 0; idx < thread_count; idx++) {
-            if (decomp_param[idx].done) {
-                decomp_param[idx].done = false;
-                qemu_mutex_lock(&decomp_param[idx].mutex);
-                qemu_get_buffer(f, decomp_param[idx].compbuf, len);
-                decomp_param[idx].des = host;
-                decomp_param[idx].len = len;
-                qemu_cond_signal(&decomp_param[idx].cond);
-                qemu_mutex_unlock(&decomp_param[idx].mutex);
-                break;
-            }
-        }
-        if (idx < thread_count) {
-            break;
-        } else {
-            qemu_cond_wait(&decomp_done_cond, &decomp_done_lock);
+    if (!batch) {
+        qemu_mutex_lock(&ds->lock);
+        while (QSIMPLEQ_EMPTY(&ds->free)) {
+            qemu_cond_wait(&ds->done_cond, &ds->lock);
         }
+        batch = QSIMPLEQ_FIRST(&ds->free);
+        QSIMPLEQ_REMOVE_HEAD(&ds->free, next);
+        qemu_mutex_unlock(&ds->lock);
+        ds->cur = batch;
+    }
+
+    page = &batch->page[batch->nr++];
+    page->block = block;
+    page->host = host;
+    page->offset = batch->used;
+    page->len = len;
+    qemu_get_buffer(f, batch->buf + batch->used, len);
+    batch->used += len;
+    atomic_inc(&block->decompress_pending);
+
+    if (batch->nr == DECOMPRESS_BATCH_PAGES) {
+        decompress_flush();
     }
-    qemu_mutex_unlock(&decomp_done_lock);
 }
 
 /**
@@ -2594,15 +3365,20 @@ static void decompress_data_with_multi_threads(QEMUFile *f,
  */
 static int ram_load_setup(QEMUFile *f, void *opaque)
 {
+#ifdef CONFIG_EXTSNAP
+    /* Memory no longer matches the pages of the last saved checkpoint */
+    xbzrle_snapshot_cache_drop();
+#endif
     xbzrle_load_setup();
     compress_threads_load_setup();
-    return 0;
+    return multifd_load_setup();
 }
 
 static int ram_load_cleanup(void *opaque)
 {
     xbzrle_load_cleanup();
     compress_threads_load_cleanup();
+    multifd_load_cleanup(NULL);
     return 0;
 }
 
@@ -2756,6 +3532,156 @@ static int ram_load_postcopy(QEMUFile *f)
     return ret;
 }
 
+/**
+ * ram_load_multifd_pages: load a RAM_SAVE_FLAG_MULTIFD_PAGE record
+ *
+ * Compressed batches are handed to an idle receive thread; the caller
+ * must use multifd_recv_wait() before relying on the pages.
+ *
+ * Returns 0 for success or a negative value on error
+ *
+ * @f: QEMUFile where to read the data from
+ * @block: RAMBlock the pages belong to
+ */
+static int ram_load_multifd_pages(QEMUFile *f, RAMBlock *block)
+{
+    MultiFDRecvParams *p = NULL;
+    uint32_t num, enc, i, n = 0;
+    ram_addr_t *offset;
+    int ret = 0, len;
+
+    num = qemu_get_be32(f);
+    enc = qemu_get_be32(f);
+    if (num == 0 || num > MULTIFD_MAX_PAGES) {
+        error_report("multifd: invalid number of pages %u", num);
+        return -EINVAL;
+    }
+    if (enc != MULTIFD_ENC_RAW && enc != MULTIFD_ENC_ZLIB) {
+        error_report("multifd: unknown page encoding %u", enc);
+        return -EINVAL;
+    }
+    if (enc == MULTIFD_ENC_ZLIB && !multifd_recv_state) {
+        error_report("multifd: receive threads are not running");
+        return -EINVAL;
+    }
+
+    offset = g_new(ram_addr_t, num);
+    for (i = 0; i < num; i++) {
+        offset[i] = qemu_get_be64(f);
+        if (!host_from_ram_block_offset(block,
+                                        offset[i] & TARGET_PAGE_MASK)) {
+            error_report("Illegal RAM offset " RAM_ADDR_FMT, offset[i]);
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+
+    if (enc == MULTIFD_ENC_ZLIB) {
+        int count = multifd_recv_state->count;
+
+        qemu_mutex_lock(&multifd_recv_state->done_lock);
+        while (!p) {
+            for (i = 0; i < count; i++) {
+                if (multifd_recv_state->params[i].done) {
+                    p = &multifd_recv_state->params[i];
+                    break;
+                }
+            }
+            if (!p) {
+                qemu_cond_wait(&multifd_recv_state->done_cond,
+                               &multifd_recv_state->done_lock);
+            }
+        }
+        ret = p->error;
+        p->done = false;
+        qemu_mutex_unlock(&multifd_recv_state->done_lock);
+        if (ret) {
+            /* Leave the channel idle so that multifd_recv_wait() sees it */
+            goto out_idle;
+        }
+        if (p->allocated < num) {
+            p->host = g_renew(uint8_t *, p->host, num);
+            p->allocated = num;
+        }
+    }
+
+    for (i = 0; i < num; i++) {
+        uint8_t *host = host_from_ram_block_offset(block,
+                                                   offset[i] &
+                                                   TARGET_PAGE_MASK);
+
+        if (offset[i] & MULTIFD_PAGE_ZERO) {
+            ram_handle_compressed(host, 0, TARGET_PAGE_SIZE);
+        } else if (enc == MULTIFD_ENC_RAW) {
+            qemu_get_buffer(f, host, TARGET_PAGE_SIZE);
+        } else {
+            p->host[n++] = host;
+        }
+    }
+    if (enc == MULTIFD_ENC_RAW) {
+        goto out;
+    }
+
+    len = qemu_get_be32(f);
+    if (len < 0 || len > compressBound((size_t)n * TARGET_PAGE_SIZE)) {
+        error_report("Invalid compressed data length: %d", len);
+        ret = -EINVAL;
+        goto out_idle;
+    }
+    if (p->zbuf_size < len) {
+        p->zbuf = g_realloc(p->zbuf, len);
+        p->zbuf_size = len;
+    }
+    qemu_get_buffer(f, p->zbuf, len);
+    p->zlen = len;
+    p->num = n;
+
+    qemu_mutex_lock(&p->mutex);
+    p->pending = true;
+    qemu_mutex_unlock(&p->mutex);
+    qemu_sem_post(&p->sem);
+    goto out;
+
+out_idle:
+    qemu_mutex_lock(&multifd_recv_state->done_lock);
+    p->done = true;
+    qemu_mutex_unlock(&multifd_recv_state->done_lock);
+out:
+    g_free(offset);
+    return ret;
+}
+
+/**
+ * multifd_recv_wait: wait until every compressed batch has been loaded
+ *
+ * Returns 0 for success or -EIO if a batch could not be decompressed
+ */
+static int multifd_recv_wait(void)
+{
+    int i, ret = 0;
+
+    if (!multifd_recv_state) {
+        return 0;
+    }
+    qemu_mutex_lock(&multifd_recv_state->done_lock);
+    for (i = 0; i < multifd_recv_state->count; i++) {
+        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+
+        while (!p->done) {
+            qemu_cond_wait(&multifd_recv_state->done_cond,
+                           &multifd_recv_state->done_lock);
+        }
+        if (p->error) {
+            error_report("multifd: failed to decompress pages");
+            ret = -EIO;
+            p->error = 0;
+        }
+    }
+    qemu_mutex_unlock(&multifd_recv_state->done_lock);
+
+    return ret;
+}
+
 static int ram_load(QEMUFile *f, void *opaque, int version_id)
 {
     int flags = 0, ret = 0, invalid_flags = 0;
@@ -2778,6 +3704,9 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
     if (!migrate_use_compression()) {
         invalid_flags |= RAM_SAVE_FLAG_COMPRESS_PAGE;
     }
+    if (!migrate_use_multifd()) {
+        invalid_flags |= RAM_SAVE_FLAG_MULTIFD_PAGE;
+    }
     /* This RCU critical section can be very long running.
      * When RCU reclaims in the code start to become numerous,
      * it will be necessary to reduce the granularity of this
@@ -2791,6 +3720,7 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
 
     while (!postcopy_running && !ret && !(flags & RAM_SAVE_FLAG_EOS)) {
         ram_addr_t addr, total_ram_bytes;
+        RAMBlock *block = NULL;
         void *host = NULL;
         uint8_t ch;
 
@@ -2802,14 +3732,18 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
             if (flags & invalid_flags & RAM_SAVE_FLAG_COMPRESS_PAGE) {
                 error_report("Received an unexpected compressed page");
             }
+            if (flags & invalid_flags & RAM_SAVE_FLAG_MULTIFD_PAGE) {
+                error_report("Received an unexpected multifd page batch");
+            }
 
             ret = -EINVAL;
             break;
         }
 
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
-                     RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE)) {
-            RAMBlock *block = ram_block_from_stream(f, flags);
+                     RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE |
+                     RAM_SAVE_FLAG_MULTIFD_PAGE)) {
+            block = ram_block_from_stream(f, flags);
 
             host = host_from_ram_block_offset(block, addr);
             if (!host) {
@@ -2839,6 +3773,8 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                     if (length != block->used_length) {
                         Error *local_err = NULL;
 
+                        wait_for_block_decompressed(block);
+
                         ret = qemu_ram_resize(block, length,
                                               &local_err);
                         if (local_err) {
@@ -2887,10 +3823,16 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                 ret = -EINVAL;
                 break;
             }
-            decompress_data_with_multi_threads(f, host, len);
+            decompress_data_with_multi_threads(f, block, host, len);
+            break;
+
+        case RAM_SAVE_FLAG_MULTIFD_PAGE:
+            ret = ram_load_multifd_pages(f, block);
             break;
 
         case RAM_SAVE_FLAG_XBZRLE:
+            /* The delta applies to the current contents of the page */
+            wait_for_block_decompressed(block);
             if (load_xbzrle(f, addr, host) < 0) {
                 error_report("Failed to decompress XBZRLE page at "
                              RAM_ADDR_FMT, addr);
@@ -2916,6 +3858,9 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
     }
 
     wait_for_decompress_done();
+    if (multifd_recv_wait() && !ret) {
+        ret = -EIO;
+    }
     rcu_read_unlock();
     trace_ram_load_complete(ret, seq_iter);
     return ret;
@@ -74,6 +74,7 @@
 #include "qapi/qmp/qstring.h"
 #include "qapi/qmp/qerror.h"
 #include "block/block_int.h"
+#include "block/blockjob.h"
 #include "io/channel-command.h"
 #include "qemu-common.h"
 
@@ -241,24 +242,83 @@ static QString *get_snap_path (const char *path) {
 //    return end + 1;
 //}
 
-static QList *get_snap_chain (BlockDriverState *bs) {
-    QList* lst = qlist_new();
+static bool qlist_has_str(QList *qlist, const char *str)
+{
+    QListEntry *entry;
+
+    QLIST_FOREACH_ENTRY(qlist, entry) {
+        QString *qstr = qobject_to_qstring(qlist_entry_obj(entry));
+
+        if (!strcmp(qstring_get_str(qstr), str)) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    bs = bs->backing->bs;
+/* Push at the head of lst the snapshot directories whose memory state goes
+ * with the layer at path.  That is the layer's own directory, or for a layer
+ * made by squash_vmstate_ext the directories listed in its .chain file.
+ * Directories already in lst are skipped, since while a squash is running
+ * the squashed layers are still in the chain below the new one.
+ */
+static void push_snap_dirs(QList *lst, const char *path)
+{
+    char *chain_file = g_strdup_printf("%s.chain", path);
+    gchar *contents;
 
-    while (bs->backing != NULL) {
+    if (g_file_get_contents(chain_file, &contents, NULL, NULL)) {
+        gchar **dirs = g_strsplit(contents, "\n", 0);
+        int i = g_strv_length(dirs);
+
+        /* listed oldest first */
+        while (i--) {
+            if (*dirs[i] && !qlist_has_str(lst, dirs[i])) {
+                qlist_push(lst, QOBJECT(qstring_from_str(dirs[i])));
+            }
+        }
+        g_strfreev(dirs);
+        g_free(contents);
+    } else {
+        QString *snap = get_snap_path(path);
+
+        if (!qlist_has_str(lst, qstring_get_str(snap))) {
+            qlist_push(lst, QOBJECT(snap));
+        } else {
+            QDECREF(snap);
+        }
+    }
+    g_free(chain_file);
+}
+
+/* Snapshot directories of the layers from bs down to, but not including,
+ * base, oldest first.
+ */
+static QList *get_snap_dirs(BlockDriverState *bs, BlockDriverState *base)
+{
+    QList *lst = qlist_new();
+
+    for (; bs != base; bs = backing_bs(bs)) {
         char path[PATH_MAX];
         if (realpath(bs->filename, path) == NULL) {
+            QDECREF(lst);
             return NULL;
         }
-        QString *snap = get_snap_path(path);
-        qlist_push(lst, QOBJECT(snap));
-        bs = bs->backing->bs;
+        push_snap_dirs(lst, path);
     }
 
     return lst;
 }
 
+static QList *get_snap_chain (BlockDriverState *bs) {
+    BlockDriverState *base = bs;
+
+    while (backing_bs(base)) {
+        base = backing_bs(base);
+    }
+    return get_snap_dirs(bs->backing->bs, base);
+}
+
 static const char *get_base_name(void) {
     BlockDriverState *bs = find_base();
     const char *ret = strrchr(bs->filename, '/');
@@ -288,25 +348,82 @@ int delete_tmp_overlay(void) {
     return unlink(bs->filename);
 }
 
-int create_tmp_overlay(void) {
-    BlockDriverState *bs = find_active();
-    char* tmp_name = g_malloc0(8192*sizeof(char));
-    const char *dev_name = bdrv_get_device_name(bs);
+/* Overlays use small clusters, so that a guest write covering whole
+ * clusters of a fresh overlay needs no copy-on-write from the layers below.
+ * That is the case of most first writes after a checkpoint, which would
+ * otherwise read the rest of a 64k cluster from the backing chain.  Writes
+ * smaller than 4k or not 4k aligned still copy the rest of their cluster.
+ *
+ * The price is 16 times more L2 metadata per byte of guest data: the
+ * default L2 cache of at most 32 MB maps only 16 GB of an overlay, against
+ * 256 GB with 64k clusters.  Overlays only hold what the guest wrote since
+ * the last checkpoint, which is usually well below that.
+ */
+#define OVERLAY_CLUSTER_SIZE 4096
+
+static char *new_overlay_name(void)
+{
+    char *name = g_malloc0(8192 * sizeof(char));
     int i = 0;
 
     do {
-        generate_name(tmp_name, i);
+        generate_name(name, i);
         i++;
-    } while (!access(tmp_name, F_OK));
+    } while (!access(name, F_OK));
 
+    return name;
+}
+
+static void create_overlay_file(const char *name, const char *backing,
+                                const char *backing_fmt, int64_t size,
+                                Error **errp)
+{
+    char *options = g_strdup_printf("cluster_size=%d", OVERLAY_CLUSTER_SIZE);
+
+    bdrv_img_create(name, "qcow2", backing, backing_fmt, options, size, 0,
+                    true, errp);
+    g_free(options);
+}
+
+/* The empty overlay created on top of the disk layer of a snapshot is
+ * cloned next to the layer.  Loading the snapshot later clones it back
+ * instead of creating or emptying an overlay, which on filesystems with
+ * reflinks takes constant time.
+ */
+static char *get_overlay_template(const char *snapshot_file)
+{
+    return g_strdup_printf("%s.overlay", snapshot_file);
+}
+
+static int create_tmp_overlay_ext(const char *template)
+{
+    BlockDriverState *bs = find_active();
+    char *tmp_name = new_overlay_name();
+    const char *dev_name = bdrv_get_device_name(bs);
     Error *local_err = NULL;
 
-    qmp_blockdev_snapshot_sync(true, dev_name, false, NULL,
-                                     tmp_name,
-                                     false,
-                                     NULL,
-                                     true, "qcow2",
-                                     true, 1, &local_err);
+    create_overlay_file(tmp_name, bs->filename, bs->drv->format_name,
+                        bdrv_getlength(bs), &local_err);
+    if (local_err == NULL && template != NULL &&
+        bdrv_clone_file(tmp_name, template, &local_err) < 0) {
+        /* Loading the snapshot creates a new overlay instead */
+        warn_report("%s", error_get_pretty(local_err));
+        error_free(local_err);
+        local_err = NULL;
+        unlink(template);
+    }
+    if (local_err == NULL) {
+        qmp_blockdev_snapshot_sync(true, dev_name, false, NULL,
+                                         tmp_name,
+                                         false,
+                                         NULL,
+                                         true, "qcow2",
+                                         true, NEW_IMAGE_MODE_EXISTING,
+                                         &local_err);
+        if (local_err != NULL) {
+            unlink(tmp_name);
+        }
+    }
     if (local_err != NULL) {
         error_report_err(local_err);
         g_free(tmp_name);
@@ -316,6 +433,10 @@ int create_tmp_overlay(void) {
     return 0;
 }
 
+int create_tmp_overlay(void) {
+    return create_tmp_overlay_ext(NULL);
+}
+
 static int mkdir_p(const char *dir, const mode_t mode) {
     char tmp[PATH_MAX];
     char *p = NULL;
@@ -400,6 +521,7 @@ int save_vmstate_ext(Monitor *mon, const char *name)
     Error *local_err = NULL;
     char snapshot_file[PATH_MAX] = {};
     char command[PATH_MAX] = {};
+    char *template = NULL;
 
     if(isNumber(name)){
 	monitor_printf(mon, "Error: Please don't save snapshot with numeric name\n"); // Why?
@@ -447,7 +569,8 @@ int save_vmstate_ext(Monitor *mon, const char *name)
     strcpy(bs->filename, snapshot_file);
     strcpy(bs->exact_filename, snapshot_file);
 
-    ret = create_tmp_overlay();
+    template = get_overlay_template(snapshot_file);
+    ret = create_tmp_overlay_ext(template);
     if (ret < 0) {
         monitor_printf(mon, "Cannot create temporary overlay %s\n", name);
         goto end;
@@ -509,53 +632,123 @@ end:
     if (snap_dir != NULL) {
         QDECREF(snap_dir);
     }
+    g_free(template);
     return ret;
 }
 
+/* The node of the backing chain starting at bs that holds the disk layer of
+ * snapshot name.
+ */
+static BlockDriverState *find_snap_layer(BlockDriverState *bs,
+                                         const char *name)
+{
+    char snap_file[PATH_MAX] = {};
+    char want[PATH_MAX], path[PATH_MAX];
+
+    if (gen_snap_path(name, snap_file) < 0 ||
+        realpath(snap_file, want) == NULL) {
+        return NULL;
+    }
+    for (; bs; bs = backing_bs(bs)) {
+        if (realpath(bs->filename, path) && !strcmp(path, want)) {
+            return bs;
+        }
+    }
+    return NULL;
+}
+
+/* Replace the active overlay by an empty one on top of the disk layer of
+ * snap.  The old overlay, with whatever was written since the last load or
+ * save, is dropped.  When snap is in the current backing chain, which is
+ * the case of every snapshot below the active image, the new overlay is
+ * linked to the node already open instead of opening the chain again.
+ */
 static int goto_snap (const char* snap) {
     char image_path[PATH_MAX] = {};
+    char *tmp_name = NULL, *template = NULL, *old_file = NULL;
+    BlockDriverState *new_bs = NULL, *snap_bs;
+    AioContext *aio_context;
+    QDict *opts = NULL;
+    Error *local_err = NULL;
+    int ret = -EINVAL;
 
     BlockDriverState *bs = find_active();
     if (bs == NULL) {
         return -EINVAL;
     }
+    snap_bs = find_snap_layer(backing_bs(bs), snap);
 
-    int ret = bs->drv->bdrv_make_empty(bs);
     QString *dir_path = get_dir_path();
 
     sprintf(image_path, "%s/%s/%s-sn", qstring_get_str(dir_path),
                                        snap,
                                        get_base_name());
-    ret = bdrv_change_backing_file(bs, image_path, "qcow2");
-    if (ret < 0) {
-        goto end;
+    QDECREF(dir_path);
+
+    /* Snapshots saved without a template get a new overlay */
+    tmp_name = new_overlay_name();
+    template = get_overlay_template(image_path);
+    if (access(template, F_OK) ||
+        bdrv_clone_file(template, tmp_name, &local_err) < 0) {
+        if (local_err != NULL) {
+            warn_report("%s", error_get_pretty(local_err));
+            error_free(local_err);
+            local_err = NULL;
+        }
+        create_overlay_file(tmp_name, image_path, "qcow2",
+                            bdrv_getlength(bs), &local_err);
+        if (local_err != NULL) {
+            error_report_err(local_err);
+            goto end;
+        }
     }
 
-    BlockDriverState *new_back = NULL;
-    Error *local_err = NULL;
-    new_back = bdrv_open(bs->backing_file, NULL, NULL, 0, &local_err);
-    if (new_back == NULL) {
+    if (snap_bs != NULL) {
+        opts = qdict_new();
+        qdict_put_str(opts, "driver", "qcow2");
+        qdict_put_str(opts, "backing", "");
+    }
+    new_bs = bdrv_open(tmp_name, NULL, opts, bdrv_get_flags(bs), &local_err);
+    if (new_bs == NULL) {
         error_report_err(local_err);
-        ret = -EINVAL;
+        unlink(tmp_name);
         goto end;
     }
 
-    bdrv_set_backing_hd(bs, NULL, &local_err);
-    if (local_err != NULL) {
-        error_report_err(local_err);
-        ret = -EINVAL;
-        goto end;
+    old_file = g_strdup(bs->filename);
+    aio_context = bdrv_get_aio_context(bs);
+    if (bdrv_get_aio_context(new_bs) != aio_context) {
+        bdrv_set_aio_context(new_bs, aio_context);
     }
-    bdrv_set_backing_hd(bs, new_back, &local_err);
+
+    /* The old overlay goes away with its last parent, so drain everything
+     * rather than just that node.
+     */
+    bdrv_drain_all_begin();
+    aio_context_acquire(aio_context);
+    if (snap_bs != NULL) {
+        bdrv_set_backing_hd(new_bs, snap_bs, &local_err);
+    }
+    if (local_err == NULL) {
+        bdrv_replace_node(bs, new_bs, &local_err);
+    }
+    aio_context_release(aio_context);
+    bdrv_drain_all_end();
+
+    bdrv_unref(new_bs);
     if (local_err != NULL) {
         error_report_err(local_err);
-        ret = -EINVAL;
+        unlink(tmp_name);
         goto end;
     }
-    bdrv_unref(new_back);
+
+    unlink(old_file);
+    ret = 0;
 
 end:
-    QDECREF(dir_path);
+    g_free(old_file);
+    g_free(template);
+    g_free(tmp_name);
     return ret;
 }
 
@@ -606,6 +799,12 @@ int incremental_load_vmstate_ext (const char *name, Monitor *mon) {
     int saved_vm_running  = runstate_is_running();
     int ret = -EINVAL;
 
+    /* A squash job would lose the nodes it works on */
+    if (block_job_next(NULL)) {
+        monitor_printf(mon, "Cannot load a snapshot while block jobs are running\n");
+        return -EBUSY;
+    }
+
     QString *dir_path = get_dir_path();
     if (dir_path == NULL) {
         monitor_printf(mon, "There are not block devices on current VM\n");
@@ -676,3 +875,206 @@ end_snap_uncreated:
     return ret;
 }
 
+static int write_snap_dirs(const char *file, QList *dirs, Error **errp)
+{
+    GString *str = g_string_new(NULL);
+    QListEntry *entry;
+    GError *err = NULL;
+    int ret = 0;
+
+    QLIST_FOREACH_ENTRY(dirs, entry) {
+        QString *dir = qobject_to_qstring(qlist_entry_obj(entry));
+
+        g_string_append_printf(str, "%s\n", qstring_get_str(dir));
+    }
+    if (!g_file_set_contents(file, str->str, str->len, &err)) {
+        error_setg(errp, "Cannot write %s: %s", file, err->message);
+        g_error_free(err);
+        ret = -EIO;
+    }
+    g_string_free(str, true);
+    return ret;
+}
+
+/* Undo the insertion of a squash image between active and top_bs: make
+ * top_bs the backing file of active again and, if @backing is not NULL,
+ * write it back to the header of active.  Returns false if the squash
+ * image is still used, in memory or on disk.
+ */
+static bool squash_unlink(BlockDriverState *active, BlockDriverState *top_bs,
+                          const char *backing, const char *backing_fmt)
+{
+    Error *local_err = NULL;
+
+    bdrv_drained_begin(active);
+    bdrv_set_backing_hd(active, top_bs, &local_err);
+    bdrv_drained_end(active);
+    if (local_err) {
+        error_report_err(local_err);
+        return false;
+    }
+    if (backing &&
+        bdrv_change_backing_file(active, backing, backing_fmt) < 0) {
+        error_report("Cannot restore %s as backing file of %s",
+                     backing, active->filename);
+        return false;
+    }
+    return true;
+}
+
+/* Merge the disk layers of the snapshots from top down to, but not
+ * including, base (by default the original base image) while the VM runs.
+ *
+ * A new image is created next to the layer of top and inserted right above
+ * it; a stream job then copies into it whatever the squashed layers hold
+ * and finally makes base its backing file.  top must be the newest
+ * snapshot, so that the only backing file to change is that of the active
+ * overlay: the snapshot files are never modified and each snapshot stays
+ * loadable by itself.  Snapshots saved afterwards build on the new image,
+ * and the .chain file next to it tells get_snap_chain() whose memory states
+ * it stands for.  If the job cannot be started, the new image is unlinked
+ * again and removed.
+ */
+void squash_vmstate_ext(const char *top, const char *base, const char *job_id,
+                        int64_t speed, Error **errp)
+{
+    BlockDriverState *active, *top_bs, *base_bs, *iter;
+    BlockDriverState *new_bs = NULL;
+    AioContext *aio_context;
+    char snap_file[PATH_MAX] = {};
+    char old_backing[PATH_MAX], old_backing_fmt[16];
+    char *new_file = NULL, *chain_file = NULL, *id = NULL;
+    QList *dirs = NULL;
+    QDict *opts;
+    gchar *old_chain = NULL;
+    gsize old_chain_len = 0;
+    Error *local_err = NULL;
+    bool inserted = false, relinked = false;
+
+    active = find_active();
+    if (active == NULL) {
+        error_setg(errp, "There are no block devices on the current VM");
+        return;
+    }
+    aio_context = bdrv_get_aio_context(active);
+    aio_context_acquire(aio_context);
+
+    top_bs = find_snap_layer(backing_bs(active), top);
+    if (top_bs == NULL) {
+        error_setg(errp, "Snapshot '%s' is not in the active backing chain",
+                   top);
+        goto out;
+    }
+    /* A layer above top would be a snapshot image */
+    if (backing_bs(active) != top_bs) {
+        error_setg(errp, "Snapshot '%s' is not the newest one", top);
+        error_append_hint(errp, "Only a range ending at the layer below the "
+                          "active image can be squashed\n");
+        goto out;
+    }
+    if (base) {
+        base_bs = find_snap_layer(backing_bs(top_bs), base);
+        if (base_bs == NULL) {
+            error_setg(errp, "Snapshot '%s' is not below '%s' in the active "
+                       "backing chain", base, top);
+            goto out;
+        }
+    } else {
+        for (base_bs = top_bs; backing_bs(base_bs);
+             base_bs = backing_bs(base_bs)) {
+            /* nothing */
+        }
+    }
+
+    for (iter = top_bs; iter != base_bs; iter = backing_bs(iter)) {
+        if (bdrv_op_is_blocked(iter, BLOCK_OP_TYPE_STREAM, errp)) {
+            goto out;
+        }
+    }
+    dirs = get_snap_dirs(top_bs, base_bs);
+    if (dirs == NULL) {
+        error_setg(errp, "Cannot resolve the snapshot chain of '%s'", top);
+        goto out;
+    }
+
+    gen_snap_path(top, snap_file);
+    new_file = g_strdup_printf("%s-squash", snap_file);
+    chain_file = g_strdup_printf("%s.chain", new_file);
+    /* Left by an earlier squash of the same snapshot, restored on failure */
+    g_file_get_contents(chain_file, &old_chain, &old_chain_len, NULL);
+    if (write_snap_dirs(chain_file, dirs, errp) < 0) {
+        goto out;
+    }
+
+    bdrv_img_create(new_file, "qcow2", top_bs->filename,
+                    top_bs->drv->format_name, NULL, bdrv_getlength(top_bs),
+                    0, true, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        goto out;
+    }
+
+    /* The backing file is linked by hand to the node already open */
+    opts = qdict_new();
+    qdict_put_str(opts, "driver", "qcow2");
+    qdict_put_str(opts, "backing", "");
+    new_bs = bdrv_open(new_file, NULL, opts, BDRV_O_RDWR, errp);
+    if (new_bs == NULL) {
+        goto out;
+    }
+
+    bdrv_drained_begin(active);
+    bdrv_set_backing_hd(new_bs, top_bs, &local_err);
+    if (!local_err) {
+        bdrv_set_backing_hd(active, new_bs, &local_err);
+    }
+    bdrv_drained_end(active);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        goto out;
+    }
+    inserted = true;
+
+    pstrcpy(old_backing, sizeof(old_backing), active->backing_file);
+    pstrcpy(old_backing_fmt, sizeof(old_backing_fmt), active->backing_format);
+
+    /* Record the new backing file in the active overlay, so that the next
+     * snapshot saved goes through the squashed image.  Failing that, the
+     * old chain on disk is still consistent.
+     */
+    if (bdrv_change_backing_file(active, new_bs->filename, "qcow2") < 0) {
+        error_report("Cannot record %s as backing file of %s",
+                     new_bs->filename, active->filename);
+    } else {
+        relinked = true;
+    }
+
+    id = job_id ? g_strdup(job_id) : g_strdup_printf("squash-%s", top);
+    stream_start(id, new_bs, base_bs, base_bs->filename, speed,
+                 BLOCKDEV_ON_ERROR_REPORT, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        inserted = !squash_unlink(active, top_bs,
+                                  relinked ? old_backing : NULL,
+                                  old_backing_fmt[0] ? old_backing_fmt : NULL);
+    }
+
+out:
+    if (new_bs) {
+        bdrv_unref(new_bs);
+    }
+    if (!inserted && chain_file) {
+        if (old_chain) {
+            g_file_set_contents(chain_file, old_chain, old_chain_len, NULL);
+        } else {
+            unlink(chain_file);
+        }
+        unlink(new_file);
+    }
+    aio_context_release(aio_context);
+    g_free(old_chain);
+    QDECREF(dirs);
+    g_free(id);
+    g_free(chain_file);
+    g_free(new_file);
+}
@@ -37,6 +37,7 @@
 #include "qemu/error-report.h"
 #include "qemu/log.h"
 #include "qemu/cutils.h"
+#include "block/shared-cache.h"
 
 #ifdef CONFIG_LINUX
 #include <sys/prctl.h>
@@ -153,6 +154,12 @@ void os_parse_cmd_args(int index, const char *optarg)
     case QEMU_OPTION_chroot:
         chroot_dir = optarg;
         break;
+    case QEMU_OPTION_shared_cache:
+        if (qemu_strtosz_MiB(optarg, NULL, &shared_cache_default_size) < 0) {
+            error_report("Invalid shared cache size: %s", optarg);
+            exit(1);
+        }
+        break;
     case QEMU_OPTION_daemonize:
         daemonize = 1;
         break;
@@ -176,7 +176,8 @@ static void QEMU_NORETURN help(void)
            "\n"
            "Parameters to convert subcommand:\n"
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
-           "       process (defaults to 8)\n"
+           "       process (defaults to 8, or to the number of host CPUs when\n"
+           "       compressing to qcow2)\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
@@ -338,13 +339,14 @@ static int img_add_key_secrets(void *opaque,
 
 static BlockBackend *img_open_new_file(const char *filename,
                                        QemuOpts *create_opts,
+                                       QDict *options,
                                        const char *fmt, int flags,
                                        bool writethrough, bool quiet,
                                        bool force_share)
 {
-    QDict *options = NULL;
-
-    options = qdict_new();
+    if (!options) {
+        options = qdict_new();
+    }
     qemu_opt_foreach(create_opts, img_add_key_secrets, options, &error_abort);
 
     return img_open_file(filename, options, fmt, flags, writethrough, quiet,
@@ -1547,7 +1549,19 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
-#define MAX_COROUTINES 16
+#define MAX_COROUTINES 64
+
+static int img_num_cpus(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n > 0) {
+        return MIN(n, INT_MAX);
+    }
+#endif
+    return 1;
+}
 
 typedef struct ImgConvertState {
     BlockBackend **src;
@@ -1953,6 +1967,8 @@ static int img_convert(int argc, char **argv)
         .wr_in_order        = true,
         .num_coroutines     = 8,
     };
+    bool has_num_coroutines = false;
+    QDict *target_options = NULL;
 
     for(;;) {
         static const struct option long_options[] = {
@@ -2054,6 +2070,7 @@ static int img_convert(int argc, char **argv)
                              " coroutines is between 1 and %d", MAX_COROUTINES);
                 goto fail_getopt;
             }
+            has_num_coroutines = true;
             break;
         case 'W':
             s.wr_in_order = false;
@@ -2089,11 +2106,6 @@ static int img_convert(int argc, char **argv)
         goto fail_getopt;
     }
 
-    if (!s.wr_in_order && s.compressed) {
-        error_report("Out of order write and compress are mutually exclusive");
-        goto fail_getopt;
-    }
-
     if (tgt_image_opts && !skip_create) {
         error_report("--target-image-opts requires use of -n flag");
         goto fail_getopt;
@@ -2297,8 +2309,22 @@ static int img_convert(int argc, char **argv)
          * That has to wait for bdrv_create to be improved
          * to allow filenames in option syntax
          */
-        s.target = img_open_new_file(out_filename, opts, out_fmt,
-                                     flags, writethrough, quiet, false);
+        if (s.compressed && !strcmp(out_fmt, "qcow2")) {
+            /* Compression is CPU bound and runs in worker threads; keep
+             * one cluster in flight per host CPU unless told otherwise,
+             * and let qcow2 compress as many clusters at once.
+             */
+            if (!has_num_coroutines) {
+                s.num_coroutines = MAX(s.num_coroutines,
+                                       MIN(img_num_cpus(), MAX_COROUTINES));
+            }
+            target_options = qdict_new();
+            qdict_put_int(target_options, "compress-threads",
+                          s.num_coroutines);
+        }
+        s.target = img_open_new_file(out_filename, opts, target_options,
+                                     out_fmt, flags, writethrough, quiet,
+                                     false);
     }
     if (!s.target) {
         ret = -1;
@@ -2312,6 +2338,18 @@ static int img_convert(int argc, char **argv)
         goto out;
     }
 
+    /* qcow2 places compressed clusters wherever they end up being written,
+     * so they are written in whatever order their compression finishes;
+     * other formats, such as streamOptimized VMDK, need them in order */
+    if (s.compressed && !strcmp(out_bs->drv->format_name, "qcow2")) {
+        s.wr_in_order = false;
+    } else if (s.compressed && !s.wr_in_order) {
+        error_report("Out of order write and compress are mutually exclusive "
+                     "for this file format");
+        ret = -1;
+        goto out;
+    }
+
     /* increase bufsectors from the default 4096 (2M) if opt_transfer
      * or discard_alignment of the out_bs is greater. Limit to 32768 (16MB)
      * as maximum. */
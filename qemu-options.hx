@@ -740,19 +740,26 @@ image file)
 
 @item cache-size
 The maximum total size of the L2 table and refcount block caches in bytes
-(default: 1048576 bytes or 8 clusters, whichever is larger)
+(default: the sum of l2-cache-size and refcount-cache-size)
 
 @item l2-cache-size
 The maximum size of the L2 table cache in bytes
-(default: 4/5 of the total cache size)
+(default: if cache-size is not specified - enough to cover the whole image, up
+to 32 MB on Linux and 8 MB elsewhere; otherwise, 4/5 of the total cache size)
 
 @item refcount-cache-size
 The maximum size of the refcount block cache in bytes
-(default: 1/5 of the total cache size)
+(default: 262144 bytes or 2 clusters, whichever is larger, if neither
+cache-size nor l2-cache-size is specified; otherwise, 1/5 of the total cache
+size)
 
 @item cache-clean-interval
 Clean unused entries in the L2 and refcount caches. The interval is in seconds.
-The default value is 0 and it disables this feature.
+The default value is 600 on Linux and 0 elsewhere; 0 disables this feature.
+
+@item compress-threads
+The number of clusters compressed or decompressed in parallel in worker
+threads, between 1 and 64 (default: 4)
 
 @item pass-discard-request
 Whether discard requests to the qcow2 device should be forwarded to the data
@@ -3755,9 +3762,13 @@ ETEXI
 
 DEF("ckpt", HAS_ARG, QEMU_OPTION_ckpt,"aaa", QEMU_ARCH_ALL)
 STEXI
-@item -ckpt [every=@var{V}][,end=@var{E}]
+@item -ckpt [every=@var{V}][,end=@var{E}][,delta=on|off][,delta-cache=@var{size}]
 @findex -ckpt
 specify the checkpoint intervals @var{V} and an interuction for end @var{E}
+
+With @option{delta=on}, pages dirtied since the previous checkpoint are saved
+as XBZRLE deltas against their contents in that checkpoint, using a cache of
+@var{size} bytes (the XBZRLE cache size by default) of previously saved pages.
 ETEXI
 
 #endif
@@ -4050,6 +4061,31 @@ Immediately before starting guest execution, chroot to the specified
 directory.  Especially useful in combination with -runas.
 ETEXI
 
+#ifndef _WIN32
+DEF("shared-cache", HAS_ARG, QEMU_OPTION_shared_cache, \
+    "-shared-cache size\n"
+    "                cache base images in memory shared with other processes\n"
+    "                opening the same files\n",
+    QEMU_ARCH_ALL)
+#endif
+STEXI
+@item -shared-cache @var{size}
+@findex -shared-cache
+Cache up to @var{size} bytes (suffixes M and G are accepted, the default unit
+is MiB) of the base image of each backing chain, that is the regular file
+under the bottom image of the chain, in a POSIX shared memory object.  All
+QEMU processes of the same user that open the same, unmodified file share the
+cache, so that VMs booted from one base image read each of its blocks from the
+disk only once.  The other images of the chain are not cached.  The
+@option{shared-cache-size} option of the @code{file} driver overrides the size
+for one file, and enables the cache for any file opened read-only.
+
+The objects are named @file{qemu-shared-cache-*} in @file{/dev/shm}, and the
+last process that uses one removes it.  An object left behind by a process
+that crashed is removed by the next process that opens the same file; others
+can be removed by hand at any time.
+ETEXI
+
 #ifndef _WIN32
 DEF("runas", HAS_ARG, QEMU_OPTION_runas, \
     "-runas user     change to user id user just before starting the VM\n",
@@ -517,6 +517,28 @@ void qmp_loadvm_ext(const char *snap_name, Error **errp)
 }
 #endif
 
+#ifdef CONFIG_EXTSNAP
+void qmp_squash_ext(const char *top, bool has_base, const char *base,
+                    bool has_job_id, const char *job_id,
+                    bool has_speed, int64_t speed, Error **errp)
+{
+    if (has_speed && speed < 0) {
+        error_setg(errp, QERR_INVALID_PARAMETER, "speed");
+        return;
+    }
+    squash_vmstate_ext(top, has_base ? base : NULL,
+                       has_job_id ? job_id : NULL,
+                       has_speed ? speed : 0, errp);
+}
+#else
+void qmp_squash_ext(const char *top, bool has_base, const char *base,
+                    bool has_job_id, const char *job_id,
+                    bool has_speed, int64_t speed, Error **errp)
+{
+    error_setg(errp, "External snapshot support disabled");
+}
+#endif
+
 #ifndef CONFIG_VNC
 /* If VNC support is enabled, the "true" query-vnc command is
    defined in the VNC subsystem */
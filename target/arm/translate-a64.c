@@ -153,6 +153,35 @@ typedef void CryptoTwoOpEnvFn(TCGv_ptr, TCGv_i32, TCGv_i32);
 typedef void CryptoThreeOpEnvFn(TCGv_ptr, TCGv_i32, TCGv_i32, TCGv_i32);
 
 /* initialize TCG globals.  */
+#ifdef CONFIG_FLEXUS
+/* The Flexus hooks are called several times per guest insn but only
+ * observe the vCPU: they may look at the general purpose registers, the
+ * pc and the flags, and never change any of them.  Tell TCG so, so that
+ * the other globals stay in host registers and none has to be reloaded
+ * after the call.
+ */
+static void a64_flexus_helper_globals(void)
+{
+    TCGTempSet reads, writes;
+    int i;
+
+    memset(&reads, 0, sizeof(reads));
+    memset(&writes, 0, sizeof(writes));
+    tcg_temp_set_add_i64(&reads, cpu_pc);
+    for (i = 0; i < 32; i++) {
+        tcg_temp_set_add_i64(&reads, cpu_X[i]);
+    }
+    tcg_temp_set_add_i32(&reads, cpu_NF);
+    tcg_temp_set_add_i32(&reads, cpu_ZF);
+    tcg_temp_set_add_i32(&reads, cpu_CF);
+    tcg_temp_set_add_i32(&reads, cpu_VF);
+
+    tcg_set_helper_globals(helper_flexus_insn_fetch_aa64, &reads, &writes);
+    tcg_set_helper_globals(helper_flexus_ld_aa64, &reads, &writes);
+    tcg_set_helper_globals(helper_flexus_st_aa64, &reads, &writes);
+}
+#endif /* CONFIG_FLEXUS */
+
 void a64_translate_init(void)
 {
     int i;
@@ -168,6 +197,10 @@ void a64_translate_init(void)
 
     cpu_exclusive_high = tcg_global_mem_new_i64(cpu_env,
         offsetof(CPUARMState, exclusive_high), "exclusive_high");
+
+#ifdef CONFIG_FLEXUS
+    a64_flexus_helper_globals();
+#endif /* CONFIG_FLEXUS */
 }
 
 static inline int get_a64_user_mem_index(DisasContext *s)
@@ -454,6 +487,78 @@ static inline void gen_goto_tb(DisasContext *s, int n, uint64_t dest)
     }
 }
 
+/* Superblock formation.  A TB translated with CF_TRACE does not stop at
+ * branches whose target lies ahead of the branch in the TB's page: an
+ * unconditional branch is simply followed, and a conditional one leaves
+ * the TB on its taken path and continues with the fall-through.  The TB
+ * still covers [pc, pc + size), so page invalidation and restore_state
+ * work as usual, and the TCG optimizer sees the whole trace at once.
+ * Ordinary TBs ending in such a branch count their executions and ask
+ * for retranslation as a superblock once they become hot.
+ */
+static bool trace_can_follow(DisasContext *s, uint64_t dest)
+{
+    if (s->base.singlestep_enabled || s->ss_active ||
+        (s->base.tb->cflags & (CF_LAST_IO | CF_NOCACHE | CF_USE_ICOUNT))) {
+        return false;
+    }
+#ifdef CONFIG_FLEXUS
+    /* Flexus has to see every branch as it is executed */
+    if (flexus_in_trace()) {
+        return false;
+    }
+#endif /* CONFIG_FLEXUS */
+
+    return dest >= s->pc &&
+           (dest & TARGET_PAGE_MASK) == (s->base.pc_first & TARGET_PAGE_MASK);
+}
+
+/* Only forward conditional branches are worth inlining: a backward one
+ * is usually a loop back edge, which is better left to goto_tb chaining.
+ */
+static bool trace_can_follow_cond(DisasContext *s, uint64_t dest)
+{
+    return dest > s->pc && trace_can_follow(s, dest);
+}
+
+static inline bool is_trace(DisasContext *s)
+{
+    return s->base.tb->cflags & CF_TRACE;
+}
+
+/* Bump the execution counter of an ordinary TB and request a superblock
+ * once it reaches TB_TRACE_THRESHOLD.  Must be emitted before any TCG
+ * temporary of the current insn is live, as it ends the basic block.
+ */
+static void gen_trace_count(DisasContext *s)
+{
+    TCGv_ptr tcg_tb = tcg_const_ptr(s->base.tb);
+    TCGv_i32 tcg_count = tcg_temp_new_i32();
+    TCGLabel *label_cold = gen_new_label();
+
+    tcg_gen_ld_i32(tcg_count, tcg_tb, offsetof(TranslationBlock, exec_count));
+    tcg_gen_addi_i32(tcg_count, tcg_count, 1);
+    tcg_gen_st_i32(tcg_count, tcg_tb, offsetof(TranslationBlock, exec_count));
+    tcg_gen_brcondi_i32(TCG_COND_LTU, tcg_count, TB_TRACE_THRESHOLD,
+                        label_cold);
+    tcg_temp_free_i32(tcg_count);
+    tcg_temp_free_ptr(tcg_tb);
+
+    tcg_tb = tcg_const_ptr(s->base.tb);
+    gen_helper_tb_trace_hot(cpu_env, tcg_tb);
+    tcg_temp_free_ptr(tcg_tb);
+    gen_set_label(label_cold);
+}
+
+/* Leave a superblock in the middle.  The goto_tb slots are kept for the
+ * final exit, so side exits go through the TB lookup helper instead.
+ */
+static void gen_trace_side_exit(DisasContext *s, uint64_t dest)
+{
+    gen_a64_set_pc_im(dest);
+    tcg_gen_lookup_and_goto_ptr(cpu_pc);
+}
+
 static void unallocated_encoding(DisasContext *s)
 {
     /* Unallocated and reserved encodings are uncategorized */
@@ -1382,6 +1487,15 @@ static void disas_uncond_b_imm(DisasContext *s, uint32_t insn)
     insn_is_branch = true;
 #endif /* CONFIG_FLEXUS */
 
+    if (trace_can_follow(s, addr)) {
+        if (is_trace(s)) {
+            /* Keep translating at the branch target */
+            s->pc = addr;
+            return;
+        }
+        gen_trace_count(s);
+    }
+
     /* B Branch / BL Branch with link */
     gen_goto_tb(s, 0, addr);
 }
@@ -1404,6 +1518,20 @@ static void disas_comp_b_imm(DisasContext *s, uint32_t insn)
     rt = extract32(insn, 0, 5);
     addr = s->pc + sextract32(insn, 5, 19) * 4 - 4;
 
+    if (trace_can_follow_cond(s, addr)) {
+        if (is_trace(s)) {
+            TCGLabel *label_next = gen_new_label();
+
+            tcg_cmp = read_cpu_reg(s, rt, sf);
+            tcg_gen_brcondi_i64(op ? TCG_COND_EQ : TCG_COND_NE,
+                                tcg_cmp, 0, label_next);
+            gen_trace_side_exit(s, addr);
+            gen_set_label(label_next);
+            return;
+        }
+        gen_trace_count(s);
+    }
+
     tcg_cmp = read_cpu_reg(s, rt, sf);
     label_match = gen_new_label();
 
@@ -1454,6 +1582,22 @@ static void disas_test_b_imm(DisasContext *s, uint32_t insn)
     addr = s->pc + sextract32(insn, 5, 14) * 4 - 4;
     rt = extract32(insn, 0, 5);
 
+    if (trace_can_follow_cond(s, addr)) {
+        if (is_trace(s)) {
+            TCGLabel *label_next = gen_new_label();
+
+            tcg_cmp = tcg_temp_new_i64();
+            tcg_gen_andi_i64(tcg_cmp, cpu_reg(s, rt), (1ULL << bit_pos));
+            tcg_gen_brcondi_i64(op ? TCG_COND_EQ : TCG_COND_NE,
+                                tcg_cmp, 0, label_next);
+            tcg_temp_free_i64(tcg_cmp);
+            gen_trace_side_exit(s, addr);
+            gen_set_label(label_next);
+            return;
+        }
+        gen_trace_count(s);
+    }
+
     tcg_cmp = tcg_temp_new_i64();
     tcg_gen_andi_i64(tcg_cmp, cpu_reg(s, rt), (1ULL << bit_pos));
     label_match = gen_new_label();
@@ -1507,7 +1651,21 @@ static void disas_cond_b_imm(DisasContext *s, uint32_t insn)
 
     if (cond < 0x0e) {
         /* genuinely conditional branches */
-        TCGLabel *label_match = gen_new_label();
+        TCGLabel *label_match;
+
+        if (trace_can_follow_cond(s, addr)) {
+            if (is_trace(s)) {
+                TCGLabel *label_next = gen_new_label();
+
+                arm_gen_test_cc(cond ^ 1, label_next);
+                gen_trace_side_exit(s, addr);
+                gen_set_label(label_next);
+                return;
+            }
+            gen_trace_count(s);
+        }
+
+        label_match = gen_new_label();
         arm_gen_test_cc(cond, label_match);
 
 #ifdef CONFIG_FLEXUS
@@ -1546,6 +1704,14 @@ static void disas_cond_b_imm(DisasContext *s, uint32_t insn)
     insn_is_branch = true;
 #endif /* CONFIG_FLEXUS */
 
+        if (trace_can_follow(s, addr)) {
+            if (is_trace(s)) {
+                s->pc = addr;
+                return;
+            }
+            gen_trace_count(s);
+        }
+
         gen_goto_tb(s, 0, addr);
     }
 }
@@ -11732,6 +11898,14 @@ static void aarch64_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
         disas_a64_insn(env, dc);
     }
 
+    /* The insn bound only holds for straight-line code; a superblock
+     * that skipped ahead must still stop at the end of the page.
+     */
+    if (is_trace(dc) && dc->base.is_jmp == DISAS_NEXT &&
+        (dc->pc & TARGET_PAGE_MASK) != (dc->base.pc_first & TARGET_PAGE_MASK)) {
+        dc->base.is_jmp = DISAS_TOO_MANY;
+    }
+
     dc->base.pc_next = dc->pc;
     translator_loop_temp_check(&dc->base);
 }
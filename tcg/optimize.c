@@ -1357,8 +1357,20 @@ void tcg_optimize(TCGContext *s)
             break;
 
         case INDEX_op_call:
-            if (!(args[nb_oargs + nb_iargs + 1]
-                  & (TCG_CALL_NO_READ_GLOBALS | TCG_CALL_NO_WRITE_GLOBALS))) {
+            if (args[nb_oargs + nb_iargs + 1] & TCG_CALL_NO_WRITE_GLOBALS) {
+                /* Nothing to do */
+            } else if (args[nb_oargs + nb_iargs + 1] & TCG_CALL_GLOBAL_SETS) {
+                const TCGHelperGlobals *hg =
+                    tcg_helper_globals(s, (void *)args[nb_oargs + nb_iargs]);
+
+                for (i = 0; i < nb_globals; i++) {
+                    if (test_bit(i, temps_used.l)
+                        && test_bit(i, hg->writes.l)) {
+                        reset_temp(i);
+                    }
+                }
+            } else if (!(args[nb_oargs + nb_iargs + 1]
+                         & TCG_CALL_NO_READ_GLOBALS)) {
                 for (i = 0; i < nb_globals; i++) {
                     if (test_bit(i, temps_used.l)) {
                         reset_temp(i);
@@ -319,6 +319,22 @@ static const TCGHelperInfo all_helpers[] = {
 #include "exec/helper-tcg.h"
 };
 
+void tcg_set_helper_globals(void *func, const TCGTempSet *reads,
+                            const TCGTempSet *writes)
+{
+    TCGContext *s = &tcg_ctx;
+    TCGHelperGlobals *hg;
+
+    tcg_debug_assert(g_hash_table_lookup(s->helpers, func));
+    if (!s->helper_globals) {
+        s->helper_globals = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    }
+    hg = g_new(TCGHelperGlobals, 1);
+    hg->reads = *reads;
+    hg->writes = *writes;
+    g_hash_table_replace(s->helper_globals, func, hg);
+}
+
 static int indirect_reg_alloc_order[ARRAY_SIZE(tcg_target_reg_alloc_order)];
 static void process_op_defs(TCGContext *s);
 
@@ -985,6 +1001,11 @@ void tcg_gen_callN(TCGContext *s, void *func, TCGArg ret,
     info = g_hash_table_lookup(s->helpers, (gpointer)func);
     flags = info->flags;
     sizemask = info->sizemask;
+    if (s->helper_globals
+        && !(flags & TCG_CALL_NO_READ_GLOBALS)
+        && g_hash_table_lookup(s->helper_globals, func)) {
+        flags |= TCG_CALL_GLOBAL_SETS;
+    }
 
 #if defined(__sparc__) && !defined(__arch64__) \
     && !defined(CONFIG_TCG_INTERPRETER)
@@ -1703,8 +1724,24 @@ static void liveness_pass_1(TCGContext *s, uint8_t *temp_state)
                         temp_state[arg] = TS_DEAD;
                     }
 
-                    if (!(call_flags & (TCG_CALL_NO_WRITE_GLOBALS |
-                                        TCG_CALL_NO_READ_GLOBALS))) {
+                    if (call_flags & TCG_CALL_GLOBAL_SETS) {
+                        const TCGHelperGlobals *hg =
+                            tcg_helper_globals(s, (void *)args[nb_oargs +
+                                                               nb_iargs]);
+                        bool no_wg = call_flags & TCG_CALL_NO_WRITE_GLOBALS;
+
+                        /* only the globals the helper touches go back to
+                           memory, written ones have to be reloaded */
+                        for (i = 0; i < nb_globals; i++) {
+                            if (!no_wg && test_bit(i, hg->writes.l)) {
+                                temp_state[i] = TS_DEAD | TS_MEM;
+                            } else if (test_bit(i, hg->reads.l)
+                                       || test_bit(i, hg->writes.l)) {
+                                temp_state[i] |= TS_MEM;
+                            }
+                        }
+                    } else if (!(call_flags & (TCG_CALL_NO_WRITE_GLOBALS |
+                                               TCG_CALL_NO_READ_GLOBALS))) {
                         /* globals should go back to memory */
                         memset(temp_state, TS_DEAD | TS_MEM, nb_globals);
                     } else if (!(call_flags & TCG_CALL_NO_READ_GLOBALS)) {
@@ -1976,7 +2013,22 @@ static bool liveness_pass_2(TCGContext *s, uint8_t *temp_state)
 
         /* Liveness analysis should ensure that the following are
            all correct, for call sites and basic block end points.  */
-        if (call_flags & TCG_CALL_NO_READ_GLOBALS) {
+        if (call_flags & TCG_CALL_GLOBAL_SETS) {
+            const TCGHelperGlobals *hg =
+                tcg_helper_globals(s, (void *)args[nb_oargs + nb_iargs]);
+
+            for (i = 0; i < nb_globals; ++i) {
+                if (!(call_flags & TCG_CALL_NO_WRITE_GLOBALS)
+                    && test_bit(i, hg->writes.l)) {
+                    tcg_debug_assert(dir_temps[i] == 0
+                                     || temp_state[i] == TS_DEAD);
+                } else if (test_bit(i, hg->reads.l)
+                           || test_bit(i, hg->writes.l)) {
+                    tcg_debug_assert(dir_temps[i] == 0
+                                     || temp_state[i] != 0);
+                }
+            }
+        } else if (call_flags & TCG_CALL_NO_READ_GLOBALS) {
             /* Nothing to do */
         } else if (call_flags & TCG_CALL_NO_WRITE_GLOBALS) {
             for (i = 0; i < nb_globals; ++i) {
@@ -2303,6 +2355,26 @@ static void sync_globals(TCGContext *s, TCGRegSet allocated_regs)
     }
 }
 
+/* save or sync only the globals a helper accesses, see
+   tcg_set_helper_globals. */
+static void save_helper_globals(TCGContext *s, const TCGHelperGlobals *hg,
+                                bool no_write, TCGRegSet allocated_regs)
+{
+    int i;
+
+    for (i = 0; i < s->nb_globals; i++) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (!no_write && test_bit(i, hg->writes.l)) {
+            temp_save(s, ts, allocated_regs);
+        } else if (test_bit(i, hg->reads.l) || test_bit(i, hg->writes.l)) {
+            tcg_debug_assert(ts->val_type != TEMP_VAL_REG
+                             || ts->fixed_reg
+                             || ts->mem_coherent);
+        }
+    }
+}
+
 /* at the end of a basic block, we assume all temporaries are dead and
    all globals are stored at their canonical location. */
 static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
@@ -2690,7 +2762,11 @@ static void tcg_reg_alloc_call(TCGContext *s, int nb_oargs, int nb_iargs,
 
     /* Save globals if they might be written by the helper, sync them if
        they might be read. */
-    if (flags & TCG_CALL_NO_READ_GLOBALS) {
+    if (flags & TCG_CALL_GLOBAL_SETS) {
+        save_helper_globals(s, tcg_helper_globals(s, func_addr),
+                            flags & TCG_CALL_NO_WRITE_GLOBALS,
+                            allocated_regs);
+    } else if (flags & TCG_CALL_NO_READ_GLOBALS) {
         /* Nothing to do */
     } else if (flags & TCG_CALL_NO_WRITE_GLOBALS) {
         sync_globals(s, allocated_regs);
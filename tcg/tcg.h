@@ -489,6 +489,10 @@ static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_PTR(TCGv_ptr t)
 #define TCG_CALL_NO_WRITE_GLOBALS   0x0020
 /* Helper can be safely suppressed if the return value is not used. */
 #define TCG_CALL_NO_SIDE_EFFECTS    0x0040
+/* Helper only reads and writes the globals registered for it with
+   tcg_set_helper_globals.  Set by tcg_gen_callN, do not use it in
+   DEF_HELPER_FLAGS. */
+#define TCG_CALL_GLOBAL_SETS        0x0080
 
 /* convenience version of most used call flags */
 #define TCG_CALL_NO_RWG         TCG_CALL_NO_READ_GLOBALS
@@ -657,6 +661,7 @@ struct TCGContext {
     tcg_insn_unit *code_ptr;
 
     GHashTable *helpers;
+    GHashTable *helper_globals;
 
 #ifdef CONFIG_PROFILER
     /* profiling info */
@@ -930,6 +935,42 @@ bool tcg_op_supported(TCGOpcode op);
 void tcg_gen_callN(TCGContext *s, void *func,
                    TCGArg ret, int nargs, TCGArg *args);
 
+/* Fine-grained version of TCG_CALL_NO_READ_GLOBALS and
+   TCG_CALL_NO_WRITE_GLOBALS: calls to FUNC only sync the globals in
+   READS to memory and only save (and later reload) those in WRITES.
+   All other globals stay in host registers across the call, unless
+   they live in a call-clobbered one.  As with the flags, a global read
+   through an exception raised by the helper counts as a read.  Must be
+   called after the globals are created and before FUNC is used. */
+void tcg_set_helper_globals(void *func, const TCGTempSet *reads,
+                            const TCGTempSet *writes);
+
+typedef struct TCGHelperGlobals {
+    TCGTempSet reads;
+    TCGTempSet writes;
+} TCGHelperGlobals;
+
+/* Only valid for calls flagged with TCG_CALL_GLOBAL_SETS. */
+static inline const TCGHelperGlobals *tcg_helper_globals(TCGContext *s,
+                                                         void *func)
+{
+    return g_hash_table_lookup(s->helper_globals, func);
+}
+
+static inline void tcg_temp_set_add_i32(TCGTempSet *set, TCGv_i32 v)
+{
+    set_bit(GET_TCGV_I32(v), set->l);
+}
+
+static inline void tcg_temp_set_add_i64(TCGTempSet *set, TCGv_i64 v)
+{
+    set_bit(GET_TCGV_I64(v), set->l);
+#if TCG_TARGET_REG_BITS == 32
+    /* high half */
+    set_bit(GET_TCGV_I64(v) + 1, set->l);
+#endif
+}
+
 void tcg_op_remove(TCGContext *s, TCGOp *op);
 TCGOp *tcg_op_insert_before(TCGContext *s, TCGOp *op, TCGOpcode opc, int narg);
 TCGOp *tcg_op_insert_after(TCGContext *s, TCGOp *op, TCGOpcode opc, int narg);
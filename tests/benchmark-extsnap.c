@@ -0,0 +1,329 @@
+/*
+ * External snapshot save/restore benchmark
+ *
+ * Starts a RAM-only machine (-machine none) on top of a scratch disk,
+ * then takes a chain of savevm-ext checkpoints while dirtying a fixed share
+ * of guest RAM between them through qtest.  For every checkpoint it records
+ * the wall-clock latency of the command, the time the guest was paused
+ * (from the STOP/RESUME event timestamps) and the bytes written for RAM and
+ * disk.  Finally it times loadvm-ext of the first checkpoint (restore) and
+ * of the last one (chain load).
+ *
+ * The sweep is controlled through the environment, all lists being comma
+ * separated:
+ *   EXTSNAP_BENCH_RAM     guest RAM sizes in MiB
+ *   EXTSNAP_BENCH_DIRTY   share of RAM dirtied between checkpoints, in %
+ *   EXTSNAP_BENCH_DELTA   "off" and/or "on", to save with XBZRLE deltas
+ *   EXTSNAP_BENCH_CHAIN   number of checkpoints in each chain
+ *   EXTSNAP_BENCH_OUTPUT  file to write the results to, as JSON
+ * Without -m perf only a small configuration is run.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "libqtest.h"
+#include "qapi/qmp/qjson.h"
+
+/* Dirtying is done in runs at the start of every chunk, so that it is
+ * spread over the whole guest without one qtest command per page.
+ */
+#define BENCH_CHUNK     (2 * 1024 * 1024)
+#define BENCH_PAGE      4096
+
+#define BENCH_BASE      "base.raw"
+
+typedef struct BenchConfig {
+    uint64_t ram_mb;
+    uint64_t dirty_pct;
+    bool delta;
+    uint64_t chain;
+} BenchConfig;
+
+static char *tmpdir;
+static QList *results;
+
+static int64_t event_time_us(QDict *ev)
+{
+    QDict *ts = qdict_get_qdict(ev, "timestamp");
+
+    return qdict_get_int(ts, "seconds") * G_USEC_PER_SEC +
+           qdict_get_int(ts, "microseconds");
+}
+
+/* Run savevm-ext or loadvm-ext to completion.  Returns the latency of the
+ * command and stores in @pause_us the time the guest spent stopped.
+ */
+static int64_t bench_snapshot_cmd(const char *cmd, const char *name,
+                                  int64_t *pause_us)
+{
+    int64_t start, stop = -1, paused = 0;
+    QDict *rsp;
+
+    start = g_get_monotonic_time();
+    qmp_async("{ 'execute': %s, 'arguments': { 'name': %s } }", cmd, name);
+    for (;;) {
+        rsp = qmp_receive();
+        if (!qdict_haskey(rsp, "event")) {
+            break;
+        }
+        if (!strcmp(qdict_get_str(rsp, "event"), "STOP")) {
+            stop = event_time_us(rsp);
+        } else if (!strcmp(qdict_get_str(rsp, "event"), "RESUME") &&
+                   stop >= 0) {
+            paused += event_time_us(rsp) - stop;
+            stop = -1;
+        }
+        QDECREF(rsp);
+    }
+    if (qdict_haskey(rsp, "error")) {
+        fprintf(stderr, "%s %s: %s\n", cmd, name,
+                qdict_get_str(qdict_get_qdict(rsp, "error"), "desc"));
+        g_assert_not_reached();
+    }
+    QDECREF(rsp);
+
+    if (pause_us) {
+        *pause_us = paused;
+    }
+    return g_get_monotonic_time() - start;
+}
+
+static void bench_dirty(const BenchConfig *c, uint8_t pattern)
+{
+    uint64_t len = QEMU_ALIGN_UP(BENCH_CHUNK / 100 * c->dirty_pct, BENCH_PAGE);
+    uint64_t addr;
+
+    if (!len) {
+        return;
+    }
+    len = MIN(len, BENCH_CHUNK);
+    for (addr = 0; addr < c->ram_mb << 20; addr += BENCH_CHUNK) {
+        qmemset(addr, pattern, len);
+    }
+}
+
+static int64_t file_size(const char *dir, const char *name)
+{
+    char *path = g_strdup_printf("%s/%s", dir, name);
+    struct stat st;
+    int ret = stat(path, &st);
+
+    g_assert_cmpint(ret, ==, 0);
+    g_free(path);
+    return st.st_size;
+}
+
+static void remove_tree(const char *path)
+{
+    GDir *dir = g_dir_open(path, 0, NULL);
+    const char *name;
+
+    if (!dir) {
+        unlink(path);
+        return;
+    }
+    while ((name = g_dir_read_name(dir))) {
+        char *child = g_build_filename(path, name, NULL);
+
+        remove_tree(child);
+        g_free(child);
+    }
+    g_dir_close(dir);
+    rmdir(path);
+}
+
+static void test_extsnap_bench(gconstpointer opaque)
+{
+    const BenchConfig *c = opaque;
+    QDict *res = qdict_new();
+    QList *ckpts = qlist_new();
+    char *base, *name, *cli;
+    int64_t restore_us, chain_us;
+    uint64_t i;
+    int fd;
+
+    base = g_build_filename(tmpdir, BENCH_BASE, NULL);
+    fd = open(base, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    g_assert(fd >= 0);
+    g_assert_cmpint(ftruncate(fd, 1024 * 1024), ==, 0);
+    close(fd);
+
+    cli = g_strdup_printf("-machine none -m %" PRIu64 "M -exton "
+                          "-drive if=none,id=disk0,format=raw,file=%s",
+                          c->ram_mb, base);
+    qtest_start(cli);
+    g_free(cli);
+    if (c->delta) {
+        qmp_discard_response("{ 'execute': 'migrate-set-capabilities',"
+                             "  'arguments': { 'capabilities': ["
+                             "    { 'capability': 'xbzrle', 'state': true }"
+                             "] } }");
+    }
+
+    /* Start from non-zero RAM, so that the first checkpoint is not just
+     * zero pages.
+     */
+    qmemset(0, 0x5a, c->ram_mb << 20);
+
+    for (i = 0; i < c->chain; i++) {
+        QDict *ckpt = qdict_new();
+        int64_t save_us, pause_us, mem, disk;
+        char *dir, *sn;
+
+        if (i) {
+            bench_dirty(c, i);
+        }
+        name = g_strdup_printf("bench%" PRIu64, i);
+        save_us = bench_snapshot_cmd("savevm-ext", name, &pause_us);
+
+        dir = g_build_filename(tmpdir, name, NULL);
+        sn = g_strdup_printf("%s-sn", BENCH_BASE);
+        mem = file_size(dir, "mem");
+        disk = file_size(dir, sn);
+        g_free(sn);
+        g_free(dir);
+
+        qdict_put_int(ckpt, "save-us", save_us);
+        qdict_put_int(ckpt, "pause-us", pause_us);
+        qdict_put_int(ckpt, "mem-bytes", mem);
+        qdict_put_int(ckpt, "disk-bytes", disk);
+        qlist_append(ckpts, ckpt);
+
+        if (g_test_perf()) {
+            g_test_message("%s: save %" PRId64 " us, paused %" PRId64
+                           " us, %" PRId64 " bytes", name, save_us,
+                           pause_us, mem + disk);
+        }
+        g_free(name);
+    }
+
+    restore_us = bench_snapshot_cmd("loadvm-ext", "bench0", NULL);
+    name = g_strdup_printf("bench%" PRIu64, c->chain - 1);
+    chain_us = bench_snapshot_cmd("loadvm-ext", name, NULL);
+    g_free(name);
+
+    if (g_test_perf()) {
+        g_test_message("restore %" PRId64 " us, chain load %" PRId64 " us",
+                       restore_us, chain_us);
+    }
+
+    qtest_end();
+
+    qdict_put_int(res, "ram-mb", c->ram_mb);
+    qdict_put_int(res, "dirty-percent", c->dirty_pct);
+    qdict_put_bool(res, "delta", c->delta);
+    qdict_put(res, "checkpoints", ckpts);
+    qdict_put_int(res, "restore-us", restore_us);
+    qdict_put_int(res, "chain-load-us", chain_us);
+    qlist_append(results, res);
+
+    remove_tree(tmpdir);
+    g_assert_cmpint(mkdir(tmpdir, 0700), ==, 0);
+    g_free(base);
+}
+
+static char **bench_list(const char *env, const char *quick,
+                         const char *perf)
+{
+    const char *s = getenv(env);
+
+    return g_strsplit(s ? s : g_test_perf() ? perf : quick, ",", 0);
+}
+
+static uint64_t bench_uint(const char *env, const char *s)
+{
+    uint64_t val;
+
+    if (qemu_strtou64(s, NULL, 10, &val) < 0) {
+        fprintf(stderr, "%s: invalid number '%s'\n", env, s);
+        exit(1);
+    }
+    return val;
+}
+
+static void bench_write_results(void)
+{
+    const char *path = getenv("EXTSNAP_BENCH_OUTPUT");
+    QString *json;
+    FILE *f;
+
+    if (!path) {
+        return;
+    }
+    json = qobject_to_json_pretty(QOBJECT(results));
+    f = fopen(path, "w");
+    g_assert(f);
+    fprintf(f, "%s\n", qstring_get_str(json));
+    fclose(f);
+    QDECREF(json);
+}
+
+int main(int argc, char **argv)
+{
+    char **ram, **dirty, **delta, **chain, **r, **d, **x;
+    uint64_t len;
+    char *pigz;
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    /* savevm-ext compresses the RAM state through pigz */
+    pigz = g_find_program_in_path("pigz");
+    if (!pigz) {
+        g_test_message("pigz not found; skipping extsnap benchmark");
+        return 0;
+    }
+    g_free(pigz);
+
+    ram = bench_list("EXTSNAP_BENCH_RAM", "32", "64,256,1024");
+    dirty = bench_list("EXTSNAP_BENCH_DIRTY", "10", "1,10,50");
+    delta = bench_list("EXTSNAP_BENCH_DELTA", "off", "off,on");
+    chain = bench_list("EXTSNAP_BENCH_CHAIN", "3", "5");
+    len = bench_uint("EXTSNAP_BENCH_CHAIN", chain[0] ? chain[0] : "");
+    g_strfreev(chain);
+    if (!len) {
+        fprintf(stderr, "EXTSNAP_BENCH_CHAIN: need at least one checkpoint\n");
+        exit(1);
+    }
+
+    for (r = ram; *r; r++) {
+        for (d = dirty; *d; d++) {
+            for (x = delta; *x; x++) {
+                BenchConfig *c = g_new0(BenchConfig, 1);
+                char *path;
+
+                c->ram_mb = bench_uint("EXTSNAP_BENCH_RAM", *r);
+                c->dirty_pct = MIN(bench_uint("EXTSNAP_BENCH_DIRTY", *d),
+                                   100);
+                c->delta = !strcmp(*x, "on");
+                c->chain = len;
+                path = g_strdup_printf("/extsnap/bench/ram-%" PRIu64 "M/"
+                                       "dirty-%" PRIu64 "/delta-%s",
+                                       c->ram_mb, c->dirty_pct,
+                                       c->delta ? "on" : "off");
+                g_test_add_data_func_full(path, c, test_extsnap_bench,
+                                          g_free);
+                g_free(path);
+            }
+        }
+    }
+    g_strfreev(ram);
+    g_strfreev(dirty);
+    g_strfreev(delta);
+
+    tmpdir = g_dir_make_tmp("extsnap-bench-XXXXXX", NULL);
+    g_assert(tmpdir);
+    results = qlist_new();
+
+    ret = g_test_run();
+
+    bench_write_results();
+    QDECREF(results);
+    remove_tree(tmpdir);
+    g_free(tmpdir);
+
+    return ret;
+}
@@ -0,0 +1,155 @@
+/*
+ * qcow2 compressed cluster throughput benchmark
+ *
+ * Writes a qcow2 image with compressed clusters the way qemu-img convert -c
+ * does, with a number of coroutines each writing one cluster at a time, and
+ * then reads it back and checks the contents.  The throughput of both
+ * directions is printed for an increasing number of requests in flight.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/coroutine.h"
+#include "qemu/main-loop.h"
+#include "block/block.h"
+#include "sysemu/block-backend.h"
+
+#define CLUSTER_SIZE    (64 * 1024)
+#define IMAGE_SIZE      (128 * 1024 * 1024)
+#define N_CLUSTERS      (IMAGE_SIZE / CLUSTER_SIZE)
+
+static const int in_flight[] = { 1, 4, 16 };
+
+typedef struct BenchState {
+    BlockBackend *blk;
+    uint8_t *data;
+    bool compressed;
+    bool write;
+    int next;
+    int running;
+    int ret;
+} BenchState;
+
+/* Half of every 64 bytes is random and half zero, which deflate shrinks to
+ * a bit more than half, much like a typical guest disk.
+ */
+static void fill_data(uint8_t *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        buf[i] = (i & 32) ? 0 : g_test_rand_int();
+    }
+}
+
+static void coroutine_fn bench_co(void *opaque)
+{
+    BenchState *s = opaque;
+    uint8_t *buf = g_malloc(CLUSTER_SIZE);
+    QEMUIOVector qiov;
+    struct iovec iov;
+
+    while (s->ret == 0 && s->next < N_CLUSTERS) {
+        int64_t offset = (int64_t)s->next++ * CLUSTER_SIZE;
+        int ret;
+
+        if (s->write) {
+            iov.iov_base = s->data + offset;
+        } else {
+            iov.iov_base = buf;
+        }
+        iov.iov_len = CLUSTER_SIZE;
+        qemu_iovec_init_external(&qiov, &iov, 1);
+
+        if (s->write) {
+            ret = blk_co_pwritev(s->blk, offset, CLUSTER_SIZE, &qiov,
+                                 s->compressed ? BDRV_REQ_WRITE_COMPRESSED
+                                               : 0);
+        } else {
+            ret = blk_co_preadv(s->blk, offset, CLUSTER_SIZE, &qiov, 0);
+            if (ret == 0 && memcmp(buf, s->data + offset, CLUSTER_SIZE)) {
+                ret = -EIO;
+            }
+        }
+        if (ret < 0) {
+            s->ret = ret;
+        }
+    }
+
+    g_free(buf);
+    s->running--;
+}
+
+static double bench_run(BenchState *s, int n)
+{
+    int i;
+
+    s->next = 0;
+    s->ret = 0;
+    s->running = n;
+
+    g_test_timer_start();
+    for (i = 0; i < n; i++) {
+        qemu_coroutine_enter(qemu_coroutine_create(bench_co, s));
+    }
+    while (s->running) {
+        aio_poll(qemu_get_aio_context(), true);
+    }
+    g_assert_cmpint(s->ret, ==, 0);
+
+    return IMAGE_SIZE / g_test_timer_elapsed() / (1024 * 1024);
+}
+
+static void test_compress_speed(gconstpointer opaque)
+{
+    bool compressed = GPOINTER_TO_INT(opaque);
+    BenchState s = { .compressed = compressed };
+    char *dir = g_dir_make_tmp("qcow2-compress-XXXXXX", NULL);
+    char *path = g_build_filename(dir, "test.qcow2", NULL);
+    int i;
+
+    g_assert(dir);
+    s.data = g_malloc(IMAGE_SIZE);
+    fill_data(s.data, IMAGE_SIZE);
+
+    for (i = 0; i < ARRAY_SIZE(in_flight); i++) {
+        double wr, rd;
+
+        bdrv_img_create(path, "qcow2", NULL, NULL, "cluster_size=64k",
+                        IMAGE_SIZE, 0, true, &error_abort);
+        s.blk = blk_new_open(path, NULL, NULL, BDRV_O_RDWR, &error_abort);
+
+        s.write = true;
+        wr = bench_run(&s, in_flight[i]);
+        s.write = false;
+        rd = bench_run(&s, in_flight[i]);
+
+        g_print("qcow2 %s: %2d in flight, write %.2f MB/s, read %.2f MB/s\n",
+                compressed ? "compressed" : "uncompressed", in_flight[i],
+                wr, rd);
+
+        blk_unref(s.blk);
+        unlink(path);
+    }
+
+    rmdir(dir);
+    g_free(path);
+    g_free(dir);
+    g_free(s.data);
+}
+
+int main(int argc, char **argv)
+{
+    qemu_init_main_loop(&error_abort);
+    bdrv_init();
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/qcow2/compress/speed/compressed",
+                         GINT_TO_POINTER(true), test_compress_speed);
+    g_test_add_data_func("/qcow2/compress/speed/uncompressed",
+                         GINT_TO_POINTER(false), test_compress_speed);
+    return g_test_run();
+}
@@ -0,0 +1,79 @@
+/*
+ * Xor Based Zero Run Length Encoding speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "../migration/xbzrle.h"
+
+#define PAGE_SIZE 4096
+#define N_PAGES   256
+
+/* Number of bytes changed in every 64 */
+static const int dirty_bytes[] = { 0, 1, 8, 32 };
+
+static void dirty_pages(uint8_t *old, uint8_t *new, int dirty)
+{
+    int i, j;
+
+    for (i = 0; i < PAGE_SIZE * N_PAGES; i++) {
+        old[i] = new[i] = g_test_rand_int();
+    }
+    for (i = 0; i < PAGE_SIZE * N_PAGES; i += 64) {
+        int start = g_test_rand_int_range(0, 64 - dirty + 1);
+
+        for (j = 0; j < dirty; j++) {
+            new[i + start + j] = ~old[i + start + j];
+        }
+    }
+}
+
+static void test_encode_speed(void)
+{
+    uint8_t *old = g_malloc(PAGE_SIZE * N_PAGES);
+    uint8_t *new = g_malloc(PAGE_SIZE * N_PAGES);
+    uint8_t *dst = g_malloc(PAGE_SIZE);
+    int accel = 0;
+    int d, i;
+
+    /* The fastest implementation comes first, the portable one last.  */
+    do {
+        for (d = 0; d < ARRAY_SIZE(dirty_bytes); d++) {
+            double total = 0.0;
+
+            dirty_pages(old, new, dirty_bytes[d]);
+
+            g_test_timer_start();
+            do {
+                for (i = 0; i < N_PAGES; i++) {
+                    xbzrle_encode_buffer(old + i * PAGE_SIZE,
+                                         new + i * PAGE_SIZE,
+                                         PAGE_SIZE, dst, PAGE_SIZE);
+                }
+                total += PAGE_SIZE * N_PAGES;
+            } while (g_test_timer_elapsed() < 2.0);
+
+            total /= 1024 * 1024; /* to MB */
+            g_print("xbzrle encode: accel %d, %d/64 bytes dirty ",
+                    accel, dirty_bytes[d]);
+            g_print("done: %.2f MB in %.2f secs: ", total,
+                    g_test_timer_last());
+            g_print("%.2f MB/sec\n", total / g_test_timer_last());
+        }
+        accel++;
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old);
+    g_free(new);
+    g_free(dst);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/xbzrle/encode/speed", test_encode_speed);
+
+    return g_test_run();
+}
@@ -0,0 +1,175 @@
+/*
+ * calc-dirty-rate and query-dirty-rate tests
+ *
+ * The guest RAM of a 'none' machine is only ever written through qtest, so
+ * the test knows exactly which pages changed while the rate was measured.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qemu/cutils.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qnum.h"
+#include "qapi/qmp/qlist.h"
+
+#define RAM_SIZE            (16 * 1024 * 1024)
+#define REGIONS             16
+#define REGION_SIZE         (RAM_SIZE / REGIONS)
+/* The first byte of each of these is dirtied, so they are distinct pages
+ * whatever the target page size.
+ */
+#define DIRTY_REGIONS       8
+#define TIMEOUT_SEC         60
+
+static const char *query_status(void)
+{
+    static char status[32];
+    QDict *rsp = qmp("{ 'execute': 'query-dirty-rate' }");
+    QDict *ret = qdict_get_qdict(rsp, "return");
+
+    g_assert(ret);
+    pstrcpy(status, sizeof(status), qdict_get_str(ret, "status"));
+    QDECREF(rsp);
+    return status;
+}
+
+/* Measure over one second with @sample_pages per GiB, dirtying the first
+ * page of DIRTY_REGIONS regions meanwhile.  Returns the "ram" block.
+ */
+static QDict *measure(int64_t sample_pages, QDict **rsp)
+{
+    const QListEntry *entry;
+    QDict *ret, *block = NULL;
+    int i;
+
+    ret = qmp("{ 'execute': 'calc-dirty-rate', 'arguments': {"
+              " 'calc-time': 1, 'sample-pages': %" PRId64 ","
+              " 'regions': %d } }", sample_pages, REGIONS);
+    g_assert(qdict_haskey(ret, "return"));
+    QDECREF(ret);
+    g_assert_cmpstr(query_status(), ==, "measuring");
+
+    /* Let the pages be hashed before they change */
+    g_usleep(G_USEC_PER_SEC / 4);
+    for (i = 0; i < DIRTY_REGIONS; i++) {
+        writeb(i * REGION_SIZE, 0xff);
+    }
+
+    for (i = 0; strcmp(query_status(), "measured"); i++) {
+        g_assert_cmpint(i, <, TIMEOUT_SEC * 10);
+        g_usleep(100 * 1000);
+    }
+
+    *rsp = qmp("{ 'execute': 'query-dirty-rate' }");
+    ret = qdict_get_qdict(*rsp, "return");
+    g_assert_cmpint(qdict_get_int(ret, "calc-time"), ==, 1);
+    g_assert(qdict_haskey(ret, "start-time"));
+    g_assert_cmpint(qdict_get_int(ret, "dirty-rate"), >=, 0);
+
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(ret, "blocks"), entry) {
+        QDict *b = qobject_to_qdict(qlist_entry_obj(entry));
+
+        if (!strcmp(qdict_get_str(b, "id"), "ram")) {
+            block = b;
+        }
+    }
+    g_assert(block);
+    g_assert_cmpint(qdict_get_int(block, "length"), ==, RAM_SIZE);
+    g_assert_cmpint(qlist_size(qdict_get_qlist(block, "heatmap")), ==,
+                    REGIONS);
+    return block;
+}
+
+static void test_dirtyrate_args(void)
+{
+    QDict *rsp;
+
+    qtest_start("-machine none -m 16");
+    g_assert_cmpstr(query_status(), ==, "unstarted");
+
+    rsp = qmp("{ 'execute': 'calc-dirty-rate',"
+              " 'arguments': { 'calc-time': 0 } }");
+    g_assert(qdict_haskey(rsp, "error"));
+    QDECREF(rsp);
+    rsp = qmp("{ 'execute': 'calc-dirty-rate',"
+              " 'arguments': { 'calc-time': 1, 'regions': 1025 } }");
+    g_assert(qdict_haskey(rsp, "error"));
+    QDECREF(rsp);
+    g_assert_cmpstr(query_status(), ==, "unstarted");
+
+    qtest_end();
+}
+
+/* Every page is sampled exactly once, so the dirty pages are counted
+ * exactly and the estimate is exact too.
+ */
+static void test_dirtyrate_all_pages(void)
+{
+    const QListEntry *entry;
+    QDict *rsp, *block;
+    int64_t sampled;
+    int r = 0;
+
+    qtest_start("-machine none -m 16");
+    block = measure(1 << 20, &rsp);
+
+    sampled = qdict_get_int(block, "sampled-pages");
+    g_assert_cmpint(RAM_SIZE % sampled, ==, 0);
+    g_assert_cmpint(qdict_get_int(block, "dirty-pages"), ==, DIRTY_REGIONS);
+    g_assert_cmpint(qdict_get_int(block, "dirty-bytes"), ==,
+                    DIRTY_REGIONS * (RAM_SIZE / sampled));
+
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(block, "heatmap"), entry) {
+        int64_t heat = qnum_get_int(qobject_to_qnum(qlist_entry_obj(entry)));
+
+        if (r++ >= DIRTY_REGIONS) {
+            g_assert_cmpint(heat, ==, 0);
+        }
+    }
+
+    QDECREF(rsp);
+    qtest_end();
+}
+
+/* 16 samples per region, spread over it, so the first page of a region is
+ * not necessarily among them but no sample is counted twice.
+ */
+static void test_dirtyrate_sampled(void)
+{
+    const QListEntry *entry;
+    QDict *rsp, *block;
+    int r = 0;
+
+    qtest_start("-machine none -m 16");
+    block = measure(REGIONS * 1024, &rsp);
+
+    g_assert_cmpint(qdict_get_int(block, "sampled-pages"), ==, REGIONS * 16);
+    g_assert_cmpint(qdict_get_int(block, "dirty-pages"), <=, DIRTY_REGIONS);
+
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(block, "heatmap"), entry) {
+        int64_t heat = qnum_get_int(qobject_to_qnum(qlist_entry_obj(entry)));
+
+        if (r++ < DIRTY_REGIONS) {
+            g_assert(heat == 0 || heat == 100 / 16);
+        } else {
+            g_assert_cmpint(heat, ==, 0);
+        }
+    }
+
+    QDECREF(rsp);
+    qtest_end();
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/dirtyrate/args", test_dirtyrate_args);
+    qtest_add_func("/dirtyrate/all-pages", test_dirtyrate_all_pages);
+    qtest_add_func("/dirtyrate/sampled", test_dirtyrate_sampled);
+
+    return g_test_run();
+}
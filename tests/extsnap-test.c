@@ -0,0 +1,434 @@
+/*
+ * External snapshot tests
+ *
+ * Starts a RAM-only machine (-machine none) on top of a scratch disk and
+ * drives savevm-ext, loadvm-ext and squash-ext through QMP.  The disk is
+ * written and checked with the qemu-io HMP command, since there is no guest
+ * to do it.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+#define TEST_BASE       "base.raw"
+#define TEST_DISK_SIZE  (1024 * 1024)
+
+static char *tmpdir;
+
+static char *snap_file(const char *name)
+{
+    return g_strdup_printf("%s/%s/%s-sn", tmpdir, name, TEST_BASE);
+}
+
+/* Snapshot commands stop and resume the VM, so events may come before the
+ * response of any command
+ */
+static QDict *skip_events(QDict *rsp)
+{
+    while (qdict_haskey(rsp, "event")) {
+        QDECREF(rsp);
+        rsp = qmp_receive();
+    }
+    return rsp;
+}
+
+static void snap_cmd(const char *cmd, const char *name)
+{
+    QDict *rsp = skip_events(qmp("{ 'execute': %s, "
+                                 "  'arguments': { 'name': %s } }",
+                                 cmd, name));
+
+    if (qdict_haskey(rsp, "error")) {
+        fprintf(stderr, "%s %s: %s\n", cmd, name,
+                qdict_get_str(qdict_get_qdict(rsp, "error"), "desc"));
+        g_assert_not_reached();
+    }
+    QDECREF(rsp);
+}
+
+/* Run a qemu-io command on the disk, which must succeed */
+static void disk_io(const char *cmd)
+{
+    char *out = hmp("qemu-io disk0 \"%s\"", cmd);
+
+    if (strstr(out, "fail")) {
+        fprintf(stderr, "qemu-io %s: %s\n", cmd, out);
+        g_assert_not_reached();
+    }
+    g_free(out);
+}
+
+static char *file_checksum(const char *path)
+{
+    gchar *contents;
+    gsize len;
+    char *sum;
+
+    g_assert(g_file_get_contents(path, &contents, &len, NULL));
+    sum = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (guchar *)contents,
+                                      len);
+    g_free(contents);
+    return sum;
+}
+
+/* Snapshot paths are built with doubled slashes, so compare files rather
+ * than names
+ */
+static bool same_file(const char *a, const char *b)
+{
+    struct stat sa, sb;
+
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 &&
+           sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+static bool block_jobs_running(void)
+{
+    QDict *rsp = skip_events(qmp("{ 'execute': 'query-block-jobs' }"));
+    bool running;
+
+    running = !qlist_empty(qdict_get_qlist(rsp, "return"));
+    QDECREF(rsp);
+    return running;
+}
+
+/* The ImageInfo of the disk in the query-block response @rsp */
+static QDict *disk_image(QDict *rsp)
+{
+    QListEntry *entry;
+
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(rsp, "return"), entry) {
+        QDict *dev = qobject_to_qdict(qlist_entry_obj(entry));
+
+        if (!strcmp(qdict_get_str(dev, "device"), "disk0")) {
+            return qdict_get_qdict(qdict_get_qdict(dev, "inserted"), "image");
+        }
+    }
+    g_assert_not_reached();
+}
+
+/* The backing chain of the disk, from the active image down, as a list of
+ * file names
+ */
+static GPtrArray *disk_chain(void)
+{
+    GPtrArray *chain = g_ptr_array_new_with_free_func(g_free);
+    QDict *rsp = skip_events(qmp("{ 'execute': 'query-block' }"));
+    QDict *image;
+
+    for (image = disk_image(rsp); image;
+         image = qdict_get_qdict(image, "backing-image")) {
+        g_ptr_array_add(chain, g_strdup(qdict_get_str(image, "filename")));
+    }
+    QDECREF(rsp);
+    return chain;
+}
+
+/* The node name of the qcow2 node open on @file */
+static char *format_node_name(const char *file)
+{
+    QDict *rsp = skip_events(qmp("{ 'execute': 'query-named-block-nodes' }"));
+    QListEntry *entry;
+    char *name = NULL;
+
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(rsp, "return"), entry) {
+        QDict *node = qobject_to_qdict(qlist_entry_obj(entry));
+
+        if (!strcmp(qdict_get_str(node, "drv"), "qcow2") &&
+            same_file(qdict_get_str(node, "file"), file)) {
+            g_assert(name == NULL);
+            name = g_strdup(qdict_get_str(node, "node-name"));
+        }
+    }
+    QDECREF(rsp);
+    g_assert(name);
+    return name;
+}
+
+static void remove_tree(const char *path)
+{
+    GDir *dir = g_dir_open(path, 0, NULL);
+    const char *name;
+
+    if (!dir) {
+        unlink(path);
+        return;
+    }
+    while ((name = g_dir_read_name(dir))) {
+        char *child = g_build_filename(path, name, NULL);
+
+        remove_tree(child);
+        g_free(child);
+    }
+    g_dir_close(dir);
+    rmdir(path);
+}
+
+static void extsnap_start(void)
+{
+    char *base = g_build_filename(tmpdir, TEST_BASE, NULL);
+    char *cli;
+    int fd;
+
+    fd = open(base, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    g_assert(fd >= 0);
+    g_assert_cmpint(ftruncate(fd, TEST_DISK_SIZE), ==, 0);
+    close(fd);
+
+    cli = g_strdup_printf("-machine none -m 16M -exton "
+                          "-drive if=none,id=disk0,format=raw,file=%s",
+                          base);
+    qtest_start(cli);
+    g_free(cli);
+    g_free(base);
+}
+
+static void extsnap_end(void)
+{
+    qtest_end();
+    remove_tree(tmpdir);
+    g_assert_cmpint(mkdir(tmpdir, 0700), ==, 0);
+}
+
+/* Overlays are created with 4k clusters */
+static void test_overlay_cluster_size(void)
+{
+    QDict *rsp, *image;
+
+    extsnap_start();
+    snap_cmd("savevm-ext", "s0");
+
+    rsp = skip_events(qmp("{ 'execute': 'query-block' }"));
+    image = disk_image(rsp);
+    g_assert_cmpstr(qdict_get_str(image, "format"), ==, "qcow2");
+    g_assert_cmpint(qdict_get_int(image, "cluster-size"), ==, 4096);
+    QDECREF(rsp);
+
+    extsnap_end();
+}
+
+static int64_t file_size(const char *path)
+{
+    struct stat st;
+
+    g_assert_cmpint(stat(path, &st), ==, 0);
+    return st.st_size;
+}
+
+/* Loading a snapshot drops what was written after it.  The new overlay is a
+ * clone of the template saved with the snapshot, which stays pristine; a
+ * snapshot without a template gets a new overlay.
+ */
+static void test_revert(void)
+{
+    char *template, *sum, *sum_after, *sn0, *node, *node_after;
+    char marker[4096];
+    GPtrArray *chain;
+    int64_t size;
+    FILE *f;
+
+    extsnap_start();
+
+    disk_io("write -P 0x11 0 64k");
+    snap_cmd("savevm-ext", "s0");
+    disk_io("write -P 0x22 0 64k");
+    disk_io("write -P 0x33 64k 64k");
+
+    /* qcow2 ignores data past its clusters, so mark the template there
+     * to recognize its clones
+     */
+    template = g_strdup_printf("%s/s0/%s-sn.overlay", tmpdir, TEST_BASE);
+    memset(marker, 0x5a, sizeof(marker));
+    f = fopen(template, "a");
+    g_assert(f);
+    g_assert_cmpint(fwrite(marker, 1, sizeof(marker), f), ==, sizeof(marker));
+    fclose(f);
+    size = file_size(template);
+    sum = file_checksum(template);
+    sn0 = snap_file("s0");
+    node = format_node_name(sn0);
+
+    /* The layer of s0 stays open across the revert */
+    snap_cmd("loadvm-ext", "s0");
+    chain = disk_chain();
+    g_assert_cmpint(chain->len, ==, 3);
+    g_assert_cmpint(file_size(g_ptr_array_index(chain, 0)), ==, size);
+    g_assert(same_file(g_ptr_array_index(chain, 1), sn0));
+    g_ptr_array_free(chain, true);
+    node_after = format_node_name(sn0);
+    g_assert_cmpstr(node_after, ==, node);
+    g_free(node_after);
+    disk_io("read -P 0x11 0 64k");
+    disk_io("read -P 0 64k 64k");
+
+    /* Again, with the revert writing to the clone */
+    disk_io("write -P 0x44 0 128k");
+    snap_cmd("loadvm-ext", "s0");
+    disk_io("read -P 0x11 0 64k");
+    disk_io("read -P 0 64k 64k");
+
+    sum_after = file_checksum(template);
+    g_assert_cmpstr(sum_after, ==, sum);
+    g_free(sum_after);
+
+    g_assert_cmpint(unlink(template), ==, 0);
+    disk_io("write -P 0x55 0 128k");
+    snap_cmd("loadvm-ext", "s0");
+    disk_io("read -P 0x11 0 64k");
+    disk_io("read -P 0 64k 64k");
+
+    g_free(node);
+    g_free(sn0);
+    g_free(sum);
+    g_free(template);
+
+    extsnap_end();
+}
+
+/* Squash s0..s2 and check that the snapshots inside the range and the one
+ * saved after it all load with their own disk contents, while the images
+ * of the squashed snapshots stay as they were.
+ */
+static void test_squash(void)
+{
+    char *files[3], *sums[3];
+    char *squash, *sn3, *backing, *chain_file;
+    GPtrArray *chain, *after;
+    QDict *rsp;
+    int i;
+
+    extsnap_start();
+
+    disk_io("write -P 0x11 0 64k");
+    snap_cmd("savevm-ext", "s0");
+    disk_io("write -P 0x22 64k 64k");
+    snap_cmd("savevm-ext", "s1");
+    disk_io("write -P 0x33 128k 64k");
+    snap_cmd("savevm-ext", "s2");
+    for (i = 0; i < 3; i++) {
+        char *name = g_strdup_printf("s%d", i);
+
+        files[i] = snap_file(name);
+        sums[i] = file_checksum(files[i]);
+        g_free(name);
+    }
+
+    /* Only the newest snapshot can be the top of the range */
+    rsp = skip_events(qmp("{ 'execute': 'squash-ext',"
+                          "  'arguments': { 'top': 's1' } }"));
+    g_assert(qdict_haskey(rsp, "error"));
+    QDECREF(rsp);
+
+    /* A job that cannot start leaves the chain and the files as they were */
+    squash = g_strdup_printf("%s-squash", files[2]);
+    chain = disk_chain();
+    rsp = skip_events(qmp("{ 'execute': 'query-block' }"));
+    backing = g_strdup(qdict_get_str(disk_image(rsp), "backing-filename"));
+    QDECREF(rsp);
+    rsp = skip_events(qmp("{ 'execute': 'squash-ext',"
+                          "  'arguments': { 'top': 's2',"
+                          "                 'job-id': '#bad' } }"));
+    g_assert(qdict_haskey(rsp, "error"));
+    QDECREF(rsp);
+    after = disk_chain();
+    g_assert_cmpint(after->len, ==, chain->len);
+    for (i = 0; i < chain->len; i++) {
+        g_assert_cmpstr(g_ptr_array_index(after, i), ==,
+                        g_ptr_array_index(chain, i));
+    }
+    g_ptr_array_free(after, true);
+    g_ptr_array_free(chain, true);
+    rsp = skip_events(qmp("{ 'execute': 'query-block' }"));
+    g_assert_cmpstr(qdict_get_str(disk_image(rsp), "backing-filename"), ==,
+                    backing);
+    QDECREF(rsp);
+    g_free(backing);
+    chain_file = g_strdup_printf("%s.chain", squash);
+    g_assert(!g_file_test(squash, G_FILE_TEST_EXISTS));
+    g_assert(!g_file_test(chain_file, G_FILE_TEST_EXISTS));
+    g_free(chain_file);
+
+    rsp = skip_events(qmp("{ 'execute': 'squash-ext',"
+                          "  'arguments': { 'top': 's2' } }"));
+    g_assert(qdict_haskey(rsp, "return"));
+    QDECREF(rsp);
+    while (block_jobs_running()) {
+        g_usleep(10 * 1000);
+    }
+
+    disk_io("write -P 0x44 192k 64k");
+    snap_cmd("savevm-ext", "s3");
+
+    /* s3 builds on the merged image, which sits right on the base */
+    sn3 = snap_file("s3");
+    chain = disk_chain();
+    g_assert_cmpint(chain->len, ==, 4);
+    g_assert(same_file(g_ptr_array_index(chain, 1), sn3));
+    g_assert(same_file(g_ptr_array_index(chain, 2), squash));
+    g_ptr_array_free(chain, true);
+
+    snap_cmd("loadvm-ext", "s1");
+    disk_io("read -P 0x11 0 64k");
+    disk_io("read -P 0x22 64k 64k");
+    disk_io("read -P 0 128k 128k");
+
+    snap_cmd("loadvm-ext", "s3");
+    disk_io("read -P 0x11 0 64k");
+    disk_io("read -P 0x22 64k 64k");
+    disk_io("read -P 0x33 128k 64k");
+    disk_io("read -P 0x44 192k 64k");
+
+    snap_cmd("loadvm-ext", "s2");
+    disk_io("read -P 0x33 128k 64k");
+    disk_io("read -P 0 192k 64k");
+    chain = disk_chain();
+    g_assert_cmpint(chain->len, ==, 5);
+    g_assert(same_file(g_ptr_array_index(chain, 1), files[2]));
+    g_ptr_array_free(chain, true);
+
+    for (i = 0; i < 3; i++) {
+        char *sum = file_checksum(files[i]);
+
+        g_assert_cmpstr(sum, ==, sums[i]);
+        g_free(sum);
+        g_free(sums[i]);
+        g_free(files[i]);
+    }
+    g_free(squash);
+    g_free(sn3);
+
+    extsnap_end();
+}
+
+int main(int argc, char **argv)
+{
+    char *pigz;
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    /* savevm-ext compresses the RAM state through pigz */
+    pigz = g_find_program_in_path("pigz");
+    if (!pigz) {
+        g_test_message("pigz not found; skipping extsnap tests");
+        return 0;
+    }
+    g_free(pigz);
+
+    tmpdir = g_dir_make_tmp("extsnap-test-XXXXXX", NULL);
+    g_assert(tmpdir);
+
+    qtest_add_func("/extsnap/overlay-cluster-size", test_overlay_cluster_size);
+    qtest_add_func("/extsnap/revert", test_revert);
+    qtest_add_func("/extsnap/squash", test_squash);
+
+    ret = g_test_run();
+
+    remove_tree(tmpdir);
+    g_free(tmpdir);
+
+    return ret;
+}
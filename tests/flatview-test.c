@@ -0,0 +1,105 @@
+/*
+ * FlatView rendering benchmark
+ *
+ * Boots a PC with a bunch of PCI devices and then programs their BARs the
+ * way firmware would, reporting how many FlatViews were rendered and how
+ * long it took, both during machine creation and for the BAR updates.
+ * Run with -m perf to get the numbers printed.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "libqos/pci-pc.h"
+#include "hw/pci/pci_ids.h"
+
+#define NR_DEVICES 24
+
+#define E1000_DEVICE_ID 0x100e
+
+typedef struct FlatViewStats {
+    unsigned renders;
+    unsigned reuses;
+    unsigned commits;
+    unsigned long us;
+} FlatViewStats;
+
+static void get_stats(FlatViewStats *st)
+{
+    char *s = hmp("info mtree -f");
+    char *p = strstr(s, "FlatView renders:");
+
+    g_assert(p);
+    g_assert_cmpint(sscanf(p, "FlatView renders: %u, reused: %u, "
+                           "commits: %u, render time: %lu us",
+                           &st->renders, &st->reuses, &st->commits,
+                           &st->us), ==, 4);
+    g_free(s);
+}
+
+static void print_stats(const char *what, FlatViewStats *from,
+                        FlatViewStats *to)
+{
+    if (g_test_perf()) {
+        g_test_message("%s: %u commits, %u renders, %u reused, %lu us",
+                       what, to->commits - from->commits,
+                       to->renders - from->renders,
+                       to->reuses - from->reuses, to->us - from->us);
+    }
+}
+
+static void map_bars(QPCIDevice *dev, int devfn, void *data)
+{
+    int *count = data;
+
+    qpci_device_enable(dev);
+    qpci_iomap(dev, 0, NULL);
+    qpci_iomap(dev, 1, NULL);
+    (*count)++;
+    g_free(dev);
+}
+
+static void test_flatview_bars(void)
+{
+    FlatViewStats zero = { 0 }, boot, bars;
+    GString *cli = g_string_new("-machine pc -net none");
+    QPCIBus *pcibus;
+    int i, count = 0;
+
+    for (i = 0; i < NR_DEVICES; i++) {
+        g_string_append(cli, " -device e1000");
+    }
+    qtest_start(cli->str);
+    g_string_free(cli, true);
+
+    get_stats(&boot);
+    print_stats("boot", &zero, &boot);
+
+    pcibus = qpci_init_pc(NULL);
+    qpci_device_foreach(pcibus, PCI_VENDOR_ID_INTEL, E1000_DEVICE_ID,
+                        map_bars, &count);
+    g_assert_cmpint(count, ==, NR_DEVICES);
+
+    get_stats(&bars);
+    print_stats("BAR programming", &boot, &bars);
+
+    /* Mapping a BAR must not render the views it does not appear in,
+     * e.g. the I/O space view for a memory BAR.
+     */
+    g_assert_cmpuint(bars.commits, >, boot.commits);
+    g_assert_cmpuint(bars.reuses, >, boot.reuses);
+
+    qpci_free_pc(pcibus);
+    qtest_end();
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/flatview/bars", test_flatview_bars);
+
+    return g_test_run();
+}
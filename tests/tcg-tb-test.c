@@ -0,0 +1,228 @@
+/*
+ * TCG translation block tests
+ *
+ * Boots small raw aarch64 programs on the virt board and checks how their
+ * code was translated, from the translate_block trace events logged with
+ * -d trace:translate_block.  The programs write 1 to a flag word in RAM
+ * once they are done, which the test polls through qtest.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+/* Where the virt board loads a raw -kernel image */
+#define GUEST_LOAD_ADDR     0x40080000ULL
+#define GUEST_TIMEOUT_SEC   120
+
+static char *tmpdir;
+
+/* Start a virt machine running @code, with @args appended to the command
+ * line.  Returns the name of the file translate_block events are logged to.
+ */
+static char *guest_start(const uint32_t *code, size_t n_insns,
+                         const char *args)
+{
+    char *kernel = g_strdup_printf("%s/kernel.bin", tmpdir);
+    char *log = g_strdup_printf("%s/trace.log", tmpdir);
+    uint32_t *buf = g_new(uint32_t, n_insns);
+    char *cmd;
+    size_t i;
+
+    for (i = 0; i < n_insns; i++) {
+        buf[i] = cpu_to_le32(code[i]);
+    }
+    g_assert(g_file_set_contents(kernel, (char *)buf,
+                                 n_insns * sizeof(*buf), NULL));
+    unlink(log);
+
+    cmd = g_strdup_printf("-machine virt,accel=tcg -cpu cortex-a57 -m 256 "
+                          "-kernel %s -d trace:translate_block -D %s %s",
+                          kernel, log, args);
+    qtest_start(cmd);
+    /* The image is copied into the ROM blob list when the machine starts */
+    unlink(kernel);
+
+    g_free(cmd);
+    g_free(buf);
+    g_free(kernel);
+    return log;
+}
+
+static void guest_wait(uint64_t flag_addr)
+{
+    int i;
+
+    for (i = 0; i < GUEST_TIMEOUT_SEC * 10; i++) {
+        if (readl(flag_addr) == 1) {
+            return;
+        }
+        g_usleep(100 * 1000);
+    }
+    g_assert_not_reached();
+}
+
+/* Stop the guest and return the highest number of times any guest pc in
+ * [@start, @end) was translated, or -1 if nothing was logged at all, which
+ * happens when QEMU was built without the log trace backend.
+ */
+static int guest_end(char *log, uint64_t start, uint64_t end)
+{
+    int *counts = g_new0(int, (end - start) / 4);
+    bool logged = false;
+    char line[256];
+    int max = 0;
+    FILE *f;
+
+    qtest_end();
+
+    f = fopen(log, "r");
+    g_assert(f);
+    while (fgets(line, sizeof(line), f)) {
+        const char *p = strstr(line, ":translate_block ");
+        uint64_t pc;
+
+        if (!p) {
+            continue;
+        }
+        logged = true;
+        p = strstr(p, "pc:0x");
+        g_assert(p);
+        pc = g_ascii_strtoull(p + 5, NULL, 16);
+        if (pc >= start && pc < end) {
+            max = MAX(max, ++counts[(pc - start) / 4]);
+        }
+    }
+    fclose(f);
+
+    unlink(log);
+    g_free(counts);
+    g_free(log);
+    return logged ? max : -1;
+}
+
+static unsigned tb_evict_count(void)
+{
+    char *info = hmp("info jit");
+    const char *p = strstr(info, "TB evict count");
+    unsigned count;
+
+    g_assert(p);
+    g_assert_cmpint(sscanf(p, "TB evict count %u", &count), ==, 1);
+    g_free(info);
+    return count;
+}
+
+/*
+ * A hot loop that only ever jumps to itself through a chained goto_tb,
+ * interleaved with calls into 2048 chunks of cold code of 64 TBs each.  The
+ * cold code overflows a 16 MiB code_gen_buffer, but the region holding the
+ * hot loop runs between every pair of evictions and must never be the one
+ * reclaimed, so none of the program's own code is translated twice.
+ */
+#define REGION_FLAG_ADDR    0x40180000ULL
+
+static const uint32_t region_code[] = {
+    0xd2a80206, /* mov   x6, #0x40100000 */
+    0xaa0603e1, /* mov   x1, x6 */
+    0x52800025, /* mov   w5, #1 */
+    0x72a28005, /* movk  w5, #0x1400, lsl #16    w5 = "b .+4" */
+    0x52807808, /* mov   w8, #0x3c0 */
+    0x72bacbe8, /* movk  w8, #0xd65f, lsl #16    w8 = "ret" */
+    0xd2810007, /* mov   x7, #2048 */
+    0xd28007e9, /* 1: mov x9, #63 */
+    0xb80044c5, /* 2: str w5, [x6], #4 */
+    0xf1000529, /* subs  x9, x9, #1 */
+    0x54ffffc1, /* b.ne  2b */
+    0xb80044c8, /* str   w8, [x6], #4 */
+    0xf10004e7, /* subs  x7, x7, #1 */
+    0x54ffff41, /* b.ne  1b */
+    0xd2807d03, /* 3: mov x3, #1000 */
+    0x91000484, /* 4: add x4, x4, #1 */
+    0xf1000463, /* subs  x3, x3, #1 */
+    0x54ffffc1, /* b.ne  4b */
+    0xd63f0020, /* blr   x1 */
+    0x91040021, /* add   x1, x1, #256 */
+    0xeb06003f, /* cmp   x1, x6 */
+    0x54ffff21, /* b.ne  3b */
+    0x5280002b, /* mov   w11, #1 */
+    0xb90000cb, /* str   w11, [x6]               x6 = REGION_FLAG_ADDR */
+    0x14000000, /* 5: b 5b */
+};
+
+static void test_region_keeps_hot_loop(void)
+{
+    char *log;
+    int max;
+
+    log = guest_start(region_code, ARRAY_SIZE(region_code), "-tb-size 16");
+    guest_wait(REGION_FLAG_ADDR);
+    g_assert_cmpuint(tb_evict_count(), >, 0);
+
+    max = guest_end(log, GUEST_LOAD_ADDR,
+                    GUEST_LOAD_ADDR + sizeof(region_code));
+    if (max < 0) {
+        g_test_message("translate_block not logged; skipping check");
+        return;
+    }
+    g_assert_cmpint(max, ==, 1);
+}
+
+/*
+ * A loop whose TB ends in a forward conditional branch to the next page.
+ * Superblocks never cross a page, so that TB must not count its executions
+ * and ask to be retranslated as one, however hot it is.
+ */
+#define CROSS_PAGE_LOOP      0xff0
+#define CROSS_PAGE_FAR       0x1000
+#define CROSS_PAGE_FLAG_ADDR 0x40100000ULL
+
+static void test_trace_cross_page(void)
+{
+    uint32_t code[(CROSS_PAGE_FAR + 16) / 4] = {
+        0xd2807d03, /* mov   x3, #1000 */
+        0x140003fb, /* b     loop */
+    };
+    char *log;
+    int max;
+
+    code[CROSS_PAGE_LOOP / 4] = 0xf1000463;     /* loop: subs x3, x3, #1 */
+    code[CROSS_PAGE_LOOP / 4 + 1] = 0x54000060; /* b.eq  far */
+    code[CROSS_PAGE_LOOP / 4 + 2] = 0x17fffffe; /* b     loop */
+    code[CROSS_PAGE_FAR / 4] = 0x5280002b;      /* far: mov w11, #1 */
+    code[CROSS_PAGE_FAR / 4 + 1] = 0xd2a80206;  /* mov   x6, #0x40100000 */
+    code[CROSS_PAGE_FAR / 4 + 2] = 0xb90000cb;  /* str   w11, [x6] */
+    code[CROSS_PAGE_FAR / 4 + 3] = 0x14000000;  /* 1: b 1b */
+
+    log = guest_start(code, ARRAY_SIZE(code), "");
+    guest_wait(CROSS_PAGE_FLAG_ADDR);
+
+    max = guest_end(log, GUEST_LOAD_ADDR, GUEST_LOAD_ADDR + sizeof(code));
+    if (max < 0) {
+        g_test_message("translate_block not logged; skipping check");
+        return;
+    }
+    g_assert_cmpint(max, ==, 1);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    tmpdir = g_dir_make_tmp("tcg-tb-test-XXXXXX", NULL);
+    g_assert(tmpdir);
+
+    qtest_add_func("/tcg/region/keeps-hot-loop", test_region_keeps_hot_loop);
+    qtest_add_func("/tcg/trace/cross-page", test_trace_cross_page);
+
+    ret = g_test_run();
+
+    rmdir(tmpdir);
+    g_free(tmpdir);
+
+    return ret;
+}
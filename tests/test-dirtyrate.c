@@ -0,0 +1,82 @@
+/*
+ * Dirty page rate sampling unit tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "../migration/dirtyrate.h"
+
+static void check_samples(uint64_t len, uint64_t n, uint64_t offset)
+{
+    uint64_t i, page, prev = 0;
+
+    for (i = 0; i < n; i++) {
+        page = dirty_rate_sample_page(len, n, i, offset);
+        g_assert_cmpuint(page, <, len);
+        if (i) {
+            g_assert_cmpuint(page, >, prev);
+        }
+        prev = page;
+    }
+}
+
+static void test_sample_distinct(void)
+{
+    static const uint64_t sizes[][2] = {
+        { 1, 1 }, { 2, 1 }, { 7, 3 }, { 100, 99 }, { 256, 16 },
+        { 4097, 64 }, { 1ULL << 40, 1 << 20 },
+    };
+    int i, j;
+
+    for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+        uint64_t len = sizes[i][0], n = sizes[i][1];
+
+        check_samples(len, n, 0);
+        check_samples(len, n, len - 1);
+        for (j = 0; j < 16; j++) {
+            check_samples(len, n,
+                          g_test_rand_int_range(0, MIN(len, INT32_MAX)));
+        }
+    }
+}
+
+/* Sampling a whole region takes every page of it once */
+static void test_sample_all(void)
+{
+    uint64_t i, offset;
+
+    for (offset = 0; offset < 64; offset++) {
+        for (i = 0; i < 64; i++) {
+            g_assert_cmpuint(dirty_rate_sample_page(64, 64, i, offset), ==, i);
+        }
+    }
+}
+
+/* Over all offsets, every page of the region is sampled equally often */
+static void test_sample_uniform(void)
+{
+    uint64_t len = 60, n = 7, i, offset;
+    int counts[60] = { 0 };
+
+    for (offset = 0; offset < len; offset++) {
+        for (i = 0; i < n; i++) {
+            counts[dirty_rate_sample_page(len, n, i, offset)]++;
+        }
+    }
+    for (i = 0; i < len; i++) {
+        g_assert_cmpint(counts[i], ==, n);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/dirtyrate/sample/distinct", test_sample_distinct);
+    g_test_add_func("/dirtyrate/sample/all", test_sample_all);
+    g_test_add_func("/dirtyrate/sample/uniform", test_sample_uniform);
+
+    return g_test_run();
+}
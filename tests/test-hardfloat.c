@@ -0,0 +1,234 @@
+/*
+ * Host FPU fast path test for softfloat
+ *
+ * Every operation is computed twice: once with the inexact flag clear, which
+ * forces the software implementation, and once with it set, which allows the
+ * host FPU to be used.  Results and exception flags must be identical.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "fpu/softfloat.h"
+
+#define N_ITER 200000
+
+enum {
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MULADD,
+    OP_SQRT,
+};
+
+typedef struct TestMode {
+    int rounding_mode;
+    int tininess;
+    flag flush_to_zero;
+} TestMode;
+
+static const TestMode modes[] = {
+    { float_round_nearest_even, float_tininess_before_rounding, 0 },
+    { float_round_nearest_even, float_tininess_after_rounding, 0 },
+    { float_round_nearest_even, float_tininess_before_rounding, 1 },
+    { float_round_to_zero, float_tininess_before_rounding, 0 },
+};
+
+static void init_status(float_status *s, const TestMode *m, bool inexact)
+{
+    memset(s, 0, sizeof(*s));
+    set_float_rounding_mode(m->rounding_mode, s);
+    set_float_detect_tininess(m->tininess, s);
+    set_flush_to_zero(m->flush_to_zero, s);
+    set_flush_inputs_to_zero(m->flush_to_zero, s);
+    s->float_exception_flags = inexact ? float_flag_inexact : 0;
+}
+
+/* Mostly normal operands, with exponents spread over the whole range so
+ * that overflow and underflow are exercised, plus the odd special value.
+ */
+static uint32_t rand_f32(void)
+{
+    static const uint32_t specials[] = {
+        0x00000000, 0x80000000, 0x00000001, 0x007fffff, 0x00800000,
+        0x7f7fffff, 0x7f800000, 0xff800000, 0x7fc00000, 0x7f800001,
+        0x3f800000, 0xbf800000,
+    };
+    uint32_t r = g_test_rand_int();
+
+    if ((r & 0xff) == 0) {
+        return specials[g_test_rand_int_range(0, ARRAY_SIZE(specials))];
+    }
+    return r;
+}
+
+static uint64_t rand_f64(void)
+{
+    static const uint64_t specials[] = {
+        0x0000000000000000ULL, 0x8000000000000000ULL, 0x0000000000000001ULL,
+        0x000fffffffffffffULL, 0x0010000000000000ULL, 0x7fefffffffffffffULL,
+        0x7ff0000000000000ULL, 0xfff0000000000000ULL, 0x7ff8000000000000ULL,
+        0x7ff0000000000001ULL, 0x3ff0000000000000ULL, 0xbff0000000000000ULL,
+    };
+    uint64_t r = ((uint64_t)g_test_rand_int() << 32) | g_test_rand_int();
+
+    if ((r & 0xff) == 0) {
+        return specials[g_test_rand_int_range(0, ARRAY_SIZE(specials))];
+    }
+    return r;
+}
+
+static float32 do_op32(int op, float32 a, float32 b, float32 c, int flags,
+                       float_status *s)
+{
+    switch (op) {
+    case OP_ADD:
+        return float32_add(a, b, s);
+    case OP_SUB:
+        return float32_sub(a, b, s);
+    case OP_MUL:
+        return float32_mul(a, b, s);
+    case OP_DIV:
+        return float32_div(a, b, s);
+    case OP_MULADD:
+        return float32_muladd(a, b, c, flags, s);
+    case OP_SQRT:
+        return float32_sqrt(a, s);
+    }
+    g_assert_not_reached();
+}
+
+static float64 do_op64(int op, float64 a, float64 b, float64 c, int flags,
+                       float_status *s)
+{
+    switch (op) {
+    case OP_ADD:
+        return float64_add(a, b, s);
+    case OP_SUB:
+        return float64_sub(a, b, s);
+    case OP_MUL:
+        return float64_mul(a, b, s);
+    case OP_DIV:
+        return float64_div(a, b, s);
+    case OP_MULADD:
+        return float64_muladd(a, b, c, flags, s);
+    case OP_SQRT:
+        return float64_sqrt(a, s);
+    }
+    g_assert_not_reached();
+}
+
+static void test_f32(gconstpointer opaque)
+{
+    int op = GPOINTER_TO_INT(opaque);
+    int i, m;
+
+    for (m = 0; m < ARRAY_SIZE(modes); m++) {
+        for (i = 0; i < N_ITER; i++) {
+            float32 a = make_float32(rand_f32());
+            float32 b = make_float32(rand_f32());
+            float32 c = make_float32(rand_f32());
+            int flags = g_test_rand_int_range(0, 16);
+            float_status soft, hard;
+            float32 rs, rh;
+
+            init_status(&soft, &modes[m], false);
+            init_status(&hard, &modes[m], true);
+            if (op == OP_MULADD && g_test_rand_bit()) {
+                /* Make cancellation likely.  */
+                float_status tmp = soft;
+
+                c = float32_chs(float32_mul(a, b, &tmp));
+            }
+            rs = do_op32(op, a, b, c, flags, &soft);
+            rh = do_op32(op, a, b, c, flags, &hard);
+
+            g_assert_cmphex(float32_val(rs), ==, float32_val(rh));
+            g_assert_cmphex(soft.float_exception_flags | float_flag_inexact,
+                            ==, hard.float_exception_flags);
+        }
+    }
+}
+
+static void test_f64(gconstpointer opaque)
+{
+    int op = GPOINTER_TO_INT(opaque);
+    int i, m;
+
+    for (m = 0; m < ARRAY_SIZE(modes); m++) {
+        for (i = 0; i < N_ITER; i++) {
+            float64 a = make_float64(rand_f64());
+            float64 b = make_float64(rand_f64());
+            float64 c = make_float64(rand_f64());
+            int flags = g_test_rand_int_range(0, 16);
+            float_status soft, hard;
+            float64 rs, rh;
+
+            init_status(&soft, &modes[m], false);
+            init_status(&hard, &modes[m], true);
+            if (op == OP_MULADD && g_test_rand_bit()) {
+                /* Make cancellation likely.  */
+                float_status tmp = soft;
+
+                c = float64_chs(float64_mul(a, b, &tmp));
+            }
+            rs = do_op64(op, a, b, c, flags, &soft);
+            rh = do_op64(op, a, b, c, flags, &hard);
+
+            g_assert_cmphex(float64_val(rs), ==, float64_val(rh));
+            g_assert_cmphex(soft.float_exception_flags | float_flag_inexact,
+                            ==, hard.float_exception_flags);
+        }
+    }
+}
+
+static void test_overflow(void)
+{
+    float_status s;
+
+    init_status(&s, &modes[0], true);
+    g_assert_cmphex(float32_val(float32_mul(make_float32(0x7f7fffff),
+                                            make_float32(0x40000000), &s)),
+                    ==, 0x7f800000);
+    g_assert_cmphex(s.float_exception_flags, ==,
+                    float_flag_overflow | float_flag_inexact);
+
+    init_status(&s, &modes[0], true);
+    g_assert_cmphex(float64_val(float64_add(make_float64(0xffefffffffffffffULL),
+                                            make_float64(0xffefffffffffffffULL),
+                                            &s)),
+                    ==, 0xfff0000000000000ULL);
+    g_assert_cmphex(s.float_exception_flags, ==,
+                    float_flag_overflow | float_flag_inexact);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *const names[] = {
+        [OP_ADD] = "add",
+        [OP_SUB] = "sub",
+        [OP_MUL] = "mul",
+        [OP_DIV] = "div",
+        [OP_MULADD] = "muladd",
+        [OP_SQRT] = "sqrt",
+    };
+    int op;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (op = 0; op < ARRAY_SIZE(names); op++) {
+        gchar *path;
+
+        path = g_strdup_printf("/softfloat/hardfloat/f32/%s", names[op]);
+        g_test_add_data_func(path, GINT_TO_POINTER(op), test_f32);
+        g_free(path);
+        path = g_strdup_printf("/softfloat/hardfloat/f64/%s", names[op]);
+        g_test_add_data_func(path, GINT_TO_POINTER(op), test_f64);
+        g_free(path);
+    }
+    g_test_add_func("/softfloat/hardfloat/overflow", test_overflow);
+
+    return g_test_run();
+}
@@ -552,6 +552,50 @@ static void test_io_channel_ipv4_fd(void)
 }
 
 
+static void test_io_channel_ipv4_zero_copy(void)
+{
+    SocketAddress *listen_addr = g_new0(SocketAddress, 1);
+    SocketAddress *connect_addr = g_new0(SocketAddress, 1);
+    QIOChannel *src, *dst;
+    QIOChannelSocket *ssrc;
+    QIOChannelTest *test;
+    Error *err = NULL;
+
+    listen_addr->type = SOCKET_ADDRESS_TYPE_INET;
+    listen_addr->u.inet = (InetSocketAddress) {
+        .host = g_strdup("127.0.0.1"),
+        .port = NULL, /* Auto-select */
+    };
+
+    connect_addr->type = SOCKET_ADDRESS_TYPE_INET;
+    connect_addr->u.inet = (InetSocketAddress) {
+        .host = g_strdup("127.0.0.1"),
+        .port = NULL, /* Filled in later */
+    };
+
+    test_io_channel_setup_sync(listen_addr, connect_addr, &src, &dst);
+    ssrc = QIO_CHANNEL_SOCKET(src);
+
+    if (qio_channel_socket_set_zero_copy(ssrc, true, &err) < 0) {
+        /* Not supported by this host */
+        error_free(err);
+    } else {
+        test = qio_channel_test_new();
+        qio_channel_test_run_threads(test, true, src, dst);
+        g_assert_cmpint(qio_channel_socket_flush_zero_copy(
+                            ssrc, ssrc->zero_copy_queued, &error_abort),
+                        ==, 0);
+        g_assert_cmpint(ssrc->zero_copy_sent, ==, ssrc->zero_copy_queued);
+        qio_channel_test_validate(test);
+    }
+
+    object_unref(OBJECT(src));
+    object_unref(OBJECT(dst));
+    qapi_free_SocketAddress(listen_addr);
+    qapi_free_SocketAddress(connect_addr);
+}
+
+
 int main(int argc, char **argv)
 {
     bool has_ipv4, has_ipv6;
@@ -577,6 +621,8 @@ int main(int argc, char **argv)
                         test_io_channel_ipv4_async);
         g_test_add_func("/io/channel/socket/ipv4-fd",
                         test_io_channel_ipv4_fd);
+        g_test_add_func("/io/channel/socket/ipv4-zero-copy",
+                        test_io_channel_ipv4_zero_copy);
     }
     if (has_ipv6) {
         g_test_add_func("/io/channel/socket/ipv6-sync",
@@ -174,6 +174,84 @@ static void test_encode_decode(void)
     }
 }
 
+/* Randomly dirty @new, a copy of @old, with @runs runs of up to @max_len
+ * bytes each.
+ */
+static void dirty_page(uint8_t *old, uint8_t *new, int runs, int max_len)
+{
+    int i, j;
+
+    for (i = 0; i < PAGE_SIZE; i++) {
+        old[i] = new[i] = g_test_rand_int();
+    }
+    for (i = 0; i < runs; i++) {
+        int start = g_test_rand_int_range(0, PAGE_SIZE);
+        int len = g_test_rand_int_range(1, max_len + 1);
+
+        for (j = start; j < start + len && j < PAGE_SIZE; j++) {
+            /* leave some bytes unchanged inside the run */
+            if (g_test_rand_int_range(0, 4)) {
+                new[j] = ~old[j];
+            }
+        }
+    }
+}
+
+#define N_ACCEL_PAGES 2000
+
+/* Every accelerated encoder must produce exactly the output of the
+ * portable one, including when it runs out of space.
+ */
+static void test_encode_accel(void)
+{
+    uint8_t *old = g_malloc(PAGE_SIZE * N_ACCEL_PAGES);
+    uint8_t *new = g_malloc(PAGE_SIZE * N_ACCEL_PAGES);
+    uint8_t *expected = g_malloc(PAGE_SIZE * N_ACCEL_PAGES);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    int *expected_len = g_new(int, N_ACCEL_PAGES);
+    int *dlen = g_new(int, N_ACCEL_PAGES);
+    bool first = true;
+    int i;
+
+    for (i = 0; i < N_ACCEL_PAGES; i++) {
+        int max_len = g_test_rand_bit() ? 8 : 300;
+
+        dirty_page(old + i * PAGE_SIZE, new + i * PAGE_SIZE,
+                   g_test_rand_int_range(0, 100), max_len);
+        dlen[i] = g_test_rand_bit() ? PAGE_SIZE :
+                  g_test_rand_int_range(0, PAGE_SIZE);
+    }
+
+    do {
+        for (i = 0; i < N_ACCEL_PAGES; i++) {
+            int rc = xbzrle_encode_buffer(old + i * PAGE_SIZE,
+                                          new + i * PAGE_SIZE, PAGE_SIZE,
+                                          compressed, dlen[i]);
+
+            if (first) {
+                expected_len[i] = rc;
+                if (rc > 0) {
+                    memcpy(expected + i * PAGE_SIZE, compressed, rc);
+                }
+                continue;
+            }
+            g_assert_cmpint(rc, ==, expected_len[i]);
+            if (rc > 0) {
+                g_assert(memcmp(compressed, expected + i * PAGE_SIZE,
+                                rc) == 0);
+            }
+        }
+        first = false;
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old);
+    g_free(new);
+    g_free(expected);
+    g_free(compressed);
+    g_free(expected_len);
+    g_free(dlen);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -186,6 +264,7 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
@@ -325,13 +325,40 @@ ThreadPool *aio_get_thread_pool(AioContext *ctx)
 LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 {
     if (!ctx->linux_aio) {
-        ctx->linux_aio = laio_init();
+        ctx->linux_aio = laio_init(ctx->aio_max_events);
         laio_attach_aio_context(ctx->linux_aio, ctx);
     }
     return ctx->linux_aio;
 }
 #endif
 
+void aio_context_set_aio_params(AioContext *ctx, int64_t max_events,
+                                int64_t max_batch, Error **errp)
+{
+    if (max_events < 0 || max_events > AIO_MAX_EVENTS_LIMIT) {
+        error_setg(errp, "aio-max-events must be in range [0, %d]",
+                   AIO_MAX_EVENTS_LIMIT);
+        return;
+    }
+    if (max_batch < 0 || max_batch > AIO_MAX_BATCH_LIMIT) {
+        error_setg(errp, "aio-max-batch must be in range [0, %d]",
+                   AIO_MAX_BATCH_LIMIT);
+        return;
+    }
+#ifdef CONFIG_LINUX_AIO
+    if (ctx->linux_aio && max_events != ctx->aio_max_events) {
+        error_setg(errp, "aio-max-events cannot be changed while in use");
+        return;
+    }
+#endif
+
+    /* As for the polling parameters, the batch size is read without
+     * synchronization; an outdated value may be used once.
+     */
+    ctx->aio_max_events = max_events;
+    ctx->aio_max_batch = max_batch;
+}
+
 void aio_notify(AioContext *ctx)
 {
     /* Write e.g. bh->scheduled before reading ctx->notify_me.  Pairs
@@ -429,6 +456,9 @@ AioContext *aio_context_new(Error **errp)
     ctx->poll_grow = 0;
     ctx->poll_shrink = 0;
 
+    ctx->aio_max_events = 0;
+    ctx->aio_max_batch = 0;
+
     return ctx;
 fail:
     g_source_destroy(&ctx->source);
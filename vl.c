@@ -654,6 +654,12 @@ static QemuOptsList qemu_ckpt_opts = {
         }, {
             .name = "end",
             .type = QEMU_OPT_STRING,
+        }, {
+            .name = "delta",
+            .type = QEMU_OPT_BOOL,
+        }, {
+            .name = "delta-cache",
+            .type = QEMU_OPT_SIZE,
         },
         { /* end of list */ }
     },